@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <utility>
+#include "lazy_state_machine.hpp"
+
+const size_t LazyStateMachine::DEFAULT_CACHE_SIZE;
+const uint LazyStateMachine::MAX_RESETS;
+const State LazyStateMachine::DEAD;
+const State LazyStateMachine::STEPPED;
+const State LazyStateMachine::FIRST_STATE;
+const State LazyStateMachine::UNKNOWN;
+const size_t LazyStateMachine::STATE_OVERHEAD;
+
+LazyStateMachine::LazyStateMachine()
+	: start_sets(1), start_states(1, UNKNOWN), states(FIRST_STATE), cache_size(0),
+	max_cache_size(DEFAULT_CACHE_SIZE), num_resets(0), text_resets(0), stepping_rules(false) {
+	std::fill(states[DEAD].next, states[DEAD].next + 256, DEAD);
+	std::fill(states[STEPPED].next, states[STEPPED].next + 256, UNKNOWN);
+	for(State state = DEAD; state < FIRST_STATE; state++) {
+		states[state].type = -1;
+		states[state].rule_states = NULL;
+	}
+}
+
+LazyStateMachine::LazyStateMachine(const LazyStateMachine& other)
+	: rules(other.rules), start_sets(other.start_sets), start_states(other.start_states), states(other.states),
+	state_ids(other.state_ids), cache_size(other.cache_size), max_cache_size(other.max_cache_size),
+	num_resets(other.num_resets), text_resets(other.text_resets), stepping_rules(other.stepping_rules) {
+	pointStates();
+}
+
+LazyStateMachine& LazyStateMachine::operator=(const LazyStateMachine& other) {
+	if (this == &other) return *this;
+	rules = other.rules;
+	start_sets = other.start_sets;
+	start_states = other.start_states;
+	states = other.states;
+	state_ids = other.state_ids;
+	cache_size = other.cache_size;
+	max_cache_size = other.max_cache_size;
+	num_resets = other.num_resets;
+	text_resets = other.text_resets;
+	stepping_rules = other.stepping_rules;
+	pointStates();
+	return *this;
+}
+
+// cached states point at their keys in state_ids, a copy has to point at its own
+void LazyStateMachine::pointStates() {
+	for(std::map<std::vector<uint>, State>::const_iterator it = state_ids.begin(); it != state_ids.end(); ++it) {
+		states[it->second].rule_states = &it->first;
+	}
+}
+
+// compiles the rule on its own, so it can overlap any other rule
+void LazyStateMachine::addRule(const std::string& simple_regex, int type, uint mode) {
+	if (mode >= modes()) throw std::runtime_error("mode does not exist");
+	TokenStateMachine machine;
+	machine.addRule(simple_regex, type);
+	addMachine(machine, mode);
+}
+
+void LazyStateMachine::addLiteral(const std::string& literal, int type, uint mode) {
+	if (mode >= modes()) throw std::runtime_error("mode does not exist");
+	TokenStateMachine machine;
+	machine.addLiteral(literal, type);
+	addMachine(machine, mode);
+}
+
+uint LazyStateMachine::addMode() {
+	start_sets.resize(start_sets.size() + 1);
+	start_states.push_back(UNKNOWN);
+	return start_sets.size() - 1;
+}
+
+LazyStateMachine::Iterator LazyStateMachine::begin(uint mode) {
+	Iterator iterator(this);
+	if (stepping_rules) {
+		iterator.state = start_sets[mode].empty() ? DEAD : STEPPED;
+		iterator.rule_states = start_sets[mode];
+		return iterator;
+	}
+
+	if (start_states[mode] == UNKNOWN) {
+		start_states[mode] = cacheState(start_sets[mode]);
+		if (start_states[mode] == UNKNOWN) {
+			emptyCache();
+			return begin(mode);
+		}
+	}
+	iterator.state = start_states[mode];
+	return iterator;
+}
+
+// lets the cache be used again after the last text gave up on it
+void LazyStateMachine::newText() {
+	text_resets = 0;
+	stepping_rules = false;
+}
+
+// empties the cache without counting it against the text
+void LazyStateMachine::clearCache() {
+	states.resize(FIRST_STATE);
+	state_ids.clear();
+	std::fill(start_states.begin(), start_states.end(), UNKNOWN);
+	cache_size = 0;
+}
+
+void LazyStateMachine::setCacheSize(size_t max_size) {
+	max_cache_size = max_size;
+	clearCache();
+}
+
+void LazyStateMachine::addMachine(const TokenStateMachine& machine, uint mode) {
+	Rule rule = { machine, mode };
+	rules.push_back(rule);
+	start_sets[mode].push_back(rules.size() - 1);
+	start_sets[mode].push_back(1);
+	clearCache();
+}
+
+// called when the next state of the iterator is not cached yet
+void LazyStateMachine::step(Iterator& iterator, unsigned char c) {
+	if (iterator.state == STEPPED) {
+		stepRules(iterator, c);
+		return;
+	}
+
+	State state = iterator.state;
+	nextRuleStates(*states[state].rule_states, c, next_set);
+	State next = cacheState(next_set);
+	if (next == UNKNOWN) {
+		// start over with just the current state, unless this text keeps filling the cache
+		std::vector<uint> rule_states = *states[state].rule_states;
+		emptyCache();
+		state = stepping_rules ? UNKNOWN : cacheState(rule_states);
+		next = (state == UNKNOWN) ? UNKNOWN : cacheState(next_set);
+		if (next == UNKNOWN) {
+			// too small to hold two states is no better than no cache
+			stepping_rules = true;
+			iterator.state = STEPPED;
+			iterator.rule_states.swap(rule_states);
+			stepRules(iterator, c);
+			return;
+		}
+	}
+
+	states[state].next[c] = next;
+	iterator.state = next;
+	int new_type = states[next].type;
+	iterator.type = (new_type != -1) ? new_type : iterator.type;
+}
+
+void LazyStateMachine::stepRules(Iterator& iterator, unsigned char c) {
+	nextRuleStates(iterator.rule_states, c, next_set);
+	iterator.rule_states.swap(next_set);
+	if (iterator.rule_states.empty()) {
+		iterator.state = DEAD;
+		return;
+	}
+	int new_type = ruleType(iterator.rule_states);
+	iterator.type = (new_type != -1) ? new_type : iterator.type;
+}
+
+// returns the cached state of the rules, adding it if there is room, or UNKNOWN if the cache is full
+State LazyStateMachine::cacheState(const std::vector<uint>& rule_states) {
+	if (rule_states.empty()) return DEAD;
+	auto it = state_ids.find(rule_states);
+	if (it != state_ids.end()) return it->second;
+
+	size_t size = sizeof(CachedState) + STATE_OVERHEAD + rule_states.size() * sizeof(uint);
+	if (cache_size + size > max_cache_size) return UNKNOWN;
+	cache_size += size;
+
+	State state = states.size();
+	it = state_ids.insert(std::make_pair(rule_states, state)).first;
+	states.resize(state + 1);
+	CachedState& cached = states.back();
+	std::fill(cached.next, cached.next + 256, UNKNOWN);
+	cached.type = ruleType(rule_states);
+	cached.rule_states = &it->first;
+	return state;
+}
+
+// empties the full cache, and gives up on it once the text has done so MAX_RESETS times
+void LazyStateMachine::emptyCache() {
+	clearCache();
+	num_resets++;
+	text_resets++;
+	if (text_resets >= MAX_RESETS) stepping_rules = true;
+}
+
+// steps each (rule, state) pair, dropping rules that stop matching
+void LazyStateMachine::nextRuleStates(const std::vector<uint>& rule_states, unsigned char c,
+	std::vector<uint>& next) const {
+	next.clear();
+	for(uint i = 0; i < rule_states.size(); i += 2) {
+		State state = rules[rule_states[i]].machine.getNextState(rule_states[i + 1], (char)c);
+		if (state != 0) {
+			next.push_back(rule_states[i]);
+			next.push_back(state);
+		}
+	}
+}
+
+// pairs are in the order rules were added, so the first accepting one has priority
+int LazyStateMachine::ruleType(const std::vector<uint>& rule_states) const {
+	for(uint i = 0; i < rule_states.size(); i += 2) {
+		const std::vector<int>& types = rules[rule_states[i]].machine.state_types;
+		State state = rule_states[i + 1];
+		if (state < types.size() && types[state] != -1) return types[state];
+	}
+	return -1;
+}
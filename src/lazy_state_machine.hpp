@@ -0,0 +1,131 @@
+/*
+Lazy state machine runs rule sets too large or too overlapping to compile into
+a single table. Each rule is compiled on its own by a TokenStateMachine, so
+rules never conflict with each other, and the machine as a whole is the set of
+rules still matching along with the state each one is in. When more than one
+of them accepts the text so far the rule added first gives the type.
+
+Stepping a set of rules one by one is slow, so the states of the combined
+machine are built the first time lexing reaches them and cached with a row of
+256 next states, filled in as bytes are seen. Text that keeps to familiar
+states steps through the cache as fast as through a compiled table. The cache
+is bounded in bytes, and when it is full it is emptied and built up again. A
+text that empties the cache MAX_RESETS times is then stepped through the rules
+directly (slower, but without building states that are thrown away again)
+until newText() is called.
+
+Adding states can empty the cache, so only one iterator can be used at a time.
+Starting a new one with begin() leaves the others invalid.
+
+ex)
+LazyStateMachine machine;
+machine.addRule("[a-z]+", TokenType::WORD);
+machine.addRule("if|else", TokenType::KEYWORD); // compiled on its own, "if" is still a WORD
+*/
+
+#ifndef LAZY_STATE_MACHINE_HPP
+#define LAZY_STATE_MACHINE_HPP
+
+#include <vector>
+#include <map>
+#include <string>
+#include <cstddef>
+#include "token_state_machine.hpp"
+
+class LazyStateMachine {
+public:
+	class Iterator {
+		friend class LazyStateMachine;
+
+	public:
+		explicit Iterator(LazyStateMachine* my_machine = NULL) : state(DEAD), type(-1), my_machine(my_machine) {}
+		// continues where other is, in a copy of the machine other steps
+		Iterator(LazyStateMachine* my_machine, const Iterator& other)
+			: state(other.state), type(other.type), my_machine(my_machine), rule_states(other.rule_states) {}
+		void nextState(char c) {
+			State next = my_machine->states[state].next[(unsigned char)c];
+			if (next == UNKNOWN) {
+				my_machine->step(*this, (unsigned char)c);
+				return;
+			}
+			state = next;
+			int new_type = my_machine->states[next].type;
+			type = (new_type != -1) ? new_type : type;
+		}
+		int getType() const { return type; }
+		bool atEnd() { return state == DEAD; }
+
+	private:
+		State state;
+		int type;
+		LazyStateMachine* my_machine;
+		std::vector<uint> rule_states; // (rule, state) pairs, only while the rules are stepped directly
+	};
+
+	// largest cache of states, in bytes
+	static const size_t DEFAULT_CACHE_SIZE = 1 << 20;
+
+	// times one text can empty the cache before the rules are stepped directly
+	static const uint MAX_RESETS = 3;
+
+	LazyStateMachine();
+	LazyStateMachine(const LazyStateMachine& other);
+	LazyStateMachine& operator=(const LazyStateMachine& other);
+	void addRule(const std::string& simple_regex, int type, uint mode = 0);
+	void addLiteral(const std::string& literal, int type, uint mode = 0);
+	uint addMode();
+	uint modes() const { return start_sets.size(); }
+	Iterator begin(uint mode = 0);
+	void newText();
+	void clearCache();
+	void setCacheSize(size_t max_size);
+	size_t cacheUsage() const { return cache_size; }
+	uint cachedStates() const { return states.size() - FIRST_STATE; }
+	uint cacheResets() const { return num_resets; }
+	bool steppingRules() const { return stepping_rules; }
+
+private:
+	// every byte from DEAD goes back to DEAD, and every byte from STEPPED misses the cache
+	static const State DEAD = 0;
+	static const State STEPPED = 1;
+	static const State FIRST_STATE = 2;
+	static const State UNKNOWN = 0xFFFFFFFF;
+
+	// bytes a cached state takes besides its set of rules, roughly what a map node costs
+	static const size_t STATE_OVERHEAD = 64;
+
+	struct CachedState {
+		State next[256];
+		int type;
+		const std::vector<uint>* rule_states; // the key of the state in state_ids
+	};
+
+	struct Rule {
+		TokenStateMachine machine;
+		uint mode;
+	};
+
+	std::vector<Rule> rules;
+	std::vector<std::vector<uint>> start_sets; // indexed by mode
+	std::vector<State> start_states; // cached start_sets, UNKNOWN until needed
+
+	std::vector<CachedState> states;
+	std::map<std::vector<uint>, State> state_ids;
+	size_t cache_size;
+	size_t max_cache_size;
+	uint num_resets;
+	uint text_resets;
+	bool stepping_rules;
+	std::vector<uint> next_set;
+
+	void pointStates();
+	void addMachine(const TokenStateMachine& machine, uint mode);
+	void step(Iterator& iterator, unsigned char c);
+	void stepRules(Iterator& iterator, unsigned char c);
+	State cacheState(const std::vector<uint>& rule_states);
+	void emptyCache();
+	void nextRuleStates(const std::vector<uint>& rule_states, unsigned char c, std::vector<uint>& next) const;
+	int ruleType(const std::vector<uint>& rule_states) const;
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include <memory>
+#include <thread>
+#include "reloadable_tokenizer.hpp"
+#include "tokenizer_core.hpp"
+
+const uint ReloadableTokenizer::NUM_SHARDS;
+
+ReloadableTokenizer::Reader::Reader(ReloadableTokenizer* handle) {
+	counter = &handle->state->enter();
+	my_version = handle->state->current.load();
+}
+
+ReloadableTokenizer::Reader::Reader(Reader&& other) : counter(other.counter), my_version(other.my_version) {
+	other.counter = NULL;
+}
+
+ReloadableTokenizer::Reader::~Reader() {
+	if (counter != NULL) counter->fetch_sub(1);
+}
+
+Tokenizer& ReloadableTokenizer::Reader::tokenizer() const {
+	return my_version->tokenizer;
+}
+
+uint64_t ReloadableTokenizer::Reader::version() const {
+	return my_version->number;
+}
+
+ReloadableTokenizer::ReloadableTokenizer(const RuleSet& rules) {
+	std::unique_ptr<Version> first(build(rules));
+	first->number = 1;
+	state = std::make_shared<State>(first.get());
+	first.release();
+}
+
+// a reload still running keeps the state, and deletes it when it is done
+ReloadableTokenizer::~ReloadableTokenizer() {}
+
+ReloadableTokenizer::State::State(Version* first) : epoch(0), current(first) {
+	for(uint parity = 0; parity < 2; parity++) {
+		for(uint i = 0; i < NUM_SHARDS; i++) {
+			counters[parity][i].readers = 0;
+		}
+	}
+}
+
+ReloadableTokenizer::State::~State() {
+	delete current.load();
+}
+
+// tokenizes on whichever rules are current when the call starts, like Tokenizer::tokenize()
+bool ReloadableTokenizer::tokenize(const std::string& str, std::vector<Token>* token_list) {
+	Reader reader = read();
+	TokenizerCore<RowColumnPosition, VectorSink, KeepErrors, MemorySource, IgnoreTypes, UseModes>
+		core(reader.tokenizer(), VectorSink(token_list));
+	return core.tokenize(MemorySource(str));
+}
+
+/*
+compiles the rules and publishes them, then waits for every reader of the old
+rules to leave and deletes them. If the rules throw the old ones stay current
+*/
+void ReloadableTokenizer::reload(const RuleSet& rules) {
+	state->reload(rules);
+}
+
+void ReloadableTokenizer::State::reload(const RuleSet& rules) {
+	std::unique_ptr<Version> next(build(rules));
+
+	std::lock_guard<std::mutex> guard(reload_lock);
+	next->number = current.load()->number + 1;
+	Version* old = current.exchange(next.release());
+	waitForReaders();
+	delete old;
+}
+
+/*
+runs reload() on a detached thread that shares the state, so neither dropping
+the future nor destroying the handle waits for it. The future rethrows anything
+it threw
+*/
+std::future<void> ReloadableTokenizer::reloadAsync(const RuleSet& rules) {
+	std::shared_ptr<std::promise<void>> done = std::make_shared<std::promise<void>>();
+	std::future<void> result = done->get_future();
+	std::shared_ptr<State> shared = state;
+	std::thread([shared, rules, done]() {
+		try {
+			shared->reload(rules);
+			done->set_value();
+		} catch (...) {
+			done->set_exception(std::current_exception());
+		}
+	}).detach();
+	return result;
+}
+
+uint64_t ReloadableTokenizer::version() const {
+	return state->current.load()->number;
+}
+
+// static
+ReloadableTokenizer::Version* ReloadableTokenizer::build(const RuleSet& rules) {
+	std::unique_ptr<Version> version(new Version());
+	rules(version->tokenizer);
+	version->tokenizer.compile();
+	return version.release();
+}
+
+/*
+registers a reader in the counter of its shard for the current epoch. If the
+epoch moved on in between the reader may have been missed, so it tries again
+*/
+std::atomic<uint64_t>& ReloadableTokenizer::State::enter() {
+	size_t shard = std::hash<std::thread::id>()(std::this_thread::get_id()) % NUM_SHARDS;
+	while(true) {
+		uint64_t cur_epoch = epoch.load();
+		std::atomic<uint64_t>& readers = counters[cur_epoch & 1][shard].readers;
+		readers.fetch_add(1);
+		if (epoch.load() == cur_epoch) return readers;
+		readers.fetch_sub(1);
+	}
+}
+
+/*
+a reader that loaded the old version registered before the exchange, in the
+epoch of either parity, so once both have drained no reader can still hold it.
+Readers that register after the last move are never waited on
+*/
+void ReloadableTokenizer::State::waitForReaders() {
+	for(uint round = 0; round < 2; round++) {
+		uint64_t old_epoch = epoch.fetch_add(1);
+		for(uint i = 0; i < NUM_SHARDS; i++) {
+			while(counters[old_epoch & 1][i].readers.load() != 0) {
+				std::this_thread::yield();
+			}
+		}
+	}
+}
@@ -0,0 +1,120 @@
+/*
+Reloadable tokenizer lets a long running service change its rules without
+stopping. reload() builds and compiles a new tokenizer from a rule set while
+the old one is still in use, then publishes it with a single atomic exchange.
+Calls that are already running finish on the old tokenizer, and it is deleted
+once the last of them has left. reloadAsync() does the same on a detached
+thread that shares the state of the handle, so the caller does not wait for it
+unless it waits on the returned future.
+
+Readers never take a lock. Each read registers in a counter of the current
+epoch, one of several picked by thread so threads rarely share a cache line. A
+reload moves the epoch on twice, each time waiting for the counters of the
+epoch it left to drain, after which no reader can still hold the old tokenizer.
+
+A Reader keeps its tokenizer alive until it is destroyed. The tokenizer is
+shared, so it must only be read: tokenize() here, TokenizerCore and
+TokenizerBatch only read it, while Tokenizer::tokenize() and feed() keep the
+state of the call in it. Readers must not outlive the handle, but a reload
+running in the background can.
+
+ex)
+ReloadableTokenizer lexer(rulesFrom(config));
+
+// on any request thread
+lexer.tokenize(request, &token_list);
+
+// when the config changes
+lexer.reloadAsync(rulesFrom(new_config));
+*/
+
+#ifndef RELOADABLE_TOKENIZER_HPP
+#define RELOADABLE_TOKENIZER_HPP
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "token.hpp"
+#include "tokenizer.hpp"
+
+class ReloadableTokenizer {
+	struct Version;
+
+public:
+	// adds the rules (and modes) of a rule set to an empty tokenizer
+	typedef std::function<void(Tokenizer&)> RuleSet;
+
+	static const uint NUM_SHARDS = 16;
+
+	class Reader {
+	public:
+		Reader(Reader&& other);
+		~Reader();
+		Reader(const Reader&) = delete;
+		Reader& operator=(const Reader&) = delete;
+
+		Tokenizer& tokenizer() const;
+		uint64_t version() const;
+
+	private:
+		friend class ReloadableTokenizer;
+
+		std::atomic<uint64_t>* counter; // NULL once moved from
+		Version* my_version;
+
+		explicit Reader(ReloadableTokenizer* handle);
+	};
+
+	explicit ReloadableTokenizer(const RuleSet& rules);
+	~ReloadableTokenizer();
+	ReloadableTokenizer(const ReloadableTokenizer&) = delete;
+	ReloadableTokenizer& operator=(const ReloadableTokenizer&) = delete;
+
+	Reader read() { return Reader(this); }
+	bool tokenize(const std::string& str, std::vector<Token>* token_list);
+
+	void reload(const RuleSet& rules);
+	std::future<void> reloadAsync(const RuleSet& rules);
+
+	// 1 for the rules given to the constructor, increased by every reload
+	uint64_t version() const;
+
+private:
+	struct Version {
+		Tokenizer tokenizer;
+		uint64_t number;
+	};
+
+	// kept on separate cache lines so readers of different shards do not contend
+	struct alignas(64) Counter {
+		std::atomic<uint64_t> readers;
+	};
+
+	// everything a reload touches, shared with reloads running on their own thread
+	struct State {
+		Counter counters[2][NUM_SHARDS]; // indexed by the parity of the epoch
+		std::atomic<uint64_t> epoch;
+		std::atomic<Version*> current;
+		std::mutex reload_lock; // only reloads wait on it
+
+		explicit State(Version* first);
+		~State();
+		State(const State&) = delete;
+		State& operator=(const State&) = delete;
+
+		void reload(const RuleSet& rules);
+		std::atomic<uint64_t>& enter();
+		void waitForReaders();
+	};
+
+	std::shared_ptr<State> state;
+
+	static Version* build(const RuleSet& rules);
+};
+
+#endif
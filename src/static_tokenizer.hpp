@@ -0,0 +1,898 @@
+/*
+Compile time version of the token state machine, only available when compiling
+with -std=c++17 or later. The rules are given as a constant array and the state
+table is built by the compiler into read only arrays, so there is no start up
+cost and rules that conflict are compile errors instead of runtime_errors.
+
+Rules are compiled exactly like TokenStateMachine::addRule() (the functions
+below mirror the compileRegex* functions one to one) so a StaticTokenizer gives
+the same tokens as a Tokenizer with the same rules added in the same order.
+Modes are not supported.
+
+The table is built twice: once with room for MaxStates states to count them and
+again with exactly that many states, using the smallest integer type that can
+hold a state number.
+
+ex)
+static constexpr StaticRule rules[] = {
+	{ Tokenizer::WHITESPACE, WHITESPACE, true },
+	{ Tokenizer::WORD_RULE, WORD },
+	{ Tokenizer::HEX_RULE, HEX }
+};
+StaticTokenizer<rules> tokenizer;
+tokenizer.tokenize(text, &token_list);
+*/
+
+#ifndef STATIC_TOKENIZER_HPP
+#define STATIC_TOKENIZER_HPP
+
+#if __cplusplus >= 201703L
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include "token.hpp"
+#include "utf8.hpp"
+#include "utf8_categories.hpp"
+
+struct StaticRule {
+	const char* rule;
+	int type;
+	bool ignore = false;
+};
+
+// reaching a throw while evaluating a constant expression is a compile error
+constexpr void staticAssert(bool condition, const char* message) {
+	if (!condition) throw std::logic_error(message);
+}
+
+template<typename T, size_t Capacity>
+class StaticVector {
+public:
+	constexpr StaticVector() : items(), count(0) {}
+	constexpr StaticVector(size_t size, const T& item) : items(), count(0) {
+		for(size_t i = 0; i < size; i++) push_back(item);
+	}
+
+	constexpr void push_back(const T& item) {
+		staticAssert(count < Capacity, "static vector is full");
+		items[count++] = item;
+	}
+	constexpr void insert(size_t index, const T& item) {
+		staticAssert(count < Capacity, "static vector is full");
+		for(size_t i = count; i > index; i--) items[i] = items[i - 1];
+		items[index] = item;
+		count++;
+	}
+	constexpr void erase(size_t index) {
+		for(size_t i = index + 1; i < count; i++) items[i - 1] = items[i];
+		count--;
+	}
+	constexpr void append(const StaticVector& other) {
+		for(size_t i = 0; i < other.size(); i++) push_back(other[i]);
+	}
+	constexpr void clear() { count = 0; }
+	constexpr size_t size() const { return count; }
+	constexpr bool empty() const { return count == 0; }
+	constexpr T& operator[](size_t index) { return items[index]; }
+	constexpr const T& operator[](size_t index) const { return items[index]; }
+
+	constexpr bool operator==(const StaticVector& other) const {
+		if (count != other.count) return false;
+		for(size_t i = 0; i < count; i++) {
+			if (!(items[i] == other.items[i])) return false;
+		}
+		return true;
+	}
+
+private:
+	T items[Capacity];
+	size_t count;
+};
+
+class StaticCodePointSet {
+public:
+	static const size_t CAPACITY = 128;
+
+	constexpr void add(utf8::CodePoint first, utf8::CodePoint last) {
+		size_t index = 0;
+		while(index < ranges.size() && ranges[index].last + 1 < first) index++;
+
+		utf8::Range merged = { first, last };
+		while(index < ranges.size() && ranges[index].first <= last + 1) {
+			if (ranges[index].first < merged.first) merged.first = ranges[index].first;
+			if (ranges[index].last > merged.last) merged.last = ranges[index].last;
+			ranges.erase(index);
+		}
+		ranges.insert(index, merged);
+	}
+	constexpr void add(utf8::CodePoint cp) { add(cp, cp); }
+	constexpr void add(const StaticCodePointSet& other) {
+		for(size_t i = 0; i < other.ranges.size(); i++) add(other.ranges[i].first, other.ranges[i].last);
+	}
+	constexpr bool empty() const { return ranges.empty(); }
+	constexpr size_t size() const { return ranges.size(); }
+	constexpr const utf8::Range& operator[](size_t index) const { return ranges[index]; }
+
+	constexpr StaticCodePointSet complement() const {
+		StaticCodePointSet result;
+		utf8::CodePoint next = 1;
+		for(size_t i = 0; i < ranges.size(); i++) {
+			if (ranges[i].first > next) result.addValid(next, ranges[i].first - 1);
+			if (ranges[i].last + 1 > next) next = ranges[i].last + 1;
+		}
+		if (next <= utf8::MAX_CODE_POINT) result.addValid(next, utf8::MAX_CODE_POINT);
+		return result;
+	}
+
+	constexpr StaticCodePointSet intersection(const StaticCodePointSet& other) const {
+		StaticCodePointSet result;
+		size_t i = 0;
+		size_t j = 0;
+		while(i < ranges.size() && j < other.ranges.size()) {
+			const utf8::Range& a = ranges[i];
+			const utf8::Range& b = other.ranges[j];
+			utf8::CodePoint first = (a.first > b.first) ? a.first : b.first;
+			utf8::CodePoint last = (a.last < b.last) ? a.last : b.last;
+			if (first <= last) result.ranges.push_back(utf8::Range{ first, last });
+			if (a.last < b.last) i++;
+			else j++;
+		}
+		return result;
+	}
+
+	// the set with the other case of every ASCII letter in it added
+	constexpr StaticCodePointSet caseFolded() const {
+		StaticCodePointSet result = *this;
+		for(size_t i = 0; i < ranges.size(); i++) {
+			utf8::CodePoint first = (ranges[i].first > 'A') ? ranges[i].first : 'A';
+			utf8::CodePoint last = (ranges[i].last < 'Z') ? ranges[i].last : 'Z';
+			if (first <= last) result.add(first + ('a' - 'A'), last + ('a' - 'A'));
+			first = (ranges[i].first > 'a') ? ranges[i].first : 'a';
+			last = (ranges[i].last < 'z') ? ranges[i].last : 'z';
+			if (first <= last) result.add(first - ('a' - 'A'), last - ('a' - 'A'));
+		}
+		return result;
+	}
+
+private:
+	StaticVector<utf8::Range, CAPACITY> ranges;
+
+	// adds a range without surrogates
+	constexpr void addValid(utf8::CodePoint first, utf8::CodePoint last) {
+		if (first < utf8::SURROGATE_FIRST) {
+			add(first, (last < utf8::SURROGATE_FIRST) ? last : utf8::SURROGATE_FIRST - 1);
+		}
+		if (last > utf8::SURROGATE_LAST) {
+			add((first > utf8::SURROGATE_LAST) ? first : utf8::SURROGATE_LAST + 1, last);
+		}
+	}
+};
+
+template<size_t MaxStates>
+class StaticStateMachineBuilder {
+public:
+	typedef uint32_t State;
+	typedef StaticVector<State, 64> States;
+
+	struct ByteSequence {
+		utf8::ByteRange ranges[utf8::MAX_SEQUENCE_LENGTH];
+		unsigned int length;
+	};
+	typedef StaticVector<ByteSequence, 256> ByteSequences;
+
+	static const uint32_t NO_MAXIMUM = 0xFFFFFFFF;
+	static const uint32_t MAX_REPETITIONS = 1000;
+
+	State transitions[MaxStates][256];
+	int types[MaxStates];
+	size_t rows;
+	bool fold_case; // set by addRule() for the rule being compiled
+
+	constexpr StaticStateMachineBuilder() : transitions(), types(), rows(2), fold_case(false) {
+		for(size_t i = 0; i < MaxStates; i++) types[i] = -1;
+	}
+
+	constexpr void addRule(std::string_view str, int type) {
+		staticAssert(str.size() > 0, "string cannot be empty");
+		fold_case = (str.substr(0, 4) == "(?i)");
+		if (fold_case) str.remove_prefix(4);
+		staticAssert(str.size() > 0, "string cannot be empty");
+		States end_states = compileRegexSequence(States(1, 1), str);
+		for(size_t i = 0; i < end_states.size(); i++) {
+			setStateType(end_states[i], type);
+		}
+	}
+
+private:
+	constexpr State newState() const { return rows; }
+
+	constexpr State addState() {
+		staticAssert(rows < MaxStates, "too many states, increase MaxStates");
+		return rows++;
+	}
+
+	constexpr void setStateType(State state, int type) {
+		int old_type = types[state];
+		if (type != old_type) {
+			staticAssert(old_type == -1, "trying to override state type");
+			types[state] = type;
+		}
+	}
+
+	constexpr void setStateChange(State from_state, unsigned char c, State to_state) {
+		staticAssert(from_state != 0, "cannot change end state");
+		staticAssert(to_state != 1, "cannot go back to start state");
+
+		State max_state = (from_state > to_state) ? from_state : to_state;
+		staticAssert(max_state < MaxStates, "too many states, increase MaxStates");
+		if (max_state >= rows) rows = max_state + 1;
+
+		State& transition = transitions[from_state][c];
+		if (transition == 0) {
+			transition = to_state;
+		} else {
+			staticAssert(transition == to_state, "trying to override state change");
+		}
+	}
+
+	constexpr State getNextState(State state, unsigned char c) const {
+		staticAssert(state < rows, "state does not exist");
+		return transitions[state][c];
+	}
+
+	constexpr State chooseState(State cur_state, unsigned char c) const {
+		State existing_state = getNextState(cur_state, c);
+		return (existing_state == 0) ? newState() : existing_state;
+	}
+
+	constexpr State chooseState(State cur_state, const ByteSequences& sequences) const {
+		for(size_t i = 0; i < sequences.size(); i++) {
+			State state = cur_state;
+			for(unsigned int b = 0; b < sequences[i].length && state != 0; b++) {
+				state = getNextState(state, sequences[i].ranges[b].first);
+			}
+			if (state != 0) return state;
+		}
+		return 0;
+	}
+
+	static constexpr bool isQuantifier(char c) {
+		return (c == '?' || c == '+' || c == '*');
+	}
+
+	static constexpr char getEscapedCharacter(char c) {
+		switch(c) {
+			case 'a': return '\a';
+			case 'b': return '\b';
+			case 'f': return '\f';
+			case 'n': return '\n';
+			case 'r': return '\r';
+			case 't': return '\t';
+			case 'v': return '\v';
+			default: return c;
+		}
+	}
+
+	constexpr States compileRegexSequence(States start_states, std::string_view str) {
+		States end_states;
+		size_t index = 0;
+
+		while(index < str.size()) {
+			end_states.clear();
+
+			// parse all group options
+			StaticVector<std::string_view, 32> groups;
+			bool add_option = false;
+
+			do {
+				std::string_view group = parseRegexGroup(str, index);
+				add_option = false;
+				if (group.size() > 0) {
+					groups.push_back(group);
+
+					if (index < str.size() && str[index] == '|') {
+						index++;
+						staticAssert(index < str.size(), "no group on right side of bar");
+						add_option = true;
+					}
+				}
+			} while(add_option);
+
+			// compile each sub-sequence
+			for(size_t i = 0; i < groups.size(); i++) {
+				end_states.append(compileRegexGroup(start_states, groups[i]));
+			}
+
+			// prepare for next iteration
+			start_states = end_states;
+		}
+		return end_states;
+	}
+
+	static constexpr std::string_view parseRegexGroup(std::string_view str, size_t& index) {
+		size_t start = index;
+		if (index < str.size()) {
+			parseRegexAtom(str, index);
+
+			uint32_t min_passes = 0;
+			uint32_t max_passes = 0;
+			while(parseQuantifier(str, index, min_passes, max_passes));
+		}
+		return str.substr(start, index - start);
+	}
+
+	static constexpr void parseRegexAtom(std::string_view str, size_t& index) {
+		if (index < str.size()) {
+			char c = str[index++];
+			staticAssert(!isQuantifier(c), "group cannot start with quantifier");
+
+			if (c == '(' || c == '[') {
+				index--;
+				parseMatchingBrackets(str, index);
+			} else {
+				bool escaped = false;
+				if (c == '\\') {
+					staticAssert(index < str.size(), "no character after escape");
+					escaped = true;
+					c = str[index++];
+				}
+
+				if (escaped && (c == 'x' || c == 'p') && index < str.size() && str[index] == '{') {
+					size_t close = str.find('}', index);
+					staticAssert(close != std::string_view::npos, "no closing brace");
+					index = close + 1;
+				}
+
+				// keep multi-byte characters together so quantifiers apply to all of it
+				while(index < str.size() && utf8::isContinuation(str[index])) index++;
+			}
+		}
+	}
+
+	static constexpr bool parseQuantifier(std::string_view str, size_t& index,
+			uint32_t& min_passes, uint32_t& max_passes) {
+		if (index >= str.size()) return false;
+
+		char q = str[index];
+		if (isQuantifier(q)) {
+			min_passes = (q == '+') ? 1 : 0;
+			max_passes = (q == '?') ? 1 : NO_MAXIMUM;
+			index++;
+			return true;
+		}
+		if (q != '{') return false;
+
+		size_t cur = index + 1;
+		size_t first_digit = cur;
+		uint32_t min_value = 0;
+		while(cur < str.size() && str[cur] >= '0' && str[cur] <= '9' && cur - first_digit < 5) {
+			min_value = min_value * 10 + (str[cur++] - '0');
+		}
+		if (cur == first_digit || cur >= str.size()) return false;
+
+		uint32_t max_value = min_value;
+		if (str[cur] == ',') {
+			cur++;
+			first_digit = cur;
+			max_value = 0;
+			while(cur < str.size() && str[cur] >= '0' && str[cur] <= '9' && cur - first_digit < 5) {
+				max_value = max_value * 10 + (str[cur++] - '0');
+			}
+			if (cur == first_digit) max_value = NO_MAXIMUM;
+		}
+		if (cur >= str.size() || str[cur] != '}') return false;
+
+		staticAssert(min_value <= max_value, "repetition minimum is more than its maximum");
+		staticAssert(min_value <= MAX_REPETITIONS && (max_value <= MAX_REPETITIONS || max_value == NO_MAXIMUM),
+			"too many repetitions");
+		min_passes = min_value;
+		max_passes = max_value;
+		index = cur + 1;
+		return true;
+	}
+
+	static constexpr void parseMatchingBrackets(std::string_view str, size_t& index) {
+		staticAssert(index < str.size(), "index out of bounds");
+		char open_bracket = str[index];
+		char close_bracket = (open_bracket == '(') ? ')' : ']';
+		size_t bracket_depth = 1;
+		index++;
+		bool escaped = false;
+		while(index < str.size() && bracket_depth > 0) {
+			char c = str[index++];
+			if (!escaped) {
+				if (c == '\\') escaped = true;
+				else if (c == open_bracket) bracket_depth++;
+				else if (c == close_bracket) bracket_depth--;
+			} else {
+				escaped = false;
+			}
+		}
+		staticAssert(bracket_depth == 0, "number of brackets do not match");
+	}
+
+	constexpr States compileRegexGroup(States start_states, std::string_view str) {
+		States end_states;
+
+		staticAssert(str.size() > 0, "group string is empty");
+		char front = str.front();
+		size_t atom_end = 0;
+		parseRegexAtom(str, atom_end);
+
+		if (atom_end < str.size()) {
+			end_states = compileRegexQuantifier(start_states, str);
+		} else if (front == '[') {
+			end_states = compileRegexBracketExpression(start_states, str.substr(1, str.size()-2));
+		} else if (front == '(') {
+			end_states = compileRegexSequence(start_states, str.substr(1, str.size()-2));
+		} else if (front == '.') {
+			StaticCodePointSet any;
+			getCategory("Any", any);
+			end_states = compileRegexCodePoints(start_states, any);
+		} else {
+			size_t index = 0;
+			utf8::CodePoint cp = 0;
+			StaticCodePointSet char_class;
+			bool is_char_class = parseRegexCharacter(str, index, cp, char_class);
+			staticAssert(index == str.size(), "unexpected characters in group");
+
+			if (is_char_class) {
+				end_states = compileRegexCodePoints(start_states, char_class);
+			} else if (cp >= 0x80 || (fold_case && isAsciiLetter(cp))) {
+				char_class.add(cp);
+				end_states = compileRegexCodePoints(start_states, char_class);
+			} else {
+				unsigned char c = (unsigned char)cp;
+				State next_state = chooseState(start_states[0], c);
+				for(size_t i = 0; i < start_states.size(); i++) {
+					setStateChange(start_states[i], c, next_state);
+				}
+				end_states.push_back(next_state);
+			}
+		}
+		return end_states;
+	}
+
+	constexpr States compileRegexQuantifier(States start_states, std::string_view str) {
+		size_t index = 0;
+		parseRegexAtom(str, index);
+
+		size_t last = index;
+		uint32_t min_passes = 0;
+		uint32_t max_passes = 0;
+		while(index < str.size()) {
+			last = index;
+			staticAssert(parseQuantifier(str, index, min_passes, max_passes), "back character is not a quantifier");
+		}
+		staticAssert(last > 0 && last < str.size(), "back character is not a quantifier");
+
+		return compileRegexRepetition(start_states, str.substr(0, last), min_passes, max_passes);
+	}
+
+	constexpr States compileRegexRepetition(States start_states, std::string_view str,
+			uint32_t min_passes, uint32_t max_passes) {
+		States cur_states = start_states;
+		bool infinite_passes = (max_passes == NO_MAXIMUM);
+		uint32_t required_passes = (infinite_passes && min_passes > 0) ? min_passes - 1 : min_passes;
+		for(uint32_t i = 0; i < required_passes; i++) {
+			cur_states = compileRegexGroup(cur_states, str);
+		}
+
+		States end_states;
+		if (infinite_passes) {
+			end_states = compileRegexGroup(cur_states, str);
+			States second_pass_start_states(1, cur_states[0]);
+			second_pass_start_states.append(end_states);
+			States should_be_the_same = compileRegexGroup(second_pass_start_states, str);
+			staticAssert(end_states == should_be_the_same, "states should be the same");
+
+			if (min_passes == 0) {
+				end_states.append(cur_states);
+			}
+		} else {
+			end_states = cur_states;
+			for(uint32_t i = min_passes; i < max_passes; i++) {
+				cur_states = compileRegexGroup(cur_states, str);
+				States next_end_states = cur_states;
+				next_end_states.append(end_states);
+				end_states = next_end_states;
+			}
+		}
+		return end_states;
+	}
+
+	constexpr States compileRegexBracketExpression(States start_states, std::string_view str) {
+		return compileRegexCodePoints(start_states, parseBracketExpression(str, fold_case));
+	}
+
+	static constexpr bool isAsciiLetter(utf8::CodePoint cp) {
+		return (cp >= 'a' && cp <= 'z') || (cp >= 'A' && cp <= 'Z');
+	}
+
+	static constexpr StaticCodePointSet parseBracketExpression(std::string_view str, bool fold_case) {
+		staticAssert(str.size() > 0, "bracket expression string is empty");
+		StaticCodePointSet char_group;
+		StaticCodePointSet intersected_group;
+		bool intersecting = false;
+		bool excluded = false;
+		bool spanning = false;
+		bool can_span = false;
+		utf8::CodePoint last_cp = 0;
+		size_t index = 0;
+
+		if (str[0] == '^') {
+			excluded = true;
+			index++;
+		}
+
+		while(index < str.size()) {
+			size_t item_start = index;
+
+			if (str[index] == '&' && index + 1 < str.size() && str[index + 1] == '&') {
+				staticAssert(!spanning, "intersection cannot end a span");
+				intersected_group = intersecting ? intersected_group.intersection(char_group) : char_group;
+				intersecting = true;
+				char_group = StaticCodePointSet();
+				can_span = false;
+				index += 2;
+				continue;
+			}
+
+			if (str[index] == '[') {
+				staticAssert(!spanning, "bracket expression cannot end a span");
+				parseMatchingBrackets(str, index);
+				char_group.add(parseBracketExpression(str.substr(item_start + 1, index - item_start - 2), fold_case));
+				can_span = false;
+				continue;
+			}
+
+			utf8::CodePoint cp = 0;
+			StaticCodePointSet char_class;
+			bool is_char_class = parseRegexCharacter(str, index, cp, char_class);
+
+			if (is_char_class) {
+				staticAssert(!spanning, "character class cannot end a span");
+				char_group.add(char_class);
+				can_span = false;
+			} else if (can_span && str[item_start] == '-' && index < str.size()) {
+				spanning = true;
+				can_span = false;
+			} else if (spanning) {
+				staticAssert(last_cp <= cp, "span is out of order");
+				char_group.add(last_cp, cp);
+				spanning = false;
+			} else {
+				char_group.add(cp);
+				last_cp = cp;
+				can_span = true;
+			}
+		}
+
+		if (intersecting) {
+			char_group = intersected_group.intersection(char_group);
+		}
+		if (fold_case) {
+			char_group = char_group.caseFolded();
+		}
+		if (excluded) {
+			char_group = char_group.complement();
+		}
+		return char_group;
+	}
+
+	constexpr States compileRegexCodePoints(States start_states, const StaticCodePointSet& group) {
+		staticAssert(!group.empty(), "character group is empty");
+		StaticCodePointSet char_group = fold_case ? group.caseFolded() : group;
+		ByteSequences sequences;
+		for(size_t i = 0; i < char_group.size(); i++) {
+			splitRange(char_group[i].first, char_group[i].last, sequences);
+		}
+
+		// every character ends in the same state
+		State end_state = chooseState(start_states[0], sequences);
+		if (end_state == 0) end_state = addState();
+
+		for(size_t i = 0; i < sequences.size(); i++) {
+			const ByteSequence& sequence = sequences[i];
+			States cur_states = start_states;
+
+			for(unsigned int b = 0; b < sequence.length; b++) {
+				const utf8::ByteRange& range = sequence.ranges[b];
+				State next_state = end_state;
+				if (b + 1 < sequence.length) {
+					next_state = getNextState(cur_states[0], range.first);
+					if (next_state == 0) next_state = addState();
+				}
+
+				for(size_t s = 0; s < cur_states.size(); s++) {
+					for(unsigned int c = range.first; c <= range.last; c++) {
+						setStateChange(cur_states[s], (unsigned char)c, next_state);
+					}
+				}
+				cur_states = States(1, next_state);
+			}
+		}
+		return States(1, end_state);
+	}
+
+	// ASCII only like the classes of TokenStateMachine
+	static constexpr bool getCharacterClass(char c, StaticCodePointSet& char_class) {
+		std::string_view chars;
+		switch(c) {
+			case 'd': chars = "0123456789"; break;
+			case 'w': chars = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_"; break;
+			case 's': chars = " \t\r\f\n\v"; break;
+			case 'l': chars = "abcdefghijklmnopqrstuvwxyz"; break;
+			case 'u': chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"; break;
+			case 'h': chars = "0123456789abcdefABCDEF"; break;
+			default: return false;
+		}
+		for(size_t i = 0; i < chars.size(); i++) char_class.add((unsigned char)chars[i]);
+		return true;
+	}
+
+	static constexpr bool getCategory(std::string_view name, StaticCodePointSet& char_class) {
+		if (name == "L") {
+			for(unsigned int i = 0; i < utf8::NUM_LETTER_CATEGORIES; i++) {
+				getCategory(utf8::LETTER_CATEGORIES[i], char_class);
+			}
+			return true;
+		}
+		for(unsigned int i = 0; i < utf8::NUM_CATEGORIES; i++) {
+			const utf8::Category& category = utf8::CATEGORIES[i];
+			if (name == category.name) {
+				for(unsigned int r = 0; r < category.size; r++) {
+					char_class.add(category.ranges[r].first, category.ranges[r].last);
+				}
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static constexpr bool decode(std::string_view str, size_t& index, utf8::CodePoint& cp) {
+		unsigned char lead = str[index];
+		unsigned int length = utf8::sequenceLength(lead);
+		if (length == 1) {
+			cp = lead;
+			index++;
+			return lead < 0x80;
+		}
+		if (index + length > str.size()) return false;
+
+		cp = lead & (0xFF >> (length + 1));
+		for(unsigned int i = 1; i < length; i++) {
+			unsigned char c = str[index + i];
+			if (!utf8::isContinuation(c)) return false;
+			cp = (cp << 6) | (c & 0x3F);
+		}
+		if (!utf8::isValidCodePoint(cp, length)) return false;
+		index += length;
+		return true;
+	}
+
+	static constexpr bool parseRegexCharacter(std::string_view str, size_t& index,
+			utf8::CodePoint& cp, StaticCodePointSet& char_class) {
+		staticAssert(index < str.size(), "index out of bounds");
+
+		if (str[index] != '\\') {
+			staticAssert(decode(str, index, cp), "invalid UTF-8 in rule");
+			return false;
+		}
+
+		index++;
+		staticAssert(index < str.size(), "no character after escape");
+		char c = str[index++];
+
+		if ((c == 'x' || c == 'p') && index < str.size() && str[index] == '{') {
+			size_t close = str.find('}', index);
+			staticAssert(close != std::string_view::npos, "no closing brace");
+			std::string_view name = str.substr(index + 1, close - index - 1);
+			index = close + 1;
+
+			if (c == 'p') {
+				staticAssert(getCategory(name, char_class), "unknown category");
+				return true;
+			}
+
+			staticAssert(name.size() > 0 && name.size() <= 6, "invalid code point");
+			cp = 0;
+			for(size_t i = 0; i < name.size(); i++) {
+				char h = name[i];
+				unsigned int digit = (h >= '0' && h <= '9') ? h - '0'
+					: (h >= 'a' && h <= 'f') ? h - 'a' + 10
+					: (h >= 'A' && h <= 'F') ? h - 'A' + 10 : 16;
+				staticAssert(digit < 16, "invalid code point");
+				cp = (cp << 4) | digit;
+			}
+			staticAssert(cp > 0 && cp <= utf8::MAX_CODE_POINT
+				&& (cp < utf8::SURROGATE_FIRST || cp > utf8::SURROGATE_LAST), "invalid code point");
+			return false;
+		}
+
+		if (getCharacterClass(c, char_class)) return true;
+
+		cp = (unsigned char)getEscapedCharacter(c);
+		return false;
+	}
+
+	static constexpr unsigned int encode(utf8::CodePoint cp, unsigned char* bytes) {
+		if (cp < 0x80) {
+			bytes[0] = cp;
+			return 1;
+		} else if (cp < 0x800) {
+			bytes[0] = 0xC0 | (cp >> 6);
+			bytes[1] = 0x80 | (cp & 0x3F);
+			return 2;
+		} else if (cp < 0x10000) {
+			bytes[0] = 0xE0 | (cp >> 12);
+			bytes[1] = 0x80 | ((cp >> 6) & 0x3F);
+			bytes[2] = 0x80 | (cp & 0x3F);
+			return 3;
+		}
+		bytes[0] = 0xF0 | (cp >> 18);
+		bytes[1] = 0x80 | ((cp >> 12) & 0x3F);
+		bytes[2] = 0x80 | ((cp >> 6) & 0x3F);
+		bytes[3] = 0x80 | (cp & 0x3F);
+		return 4;
+	}
+
+	// same as the splitting in utf8::sequences()
+	static constexpr void splitRange(utf8::CodePoint first, utf8::CodePoint last, ByteSequences& result) {
+		if (first > last) return;
+
+		if (first <= utf8::SURROGATE_LAST && last >= utf8::SURROGATE_FIRST) {
+			if (first < utf8::SURROGATE_FIRST) splitRange(first, utf8::SURROGATE_FIRST - 1, result);
+			if (last > utf8::SURROGATE_LAST) splitRange(utf8::SURROGATE_LAST + 1, last, result);
+			return;
+		}
+
+		const utf8::CodePoint length_limits[] = { 0x7F, 0x7FF, 0xFFFF };
+		for(unsigned int i = 0; i < 3; i++) {
+			utf8::CodePoint limit = length_limits[i];
+			if (first <= limit && last > limit) {
+				splitRange(first, limit, result);
+				splitRange(limit + 1, last, result);
+				return;
+			}
+		}
+
+		for(unsigned int i = 1; i < utf8::MAX_SEQUENCE_LENGTH; i++) {
+			utf8::CodePoint mask = (1u << (6 * i)) - 1;
+			if ((first & ~mask) != (last & ~mask)) {
+				if ((first & mask) != 0) {
+					splitRange(first, first | mask, result);
+					splitRange((first | mask) + 1, last, result);
+					return;
+				}
+				if ((last & mask) != mask) {
+					splitRange(first, (last & ~mask) - 1, result);
+					splitRange(last & ~mask, last, result);
+					return;
+				}
+			}
+		}
+
+		unsigned char first_bytes[utf8::MAX_SEQUENCE_LENGTH] = {};
+		unsigned char last_bytes[utf8::MAX_SEQUENCE_LENGTH] = {};
+		ByteSequence sequence = {};
+		sequence.length = encode(first, first_bytes);
+		encode(last, last_bytes);
+		for(unsigned int i = 0; i < sequence.length; i++) {
+			sequence.ranges[i].first = first_bytes[i];
+			sequence.ranges[i].last = last_bytes[i];
+		}
+		result.push_back(sequence);
+	}
+};
+
+template<typename State, size_t Rows>
+struct StaticStateTable {
+	State transitions[Rows << 8];
+	int types[Rows];
+};
+
+template<const auto& Rules, size_t MaxStates = 512>
+class StaticTokenizer {
+public:
+	static constexpr size_t NUM_RULES = sizeof(Rules) / sizeof(StaticRule);
+
+	template<size_t Capacity>
+	static constexpr StaticStateMachineBuilder<Capacity> build() {
+		StaticStateMachineBuilder<Capacity> builder;
+		for(size_t i = 0; i < NUM_RULES; i++) {
+			builder.addRule(Rules[i].rule, Rules[i].type);
+		}
+		return builder;
+	}
+
+	static constexpr size_t NUM_STATES = build<MaxStates>().rows;
+
+	typedef std::conditional_t<(NUM_STATES <= 0x100), uint8_t,
+		std::conditional_t<(NUM_STATES <= 0x10000), uint16_t, uint32_t>> State;
+	typedef StaticStateTable<State, NUM_STATES> Table;
+
+	static constexpr Table makeTable() {
+		StaticStateMachineBuilder<NUM_STATES> builder = build<NUM_STATES>();
+		Table table = {};
+		for(size_t row = 0; row < NUM_STATES; row++) {
+			for(size_t c = 0; c < 256; c++) {
+				table.transitions[(row << 8) | c] = (State)builder.transitions[row][c];
+			}
+			table.types[row] = builder.types[row];
+		}
+		return table;
+	}
+
+	static constexpr Table table = makeTable();
+
+	static constexpr bool isIgnored(int type) {
+		for(size_t i = 0; i < NUM_RULES; i++) {
+			if (Rules[i].ignore && Rules[i].type == type) return true;
+		}
+		return false;
+	}
+
+	bool tokenize(const std::string& str, std::vector<Token>* token_list) {
+		return tokenize(str.data(), str.size(), token_list);
+	}
+
+	bool tokenize(const char* data, size_t size, std::vector<Token>* token_list) {
+		row = 1;
+		column = 1;
+		num_errors = 0;
+
+		const char* cur = data;
+		const char* end = data + size;
+		while(cur < end) {
+			const char* token_begin = cur;
+			size_t state = 1;
+			int type = -1;
+			while(cur < end) {
+				state = table.transitions[(state << 8) | (unsigned char)*cur];
+				if (state == 0) break;
+				int new_type = table.types[state];
+				type = (new_type != -1) ? new_type : type;
+				cur++;
+			}
+
+			if (cur == token_begin) {
+				// no rule starts with this character, consume it as an invalid token
+				cur = utf8::nextCharacter(cur, end);
+				type = -1;
+			}
+
+			uint token_row = row;
+			uint token_column = column;
+			advance(token_begin, cur);
+
+			if (!isIgnored(type)) {
+				if (type < 0) num_errors++;
+				token_list->push_back(Token(type, std::string(token_begin, cur), token_row, token_column));
+			}
+		}
+		return num_errors > 0;
+	}
+
+	unsigned int errors() const { return num_errors; }
+
+private:
+	typedef unsigned int uint;
+
+	uint row = 1;
+	uint column = 1;
+	uint num_errors = 0;
+
+	void advance(const char* begin, const char* end) {
+		utf8::advancePosition(begin, end, row, column);
+	}
+};
+
+#endif
+
+#endif
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <utility>
+#include "structural_classifier.hpp"
+
+const size_t StructuralClassifier::BLOCK_SIZE;
+const uint StructuralClassifier::MAX_RUNS;
+const uint StructuralClassifier::MAX_RANGES;
+
+StructuralClassifier::StructuralClassifier() : num_runs(0), num_ranges(0) {
+	std::fill(kinds, kinds + 256, NONE);
+	std::fill(types, types + 256, -1);
+}
+
+StructuralClassifier::StructuralClassifier(TokenStateMachine& machine, uint mode) : num_runs(0), num_ranges(0) {
+	std::fill(kinds, kinds + 256, NONE);
+	std::fill(types, types + 256, -1);
+
+	// the state each ASCII byte leads to from the start of the mode
+	State first_states[128];
+	for(uint c = 0; c < 128; c++) {
+		TokenStateMachine::Iterator iterator = machine.begin(mode);
+		iterator.nextState((char)c);
+		first_states[c] = iterator.getState();
+		types[c] = iterator.getType();
+	}
+
+	// (bytes in the run, a byte of it) for each state that makes a run
+	std::vector<std::pair<uint, uint>> runs;
+	for(uint c = 0; c < 128; c++) {
+		State state = first_states[c];
+		if (state == 0 || types[c] == -1) continue;
+		bool seen = false;
+		for(uint b = 0; b < c && !seen; b++) {
+			seen = (first_states[b] == state);
+		}
+		if (seen) continue;
+
+		// every byte out of the state must end the token, or loop on the bytes leading to it
+		bool single = true;
+		bool run = true;
+		for(uint b = 0; b < 256 && (single || run); b++) {
+			TokenStateMachine::Iterator iterator = machine.begin(mode);
+			iterator.nextState((char)c);
+			iterator.nextState((char)b);
+			State next = iterator.getState();
+			bool leads_here = b < 128 && first_states[b] == state;
+			if (next != 0) single = false;
+			if (next != (leads_here ? state : 0)) run = false;
+		}
+
+		uint size = 0;
+		for(uint b = c; b < 128; b++) {
+			if (first_states[b] != state) continue;
+			if (single) kinds[b] = SINGLE;
+			size++;
+		}
+		if (run) {
+			runs.push_back(std::make_pair(size, c));
+		}
+	}
+
+	// the largest runs first, in the order of their bytes when they are the same size
+	std::stable_sort(runs.begin(), runs.end(),
+		[](const std::pair<uint, uint>& a, const std::pair<uint, uint>& b) { return a.first > b.first; });
+	num_runs = std::min<size_t>(runs.size(), MAX_RUNS);
+	for(uint i = 0; i < num_runs; i++) {
+		State state = first_states[runs[i].second];
+		for(uint c = 0; c < 128; c++) {
+			if (first_states[c] == state) kinds[c] = RUN + i;
+		}
+	}
+
+	single_ranges = ranges(kinds, SINGLE);
+	num_ranges = single_ranges.size();
+	for(uint i = 0; i < num_runs; i++) {
+		run_ranges[i] = ranges(kinds, RUN + i);
+		num_ranges += run_ranges[i].size();
+	}
+}
+
+// the bytes of a kind as a list of ranges
+std::vector<utf8::ByteRange> StructuralClassifier::ranges(const unsigned char* kinds, unsigned char kind) {
+	std::vector<utf8::ByteRange> list;
+	for(uint c = 0; c < 256; c++) {
+		if (kinds[c] != kind) continue;
+		if (!list.empty() && list.back().last + 1u == c) {
+			list.back().last = c;
+		} else {
+			utf8::ByteRange range = { (unsigned char)c, (unsigned char)c };
+			list.push_back(range);
+		}
+	}
+	return list;
+}
+
+#ifdef __SSE2__
+// a byte is in [first, last] when byte - first (wrapping) saturates to 0 after taking away last - first
+static inline __m128i inRanges(__m128i bytes, const std::vector<utf8::ByteRange>& ranges) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i found = zero;
+	for(uint r = 0; r < ranges.size(); r++) {
+		__m128i offset = _mm_sub_epi8(bytes, _mm_set1_epi8((char)ranges[r].first));
+		__m128i width = _mm_set1_epi8((char)(ranges[r].last - ranges[r].first));
+		found = _mm_or_si128(found, _mm_cmpeq_epi8(_mm_subs_epu8(offset, width), zero));
+	}
+	return found;
+}
+#endif
+
+// masks of the single and run bytes in the block, bits past size are 0
+StructuralClassifier::Masks StructuralClassifier::classify(const char* block, size_t size) const {
+	Masks masks = {};
+#ifdef __SSE2__
+	if (size == BLOCK_SIZE && num_ranges <= MAX_RANGES) {
+		for(uint i = 0; i < BLOCK_SIZE; i += 16) {
+			__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+			masks.single |= (uint64_t)(uint16_t)_mm_movemask_epi8(inRanges(bytes, single_ranges)) << i;
+			for(uint r = 0; r < num_runs; r++) {
+				masks.runs[r] |= (uint64_t)(uint16_t)_mm_movemask_epi8(inRanges(bytes, run_ranges[r])) << i;
+			}
+		}
+		for(uint r = 0; r < num_runs; r++) {
+			masks.any_run |= masks.runs[r];
+		}
+		return masks;
+	}
+#endif
+	for(uint i = 0; i < size; i++) {
+		unsigned char kind = kinds[(unsigned char)block[i]];
+		masks.single |= (uint64_t)(kind == SINGLE) << i;
+		if (kind >= RUN) masks.runs[kind - RUN] |= (uint64_t)1 << i;
+	}
+	for(uint r = 0; r < num_runs; r++) {
+		masks.any_run |= masks.runs[r];
+	}
+	return masks;
+}
@@ -0,0 +1,125 @@
+/*
+Structural classifier finds the bytes of a mode that make up a whole token on
+their own, so text dominated by punctuation and whitespace does not have to
+go through the state machine a byte at a time. Both kinds are read from the
+compiled table rather than from the rules:
+
+single	a byte whose state from the start of the mode has a type and no way
+		out, like ',' or '('. The token is that one byte
+run		a set of bytes that all lead from the start to a state that only
+		loops on the same bytes, like whitespace. The token is the longest
+		run of them. Up to MAX_RUNS of the largest sets of a mode are used
+
+Text is classified 64 bytes at a time into a mask of single bytes and a mask
+of the bytes of each run. With SSE2 each set is compared as a few byte
+ranges, 16 bytes at a time. The masks only mean anything where a token starts
+in the mode they were made for. Everything else (words, numbers, strings, comments)
+is still lexed by the state machine.
+
+StructuralScanner walks a chunk of text, classifying each block the first
+time a token starts in it.
+*/
+
+#ifndef STRUCTURAL_CLASSIFIER_HPP
+#define STRUCTURAL_CLASSIFIER_HPP
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "token_state_machine.hpp"
+#include "utf8.hpp"
+
+class StructuralClassifier {
+public:
+	static const size_t BLOCK_SIZE = 64;
+
+	static const uint MAX_RUNS = 4;
+
+	// more ranges than this in all sets together are classified a byte at a time
+	static const uint MAX_RANGES = 16;
+
+	struct Masks {
+		uint64_t single;
+		uint64_t any_run;
+		uint64_t runs[MAX_RUNS];
+	};
+
+	StructuralClassifier();
+	StructuralClassifier(TokenStateMachine& machine, uint mode);
+	bool empty() const { return num_ranges == 0; }
+	int type(char c) const { return types[(unsigned char)c]; }
+	uint run(char c) const { return kinds[(unsigned char)c] - RUN; }
+	Masks classify(const char* block, size_t size) const;
+
+private:
+	// a byte of the i'th run is RUN + i
+	enum Kind {
+		NONE,
+		SINGLE,
+		RUN
+	};
+
+	unsigned char kinds[256];
+	int types[256];
+	uint num_runs;
+	std::vector<utf8::ByteRange> single_ranges;
+	std::vector<utf8::ByteRange> run_ranges[MAX_RUNS];
+	uint num_ranges;
+
+	static std::vector<utf8::ByteRange> ranges(const unsigned char* kinds, unsigned char kind);
+};
+
+class StructuralScanner {
+public:
+	StructuralScanner(const char* data, size_t size) : data(data), size(size), block(NO_BLOCK), classifier(NULL), masks() {}
+
+	/*
+	returns the length of the token the classifier makes at offset and sets its
+	type, or 0 if the state machine has to lex it. A run reaching the end of the
+	text gives 0 too, since it may go on in the next chunk
+	*/
+	size_t token(const StructuralClassifier& classifier, size_t offset, int& type) {
+		if (offset / BLOCK_SIZE != block || &classifier != this->classifier) {
+			load(classifier, offset / BLOCK_SIZE);
+		}
+		uint bit = offset % BLOCK_SIZE;
+		if ((masks.single >> bit) & 1) {
+			type = classifier.type(data[offset]);
+			return 1;
+		}
+		if (((masks.any_run >> bit) & 1) == 0) return 0;
+
+		type = classifier.type(data[offset]);
+		uint run_index = classifier.run(data[offset]);
+		size_t length = 0;
+		while(true) {
+			uint64_t rest = ~(masks.runs[run_index] >> bit);
+			uint run = (rest == 0) ? BLOCK_SIZE - bit : __builtin_ctzll(rest);
+			length += run;
+			if (bit + run < BLOCK_SIZE) break;
+			if ((block + 1) * BLOCK_SIZE >= size) return 0;
+			load(classifier, block + 1);
+			bit = 0;
+		}
+		return (offset + length < size) ? length : 0;
+	}
+
+private:
+	static const size_t BLOCK_SIZE = StructuralClassifier::BLOCK_SIZE;
+	static const size_t NO_BLOCK = ~(size_t)0;
+
+	const char* data;
+	size_t size;
+	size_t block;
+	const StructuralClassifier* classifier;
+	StructuralClassifier::Masks masks;
+
+	void load(const StructuralClassifier& classifier, size_t block) {
+		this->block = block;
+		this->classifier = &classifier;
+		size_t begin = block * BLOCK_SIZE;
+		masks = classifier.classify(data + begin, (size - begin < BLOCK_SIZE) ? size - begin : BLOCK_SIZE);
+	}
+};
+
+#endif
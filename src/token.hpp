@@ -2,17 +2,18 @@
 #define TOKEN_HPP
 
 #include <string>
+#include <utility>
 
 struct Token {
 public:
 	int type;
-	const std::string str;
-	const unsigned int row;
-	const unsigned int column;
+	std::string str;
+	unsigned int row;
+	unsigned int column;
 	
 	Token() : type(-1), str(""), row(0), column(0) {}
 	Token(int type, std::string str, unsigned int row = 0, unsigned int column = 0)
-		: type(type), str(str), row(row), column(column) {}
+		: type(type), str(std::move(str)), row(row), column(column) {}
 };
 
 #endif
\ No newline at end of file
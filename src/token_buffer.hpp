@@ -0,0 +1,66 @@
+/*
+Token buffer is a list of tokens that keeps its tokens, and the memory of their
+strings, when it is cleared. Tokenizing similar text into the same buffer again
+overwrites the old tokens in place, so once the buffer has grown to fit a call
+later calls make no allocations. Only the first size() tokens are in the list.
+
+ex)
+TokenBuffer buffer;
+while(readRequest(request)) {
+	buffer.clear();
+	tokenizer.tokenize(request, &buffer);
+	handle(buffer);
+}
+*/
+
+#ifndef TOKEN_BUFFER_HPP
+#define TOKEN_BUFFER_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include "token.hpp"
+
+class TokenBuffer {
+public:
+	typedef std::vector<Token>::iterator iterator;
+	typedef std::vector<Token>::const_iterator const_iterator;
+
+	TokenBuffer() : count(0) {}
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	Token& operator[](size_t index) { return tokens[index]; }
+	const Token& operator[](size_t index) const { return tokens[index]; }
+	iterator begin() { return tokens.begin(); }
+	iterator end() { return tokens.begin() + count; }
+	const_iterator begin() const { return tokens.begin(); }
+	const_iterator end() const { return tokens.begin() + count; }
+
+	// keeps every token for reuse
+	void clear() { count = 0; }
+
+	// makes room for num_tokens tokens of up to string_size bytes without allocating
+	void reserve(size_t num_tokens, size_t string_size = 0) {
+		if (tokens.size() < num_tokens) tokens.resize(num_tokens);
+		for(size_t i = 0; i < tokens.size(); i++) {
+			tokens[i].str.reserve(string_size);
+		}
+	}
+
+	Token& add(int type, const char* begin, const char* end, unsigned int row, unsigned int column) {
+		if (count == tokens.size()) tokens.emplace_back();
+		Token& token = tokens[count++];
+		token.type = type;
+		token.str.assign(begin, end - begin);
+		token.row = row;
+		token.column = column;
+		return token;
+	}
+
+private:
+	std::vector<Token> tokens; // tokens past count are kept for reuse
+	size_t count;
+};
+
+#endif
@@ -0,0 +1,342 @@
+#include <cstring>
+#include <fstream>
+#include "token_file.hpp"
+#include "utf8.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const uint TokenFile::VERSION;
+
+static const char MAGIC[4] = { 'T', 'O', 'K', 'F' };
+static const uint MAX_VARINT_LENGTH = 10;
+
+static void putU32(std::string& out, uint32_t value) {
+	for(uint i = 0; i < 4; i++) out += (char)(value >> (8 * i));
+}
+
+static void putU64(std::string& out, uint64_t value) {
+	for(uint i = 0; i < 8; i++) out += (char)(value >> (8 * i));
+}
+
+static uint32_t getU32(const unsigned char* in) {
+	uint32_t value = 0;
+	for(uint i = 0; i < 4; i++) value |= (uint32_t)in[i] << (8 * i);
+	return value;
+}
+
+static uint64_t getU64(const unsigned char* in) {
+	uint64_t value = 0;
+	for(uint i = 0; i < 8; i++) value |= (uint64_t)in[i] << (8 * i);
+	return value;
+}
+
+// 7 bits per byte, high bit set on every byte but the last
+static void putVarint(std::string& out, uint64_t value) {
+	while(value >= 0x80) {
+		out += (char)(value | 0x80);
+		value >>= 7;
+	}
+	out += (char)value;
+}
+
+static uint64_t getVarint(const unsigned char*& in) {
+	uint64_t value = 0;
+	uint shift = 0;
+	while(*in & 0x80) {
+		value |= (uint64_t)(*in++ & 0x7F) << shift;
+		shift += 7;
+	}
+	value |= (uint64_t)*in++ << shift;
+	return value;
+}
+
+// signed deltas are zig-zag encoded so small negative values stay small
+static void putSignedVarint(std::string& out, int64_t value) {
+	putVarint(out, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static int64_t getSignedVarint(const unsigned char*& in) {
+	uint64_t value = getVarint(in);
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// a varint column must end in a complete varint for every token, and no varint
+// may hold more than 64 bits
+static bool checkVarints(const unsigned char* in, uint64_t size, uint64_t count) {
+	uint64_t found = 0;
+	uint length = 0;
+	for(uint64_t i = 0; i < size; i++) {
+		length++;
+		if (length > MAX_VARINT_LENGTH || (length == MAX_VARINT_LENGTH && in[i] > 1)) return false;
+		if (!(in[i] & 0x80)) {
+			found++;
+			length = 0;
+		}
+	}
+	return found == count && length == 0;
+}
+
+bool TokenFile::save(const std::string& filename, const std::vector<Token>& tokens) {
+	return save(filename, tokens, NULL, 0, TOKEN_TEXT);
+}
+
+bool TokenFile::save(const std::string& filename, const std::vector<Token>& tokens,
+		const char* source, size_t size, TextKind kind, const std::string& reference) {
+	std::vector<size_t> offsets;
+	if (kind != TOKEN_TEXT && !findOffsets(tokens, source, size, offsets)) return false;
+
+	std::string columns[NUM_SECTIONS];
+	uint row = 1;
+	uint column = 1;
+	size_t end_offset = 0;
+	for(size_t i = 0; i < tokens.size(); i++) {
+		const Token& token = tokens[i];
+		size_t offset = (kind == TOKEN_TEXT) ? end_offset : offsets[i];
+
+		putSignedVarint(columns[TYPES], token.type);
+		putSignedVarint(columns[LINES], (int64_t)token.row - row);
+		putSignedVarint(columns[LINES], (int64_t)token.column - column);
+		putSignedVarint(columns[OFFSETS], (int64_t)offset - (int64_t)end_offset);
+		putVarint(columns[LENGTHS], token.str.size());
+		if (kind == TOKEN_TEXT) columns[TEXT] += token.str;
+
+		row = token.row;
+		column = token.column;
+		end_offset = offset + token.str.size();
+	}
+	if (kind == SOURCE_TEXT) columns[TEXT].assign(source, size);
+	if (kind == SOURCE_REFERENCE) columns[TEXT] = reference;
+
+	std::string header(MAGIC, 4);
+	putU32(header, VERSION);
+	putU32(header, kind);
+	putU32(header, 0);
+	putU64(header, tokens.size());
+	uint64_t section_offset = HEADER_SIZE;
+	for(uint i = 0; i < NUM_SECTIONS; i++) {
+		putU64(header, section_offset);
+		putU64(header, columns[i].size());
+		section_offset += columns[i].size();
+	}
+
+	std::ofstream fout(filename.c_str(), std::ios::binary);
+	if (!fout.is_open()) return false;
+	fout.write(header.data(), header.size());
+	for(uint i = 0; i < NUM_SECTIONS; i++) {
+		fout.write(columns[i].data(), columns[i].size());
+	}
+	fout.close();
+	return !fout.fail();
+}
+
+// finds the offset of each token in the source by walking the token lengths,
+// stepping over skipped text until the row, column and text match the token
+bool TokenFile::findOffsets(const std::vector<Token>& tokens, const char* source, size_t size,
+		std::vector<size_t>& offsets) {
+	offsets.resize(tokens.size());
+	size_t offset = 0;
+	uint row = 1;
+	uint column = 1;
+	for(size_t i = 0; i < tokens.size(); i++) {
+		const Token& token = tokens[i];
+		while(row != token.row || column != token.column || token.str.size() > size - offset
+			|| std::memcmp(source + offset, token.str.data(), token.str.size()) != 0) {
+			if (offset >= size || row > token.row || (row == token.row && column > token.column)) return false;
+			utf8::advancePosition(source + offset, source + offset + 1, row, column);
+			offset++;
+		}
+		offsets[i] = offset;
+		utf8::advancePosition(source + offset, source + offset + token.str.size(), row, column);
+		offset += token.str.size();
+	}
+	return true;
+}
+
+TokenFile::TokenFile()
+	: data(NULL), data_size(0), mapping(NULL), mapped_size(0), text_kind(TOKEN_TEXT),
+	token_count(0), source(NULL), source_size(0) {
+	for(uint i = 0; i < NUM_SECTIONS; i++) {
+		sections[i] = NULL;
+		section_sizes[i] = 0;
+	}
+}
+
+TokenFile::~TokenFile() {
+	close();
+}
+
+bool TokenFile::open(const std::string& filename) {
+	close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE handle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (handle == NULL) return false;
+	void* view = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL) {
+		CloseHandle(handle);
+		return false;
+	}
+	mapping = handle;
+	mapped_size = (size_t)file_size.QuadPart;
+#else
+	int file = ::open(filename.c_str(), O_RDONLY);
+	if (file < 0) return false;
+	struct stat file_stat;
+	if (fstat(file, &file_stat) != 0 || file_stat.st_size == 0) {
+		::close(file);
+		return false;
+	}
+	void* view = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	::close(file);
+	if (view == MAP_FAILED) return false;
+	mapping = view;
+	mapped_size = file_stat.st_size;
+#endif
+	data = (const unsigned char*)view;
+	data_size = mapped_size;
+	if (!parse()) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool TokenFile::open(const char* data, size_t size) {
+	close();
+	this->data = (const unsigned char*)data;
+	data_size = size;
+	if (!parse()) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void TokenFile::close() {
+	unmap();
+	data = NULL;
+	data_size = 0;
+	token_count = 0;
+}
+
+void TokenFile::unmap() {
+	if (mapping == NULL) return;
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle((HANDLE)mapping);
+#else
+	munmap(mapping, mapped_size);
+#endif
+	mapping = NULL;
+	mapped_size = 0;
+}
+
+// the source text tokens of a SOURCE_REFERENCE file point into
+void TokenFile::setSource(const char* data, size_t size) {
+	source = data;
+	source_size = size;
+}
+
+std::string TokenFile::reference() const {
+	if (text_kind != SOURCE_REFERENCE) return "";
+	return std::string((const char*)sections[TEXT], section_sizes[TEXT]);
+}
+
+bool TokenFile::parse() {
+	if (data_size < HEADER_SIZE || std::memcmp(data, MAGIC, 4) != 0) return false;
+	if (getU32(data + 4) > VERSION) return false;
+	uint32_t kind = getU32(data + 8);
+	if (kind > SOURCE_REFERENCE) return false;
+	text_kind = (TextKind)kind;
+	token_count = getU64(data + 16);
+	if (token_count > UINT64_MAX / 2) return false;
+
+	for(uint i = 0; i < NUM_SECTIONS; i++) {
+		uint64_t offset = getU64(data + 24 + i * 16);
+		uint64_t size = getU64(data + 32 + i * 16);
+		if (offset > data_size || size > data_size - offset) return false;
+		sections[i] = data + offset;
+		section_sizes[i] = size;
+	}
+
+	// check everything the iterator trusts once, instead of on every token
+	if (!checkVarints(sections[TYPES], section_sizes[TYPES], token_count)) return false;
+	if (!checkVarints(sections[LINES], section_sizes[LINES], token_count * 2)) return false;
+	if (!checkVarints(sections[OFFSETS], section_sizes[OFFSETS], token_count)) return false;
+	if (!checkVarints(sections[LENGTHS], section_sizes[LENGTHS], token_count)) return false;
+
+	if (text_kind != SOURCE_REFERENCE) {
+		const unsigned char* offsets = sections[OFFSETS];
+		const unsigned char* lengths = sections[LENGTHS];
+		uint64_t end_offset = 0;
+		for(uint64_t i = 0; i < token_count; i++) {
+			int64_t delta = getSignedVarint(offsets);
+			uint64_t length = getVarint(lengths);
+			// end_offset is within the text, so only the delta can leave it
+			if (delta < 0 ? (uint64_t)0 - (uint64_t)delta > end_offset
+				: (uint64_t)delta > section_sizes[TEXT] - end_offset) {
+				return false;
+			}
+			uint64_t offset = end_offset + delta;
+			if (length > section_sizes[TEXT] - offset) return false;
+			end_offset = offset + length;
+		}
+	}
+	return true;
+}
+
+TokenFile::Iterator::Iterator(const TokenFile* file, uint64_t index)
+	: file(file), index(index), types(NULL), lines(NULL), offsets(NULL), lengths(NULL) {
+	view.type = -1;
+	view.str = NULL;
+	view.length = 0;
+	view.offset = 0;
+	view.row = 1;
+	view.column = 1;
+	if (file != NULL) {
+		types = file->sections[TYPES];
+		lines = file->sections[LINES];
+		offsets = file->sections[OFFSETS];
+		lengths = file->sections[LENGTHS];
+		if (index < file->token_count) decode();
+	}
+}
+
+TokenFile::Iterator& TokenFile::Iterator::operator++() {
+	index++;
+	if (index < file->token_count) decode();
+	return *this;
+}
+
+void TokenFile::Iterator::decode() {
+	size_t end_offset = view.offset + view.length;
+	view.type = (int)getSignedVarint(types);
+	view.row += getSignedVarint(lines);
+	view.column += getSignedVarint(lines);
+	view.offset = end_offset + getSignedVarint(offsets);
+	view.length = getVarint(lengths);
+
+	if (file->text_kind != SOURCE_REFERENCE) {
+		view.str = (const char*)file->sections[TEXT] + view.offset;
+	} else if (file->source != NULL && view.offset <= file->source_size
+		&& view.length <= file->source_size - view.offset) {
+		view.str = file->source + view.offset;
+	} else {
+		view.str = NULL;
+	}
+}
@@ -0,0 +1,132 @@
+/*
+Token file is a compact binary format for passing tokens between programs
+without writing and re-parsing text. Each column is stored separately as
+variable length integers: types, rows and columns as deltas from the previous
+token, offsets as the gap after the previous token and lengths of each token's
+text. The text can be the token strings themselves, the whole source text (so
+offsets point into it), or only a reference (like a file name) to a source
+text the reader provides.
+
+A file is opened by mapping it into memory and iterated without allocating
+anything per token. The strings in a TokenView point into the file (or the
+source given to setSource()) and are only valid while it is open.
+
+ex)
+TokenFile::save("out.tok", token_list, source.data(), source.size(), TokenFile::SOURCE_TEXT);
+
+TokenFile file;
+if (file.open("out.tok")) {
+	for(TokenFile::Iterator it = file.begin(); it != file.end(); ++it) {
+		std::cout << it->type << ' ' << std::string(it->str, it->length) << '\n';
+	}
+}
+*/
+
+#ifndef TOKEN_FILE_HPP
+#define TOKEN_FILE_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "token.hpp"
+
+typedef unsigned int uint;
+
+class TokenFile {
+public:
+	enum TextKind {
+		TOKEN_TEXT,
+		SOURCE_TEXT,
+		SOURCE_REFERENCE
+	};
+
+	struct TokenView {
+		int type;
+		const char* str; // NULL if the source of a reference has not been set
+		size_t length;
+		size_t offset; // in the token text or source
+		uint row;
+		uint column;
+	};
+
+	class Iterator {
+	public:
+		Iterator() : file(NULL), index(0) {}
+		const TokenView& operator*() const { return view; }
+		const TokenView* operator->() const { return &view; }
+		Iterator& operator++();
+		bool operator==(const Iterator& other) const { return index == other.index; }
+		bool operator!=(const Iterator& other) const { return index != other.index; }
+
+	private:
+		friend class TokenFile;
+
+		const TokenFile* file;
+		uint64_t index;
+		const unsigned char* types;
+		const unsigned char* lines;
+		const unsigned char* offsets;
+		const unsigned char* lengths;
+		TokenView view;
+
+		Iterator(const TokenFile* file, uint64_t index);
+		void decode();
+	};
+
+	static const uint VERSION = 1;
+
+	// writing
+	static bool save(const std::string& filename, const std::vector<Token>& tokens);
+	static bool save(const std::string& filename, const std::vector<Token>& tokens,
+		const char* source, size_t size, TextKind kind, const std::string& reference = "");
+
+	// reading
+	TokenFile();
+	TokenFile(const TokenFile&) = delete;
+	TokenFile& operator=(const TokenFile&) = delete;
+	~TokenFile();
+
+	bool open(const std::string& filename);
+	bool open(const char* data, size_t size);
+	void close();
+	void setSource(const char* data, size_t size);
+
+	uint64_t size() const { return token_count; }
+	TextKind textKind() const { return text_kind; }
+	std::string reference() const;
+	Iterator begin() const { return Iterator(this, 0); }
+	Iterator end() const { return Iterator(NULL, token_count); }
+
+private:
+	enum Section {
+		TYPES,
+		LINES,
+		OFFSETS,
+		LENGTHS,
+		TEXT,
+		NUM_SECTIONS
+	};
+
+	static const size_t HEADER_SIZE = 24 + NUM_SECTIONS * 16;
+
+	const unsigned char* data;
+	size_t data_size;
+	void* mapping; // platform handle of a mapped file
+	size_t mapped_size;
+
+	TextKind text_kind;
+	uint64_t token_count;
+	const unsigned char* sections[NUM_SECTIONS];
+	uint64_t section_sizes[NUM_SECTIONS];
+	const char* source;
+	size_t source_size;
+
+	bool parse();
+	void unmap();
+
+	static bool findOffsets(const std::vector<Token>& tokens, const char* source, size_t size,
+		std::vector<size_t>& offsets);
+};
+
+#endif
@@ -0,0 +1,232 @@
+/*
+C++20 coroutine interface to the tokenizer, only available when compiling with
+-std=c++20 or later. tokens() lazily yields the tokens of a buffer or stream as
+a Generator. tokenizeAsync() reads from an awaitable source and suspends
+whenever the source is waiting for data instead of blocking the thread, so one
+thread can serve many streams. Both are built on Tokenizer::feed() and finish()
+so the synchronous tokenize() is unchanged.
+
+A source is any object with a read(char* buffer, size_t size) member that
+returns an awaitable resulting in the number of bytes read (0 at the end).
+
+Each stream being tokenized at the same time needs its own tokenizer, and the
+tokenizer and source must outlive the generator. A generator resets the
+tokenizer when it starts, so one that was dropped before the end leaves nothing
+behind for the next.
+
+When the token or memory limit of the tokenizer stops a chunk, the tokens so
+far are yielded and the rest of the chunk is resumed before the next is read,
+so the limits bound each batch of tokens instead of dropping any.
+
+ex)
+Task lex(Tokenizer& tokenizer, Socket& socket) {
+	AsyncGenerator<Token> tokens = tokenizeAsync(tokenizer, socket);
+	while(const Token* token = co_await tokens.next()) {
+		parse(*token);
+	}
+}
+*/
+
+#ifndef TOKEN_GENERATOR_HPP
+#define TOKEN_GENERATOR_HPP
+
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <exception>
+#include <istream>
+#include <vector>
+#include <cstddef>
+#include "tokenizer.hpp"
+
+template<typename T>
+class Generator {
+public:
+	struct promise_type {
+		const T* value = nullptr;
+		std::exception_ptr exception;
+
+		Generator get_return_object() { return Generator(Handle::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		std::suspend_always yield_value(const T& yielded) noexcept {
+			value = &yielded;
+			return {};
+		}
+		void return_void() noexcept {}
+		void unhandled_exception() { exception = std::current_exception(); }
+	};
+
+	typedef std::coroutine_handle<promise_type> Handle;
+
+	class Iterator {
+	public:
+		explicit Iterator(Handle handle = nullptr) : handle(handle) {}
+		const T& operator*() const { return *handle.promise().value; }
+		const T* operator->() const { return handle.promise().value; }
+		Iterator& operator++() {
+			resume(handle);
+			return *this;
+		}
+		bool operator==(const Iterator& other) const { return atEnd() == other.atEnd(); }
+		bool operator!=(const Iterator& other) const { return !(*this == other); }
+
+	private:
+		Handle handle;
+		bool atEnd() const { return !handle || handle.done(); }
+	};
+
+	Generator(Generator&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+	Generator(const Generator&) = delete;
+	Generator& operator=(const Generator&) = delete;
+	~Generator() { if (handle) handle.destroy(); }
+
+	Iterator begin() {
+		resume(handle);
+		return Iterator(handle);
+	}
+	Iterator end() { return Iterator(); }
+
+private:
+	Handle handle;
+
+	explicit Generator(Handle handle) : handle(handle) {}
+
+	static void resume(Handle handle) {
+		handle.resume();
+		if (handle.promise().exception) std::rethrow_exception(handle.promise().exception);
+	}
+};
+
+template<typename T>
+class AsyncGenerator {
+public:
+	struct promise_type {
+		const T* value = nullptr;
+		std::exception_ptr exception;
+		std::coroutine_handle<> consumer;
+
+		// yielding or finishing resumes whoever awaited next()
+		struct ResumeConsumer {
+			bool await_ready() noexcept { return false; }
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+				return handle.promise().consumer;
+			}
+			void await_resume() noexcept {}
+		};
+
+		AsyncGenerator get_return_object() { return AsyncGenerator(Handle::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		ResumeConsumer final_suspend() noexcept { return {}; }
+		ResumeConsumer yield_value(const T& yielded) noexcept {
+			value = &yielded;
+			return {};
+		}
+		void return_void() noexcept { value = nullptr; }
+		void unhandled_exception() { exception = std::current_exception(); }
+	};
+
+	typedef std::coroutine_handle<promise_type> Handle;
+
+	// results in the next value, or NULL once the generator is finished
+	class NextAwaiter {
+	public:
+		explicit NextAwaiter(Handle handle) : handle(handle) {}
+		bool await_ready() const noexcept { return handle.done(); }
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> consumer) noexcept {
+			handle.promise().consumer = consumer;
+			return handle;
+		}
+		const T* await_resume() const {
+			if (handle.promise().exception) std::rethrow_exception(handle.promise().exception);
+			return handle.done() ? nullptr : handle.promise().value;
+		}
+
+	private:
+		Handle handle;
+	};
+
+	AsyncGenerator(AsyncGenerator&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+	AsyncGenerator(const AsyncGenerator&) = delete;
+	AsyncGenerator& operator=(const AsyncGenerator&) = delete;
+	~AsyncGenerator() { if (handle) handle.destroy(); }
+
+	NextAwaiter next() { return NextAwaiter(handle); }
+
+private:
+	Handle handle;
+
+	explicit AsyncGenerator(Handle handle) : handle(handle) {}
+};
+
+const size_t TOKEN_GENERATOR_BUFFER_SIZE = 4096;
+
+inline Generator<Token> tokens(Tokenizer& tokenizer, const char* data, size_t size) {
+	tokenizer.reset();
+	std::vector<Token> token_list;
+	for(size_t offset = 0; offset < size; offset += TOKEN_GENERATOR_BUFFER_SIZE) {
+		size_t chunk_size = size - offset;
+		if (chunk_size > TOKEN_GENERATOR_BUFFER_SIZE) chunk_size = TOKEN_GENERATOR_BUFFER_SIZE;
+
+		token_list.clear();
+		tokenizer.feed(data + offset, chunk_size, &token_list);
+		for(const Token& token : token_list) co_yield token;
+		// a limit stopped the chunk, the rest of it comes in calls of their own
+		while(tokenizer.status() != Tokenizer::COMPLETE) {
+			token_list.clear();
+			tokenizer.resume(&token_list);
+			for(const Token& token : token_list) co_yield token;
+		}
+	}
+	token_list.clear();
+	tokenizer.finish(&token_list);
+	for(const Token& token : token_list) co_yield token;
+}
+
+inline Generator<Token> tokens(Tokenizer& tokenizer, std::istream& stream) {
+	tokenizer.reset();
+	std::vector<char> buffer(TOKEN_GENERATOR_BUFFER_SIZE);
+	std::vector<Token> token_list;
+	do {
+		stream.read(buffer.data(), buffer.size());
+		token_list.clear();
+		tokenizer.feed(buffer.data(), stream.gcount(), &token_list);
+		for(const Token& token : token_list) co_yield token;
+		// a limit stopped the chunk, the rest of it comes in calls of their own
+		while(tokenizer.status() != Tokenizer::COMPLETE) {
+			token_list.clear();
+			tokenizer.resume(&token_list);
+			for(const Token& token : token_list) co_yield token;
+		}
+	} while(stream);
+	token_list.clear();
+	tokenizer.finish(&token_list);
+	for(const Token& token : token_list) co_yield token;
+}
+
+template<typename Source>
+AsyncGenerator<Token> tokenizeAsync(Tokenizer& tokenizer, Source& source,
+		size_t buffer_size = TOKEN_GENERATOR_BUFFER_SIZE) {
+	tokenizer.reset();
+	std::vector<char> buffer(buffer_size);
+	std::vector<Token> token_list;
+	size_t size;
+	while((size = co_await source.read(buffer.data(), buffer.size())) > 0) {
+		token_list.clear();
+		tokenizer.feed(buffer.data(), size, &token_list);
+		for(const Token& token : token_list) co_yield token;
+		// a limit stopped the chunk, the rest of it comes in calls of their own
+		while(tokenizer.status() != Tokenizer::COMPLETE) {
+			token_list.clear();
+			tokenizer.resume(&token_list);
+			for(const Token& token : token_list) co_yield token;
+		}
+	}
+	token_list.clear();
+	tokenizer.finish(&token_list);
+	for(const Token& token : token_list) co_yield token;
+}
+
+#endif
+
+#endif
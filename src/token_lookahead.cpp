@@ -0,0 +1,83 @@
+#include <stdexcept>
+#include <utility>
+#include "token_lookahead.hpp"
+
+const uint TokenLookahead::DEFAULT_DEPTH;
+const size_t TokenLookahead::CHUNK_SIZE;
+
+TokenLookahead::TokenLookahead(Tokenizer& tokenizer, std::istream* stream, uint depth)
+	: tokenizer(tokenizer), stream(stream), data(NULL), size(0), offset(0), buffer(CHUNK_SIZE),
+	read_all(false), finished(false), next_pending(0), ring(depth), depth(depth), first(0), count(0), cur_position(0) {
+	if (depth == 0) throw std::runtime_error("lookahead depth cannot be 0");
+	tokenizer.reset();
+}
+
+TokenLookahead::TokenLookahead(Tokenizer& tokenizer, const char* data, size_t size, uint depth)
+	: tokenizer(tokenizer), stream(NULL), data(data), size(size), offset(0), read_all(false), finished(false),
+	next_pending(0), ring(depth), depth(depth), first(0), count(0), cur_position(0) {
+	if (depth == 0) throw std::runtime_error("lookahead depth cannot be 0");
+	tokenizer.reset();
+}
+
+const Token* TokenLookahead::peek(uint k) {
+	if (k >= depth) throw std::runtime_error("cannot peek past the lookahead depth");
+	if (!fill(cur_position + k + 1)) return NULL;
+	return &ring[(cur_position + k) % depth];
+}
+
+bool TokenLookahead::consume() {
+	if (!fill(cur_position + 1)) return false;
+	cur_position++;
+	return true;
+}
+
+void TokenLookahead::rewind(size_t mark) {
+	if (mark < first || mark > cur_position) {
+		throw std::runtime_error("mark is no longer in the lookahead window");
+	}
+	cur_position = mark;
+}
+
+// makes sure the ring holds every token before end_position, returns false if the text ends first
+bool TokenLookahead::fill(size_t end_position) {
+	while(first + count < end_position) {
+		if (next_pending == pending.size()) {
+			if (finished) return false;
+			readChunk();
+			continue;
+		}
+
+		if (count == depth) {
+			// drop the oldest consumed token (and any mark on it)
+			first++;
+			count--;
+		}
+		ring[(first + count) % depth] = std::move(pending[next_pending++]);
+		count++;
+	}
+	return true;
+}
+
+void TokenLookahead::readChunk() {
+	pending.clear();
+	next_pending = 0;
+
+	// a limit stopped the last chunk, its tokens come before the next chunk is read
+	if (tokenizer.status() != Tokenizer::COMPLETE) {
+		tokenizer.resume(&pending);
+	} else if (stream != NULL) {
+		stream->read(buffer.data(), buffer.size());
+		tokenizer.feed(buffer.data(), stream->gcount(), &pending);
+		read_all = !*stream;
+	} else {
+		size_t chunk_size = (size - offset < CHUNK_SIZE) ? size - offset : CHUNK_SIZE;
+		tokenizer.feed(data + offset, chunk_size, &pending);
+		offset += chunk_size;
+		read_all = (offset == size);
+	}
+
+	if (read_all && tokenizer.status() == Tokenizer::COMPLETE) {
+		tokenizer.finish(&pending);
+		finished = true;
+	}
+}
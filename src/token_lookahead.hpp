@@ -0,0 +1,80 @@
+/*
+Token lookahead lets a parser look at the next few tokens and consume them one
+at a time without tokenizing the whole text first. Only a ring of depth tokens
+is kept. It is filled lazily by feeding the tokenizer one chunk of text at a
+time, so memory is bounded by the lookahead depth and chunk size instead of the
+size of the text.
+
+mark() records the current position and rewind() returns to it, as long as the
+marked token is still in the ring (at most depth tokens back).
+
+The tokenizer is reset when the lookahead is made. If its token or memory
+limit stops a chunk, the rest of the chunk is resumed before the next one is
+read, so the limits bound each refill of the ring instead of dropping tokens.
+
+ex)
+TokenLookahead lookahead(tokenizer, &fin, 4);
+while(const Token* token = lookahead.peek()) {
+	if (token->type == WORD && lookahead.peek(1) && lookahead.peek(1)->type == COLON) {
+		parseLabel(lookahead);
+	} else {
+		parseStatement(lookahead);
+	}
+}
+*/
+
+#ifndef TOKEN_LOOKAHEAD_HPP
+#define TOKEN_LOOKAHEAD_HPP
+
+#include <istream>
+#include <vector>
+#include <cstddef>
+#include "token.hpp"
+#include "tokenizer.hpp"
+
+class TokenLookahead {
+public:
+	static const uint DEFAULT_DEPTH = 8;
+	static const size_t CHUNK_SIZE = 4096;
+
+	TokenLookahead(Tokenizer& tokenizer, std::istream* stream, uint depth = DEFAULT_DEPTH);
+	TokenLookahead(Tokenizer& tokenizer, const char* data, size_t size, uint depth = DEFAULT_DEPTH);
+	TokenLookahead(const TokenLookahead&) = delete;
+	TokenLookahead& operator=(const TokenLookahead&) = delete;
+
+	// the token k after the current one or NULL past the end. Valid until the next call
+	const Token* peek(uint k = 0);
+
+	// moves past the current token, returns false at the end
+	bool consume();
+	bool atEnd() { return peek() == NULL; }
+
+	size_t position() const { return cur_position; }
+	size_t mark() const { return cur_position; }
+	void rewind(size_t mark);
+
+private:
+	Tokenizer& tokenizer;
+	std::istream* stream;
+	const char* data;
+	size_t size;
+	size_t offset;
+	std::vector<char> buffer; // the last chunk of the stream, a stopped call resumes in it
+	bool read_all; // every chunk has been fed
+	bool finished;
+
+	// tokens from the last chunk that are not in the ring yet
+	std::vector<Token> pending;
+	size_t next_pending;
+
+	std::vector<Token> ring;
+	uint depth;
+	size_t first; // position of the oldest token in the ring
+	uint count; // tokens in the ring
+	size_t cur_position;
+
+	bool fill(size_t end_position);
+	void readChunk();
+};
+
+#endif
@@ -0,0 +1,137 @@
+#include <stdexcept>
+#include "token_pipeline.hpp"
+#include "tokenizer_core.hpp"
+
+const size_t TokenPipeline::DEFAULT_BATCH_SIZE;
+const uint TokenPipeline::DEFAULT_BATCHES;
+const uint TokenPipeline::SPINS;
+
+struct TokenPipeline::Sink {
+	TokenPipeline* pipeline;
+
+	explicit Sink(TokenPipeline* pipeline = NULL) : pipeline(pipeline) {}
+
+	template<class Position>
+	void token(int type, const char* begin, const char* end, const Position& position) {
+		pipeline->add(type, begin, end, position.row(), position.column());
+	}
+};
+
+TokenPipeline::TokenPipeline(Tokenizer& tokenizer, std::istream* stream, size_t batch_size, uint batches)
+	: tokenizer(tokenizer), batch_size(batch_size), batches(batches), produced(0), consumed(0),
+	next_batch(0), filling(NULL), holding(false), caller_waiting(false), lexer_waiting(false),
+	done(false), cancelled(false), num_errors(0) {
+	if (batch_size == 0 || batches == 0) throw std::runtime_error("pipeline batches cannot be empty");
+	// the batches bound the memory instead, a limit would stop the lexing thread midway
+	if (tokenizer.maxTokens() > 0 || tokenizer.memoryBudget() > 0) {
+		throw std::runtime_error("a pipeline does not apply token or memory limits");
+	}
+	thread = std::thread(&TokenPipeline::produce<StreamSource>, this, StreamSource(stream));
+}
+
+TokenPipeline::TokenPipeline(Tokenizer& tokenizer, const char* data, size_t size, size_t batch_size, uint batches)
+	: tokenizer(tokenizer), batch_size(batch_size), batches(batches), produced(0), consumed(0),
+	next_batch(0), filling(NULL), holding(false), caller_waiting(false), lexer_waiting(false),
+	done(false), cancelled(false), num_errors(0) {
+	if (batch_size == 0 || batches == 0) throw std::runtime_error("pipeline batches cannot be empty");
+	// the batches bound the memory instead, a limit would stop the lexing thread midway
+	if (tokenizer.maxTokens() > 0 || tokenizer.memoryBudget() > 0) {
+		throw std::runtime_error("a pipeline does not apply token or memory limits");
+	}
+	thread = std::thread(&TokenPipeline::produce<MemorySource>, this, MemorySource(data, size));
+}
+
+TokenPipeline::~TokenPipeline() {
+	cancelled = true;
+	wake(batch_free);
+	thread.join();
+}
+
+// the stores and loads of the counters and waiting flags are sequentially
+// consistent, so a side that sleeps sees the other's update or is seen waiting
+const TokenBuffer* TokenPipeline::next() {
+	size_t batch = consumed.load(std::memory_order_relaxed);
+	if (holding) {
+		holding = false;
+		consumed.store(++batch);
+		if (lexer_waiting.load()) wake(batch_free);
+	}
+
+	for(uint spins = 0; ; spins++) {
+		if (produced.load() != batch) {
+			holding = true;
+			return &batches[batch % batches.size()];
+		}
+		if (done.load()) {
+			// the last batch is published before done is set
+			if (produced.load() != batch) continue;
+			if (error) std::rethrow_exception(error);
+			return NULL;
+		}
+		if (spins < SPINS) {
+			std::this_thread::yield();
+		} else {
+			sleepUntil(caller_waiting, batch_ready, [this, batch]() {
+				return produced.load() != batch || done.load();
+			});
+		}
+	}
+}
+
+// adds a token to the batch being filled, on the lexing thread
+void TokenPipeline::add(int type, const char* begin, const char* end, uint row, uint column) {
+	if (filling == NULL) {
+		// wait for the caller to give back a batch when the ring is full
+		for(uint spins = 0; ; spins++) {
+			if (cancelled.load()) throw Cancelled();
+			if (next_batch - consumed.load() < batches.size()) break;
+			if (spins < SPINS) {
+				std::this_thread::yield();
+			} else {
+				sleepUntil(lexer_waiting, batch_free, [this]() {
+					return cancelled.load() || next_batch - consumed.load() < batches.size();
+				});
+			}
+		}
+		filling = &batches[next_batch % batches.size()];
+		filling->clear();
+	}
+	filling->add(type, begin, end, row, column);
+	if (filling->size() == batch_size) publish();
+}
+
+void TokenPipeline::publish() {
+	produced.store(++next_batch);
+	filling = NULL;
+	if (caller_waiting.load()) wake(batch_ready);
+}
+
+template<class Condition>
+void TokenPipeline::sleepUntil(std::atomic<bool>& waiting, std::condition_variable& signal, Condition condition) {
+	std::unique_lock<std::mutex> guard(lock);
+	waiting.store(true);
+	while(!condition()) signal.wait(guard);
+	waiting.store(false);
+}
+
+// taking the lock first means a side that just saw the ring empty or full is already asleep
+void TokenPipeline::wake(std::condition_variable& sleeper) {
+	std::lock_guard<std::mutex> guard(lock);
+	sleeper.notify_one();
+}
+
+template<class Source>
+void TokenPipeline::produce(Source source) {
+	try {
+		TokenizerCore<RowColumnPosition, Sink, KeepErrors, Source, IgnoreTypes, UseModes>
+			core(tokenizer, Sink(this));
+		core.tokenize(source);
+		if (filling != NULL) publish();
+		num_errors = core.errors();
+	} catch (Cancelled&) {
+	} catch (...) {
+		error = std::current_exception();
+	}
+	done.store(true);
+	wake(batch_ready);
+}
@@ -0,0 +1,114 @@
+/*
+Token pipeline lexes on its own thread while the caller parses, so lexing and
+parsing of a large text overlap on two cores. The lexing thread fills batches
+of a fixed number of tokens and hands them to the caller through a ring of
+batches with one producer and one consumer. Handing over a batch, or giving it
+back, is a single atomic store, and no locks are taken while both sides keep up.
+A side that has to wait spins for a short while and then sleeps on a condition
+variable. It is only woken when the ring goes from empty to not empty, or from
+full to not full, so sleeping does not cost a core.
+
+When every batch in the ring is waiting to be parsed the lexing thread waits
+for the caller, so memory is bounded by the number and size of batches. A
+batch is given back when next() is called again, and its tokens (and their
+string memory) are reused for a later batch. next() returns NULL at the end of
+the text, or rethrows an exception thrown while lexing (a failed read of the
+stream for example). The tokenizer should not be used for anything else until
+the pipeline is destroyed, which stops the lexing thread if it is not done.
+The batches take the place of the token and memory limits of the tokenizer,
+so a tokenizer with either set is refused.
+
+ex)
+TokenPipeline pipeline(tokenizer, &fin);
+while(const TokenBuffer* batch = pipeline.next()) {
+	for(const Token& token : *batch) {
+		parser.add(token);
+	}
+}
+if (pipeline.errors() > 0) reportInvalidTokens();
+*/
+
+#ifndef TOKEN_PIPELINE_HPP
+#define TOKEN_PIPELINE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <istream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include "token.hpp"
+#include "token_buffer.hpp"
+#include "tokenizer.hpp"
+
+class TokenPipeline {
+public:
+	static const size_t DEFAULT_BATCH_SIZE = 1024;
+	static const uint DEFAULT_BATCHES = 8;
+	// times a side checks the ring before it sleeps
+	static const uint SPINS = 100;
+
+	TokenPipeline(Tokenizer& tokenizer, std::istream* stream,
+		size_t batch_size = DEFAULT_BATCH_SIZE, uint batches = DEFAULT_BATCHES);
+	TokenPipeline(Tokenizer& tokenizer, const char* data, size_t size,
+		size_t batch_size = DEFAULT_BATCH_SIZE, uint batches = DEFAULT_BATCHES);
+	~TokenPipeline();
+	TokenPipeline(const TokenPipeline&) = delete;
+	TokenPipeline& operator=(const TokenPipeline&) = delete;
+
+	// gives back the last batch and waits for the next, NULL at the end. Valid until the next call
+	const TokenBuffer* next();
+
+	// invalid tokens in the text, once next() has returned NULL
+	uint errors() const { return num_errors; }
+
+	// batches lexed but not given back yet
+	size_t queued() const { return produced.load() - consumed.load(); }
+
+private:
+	// thrown on the lexing thread to stop it when the pipeline is destroyed
+	struct Cancelled {};
+
+	// the TokenizerCore sink of the lexing thread
+	struct Sink;
+
+	Tokenizer& tokenizer;
+	size_t batch_size;
+	std::vector<TokenBuffer> batches;
+
+	// written by one side each, on separate cache lines
+	alignas(64) std::atomic<size_t> produced;
+	alignas(64) std::atomic<size_t> consumed;
+
+	// lexing thread
+	alignas(64) size_t next_batch;
+	TokenBuffer* filling;
+
+	// caller
+	bool holding;
+
+	// only taken to sleep once spinning gave up, and to wake a sleeping side
+	std::mutex lock;
+	std::condition_variable batch_ready;
+	std::condition_variable batch_free;
+	std::atomic<bool> caller_waiting;
+	std::atomic<bool> lexer_waiting;
+
+	std::atomic<bool> done;
+	std::atomic<bool> cancelled;
+	std::exception_ptr error;
+	uint num_errors;
+	std::thread thread;
+
+	template<class Source>
+	void produce(Source source);
+	void add(int type, const char* begin, const char* end, uint row, uint column);
+	void publish();
+	template<class Condition>
+	void sleepUntil(std::atomic<bool>& waiting, std::condition_variable& signal, Condition condition);
+	void wake(std::condition_variable& sleeper);
+};
+
+#endif
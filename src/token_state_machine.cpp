@@ -2,39 +2,54 @@
 #include <iomanip>
 #include <string>
 #include <fstream>
+#include <cstdlib>
+#include <cctype>
 #include "token_state_machine.hpp"
 
+const uint TokenStateMachine::COMPILER_VERSION;
+const uint TokenStateMachine::NO_MAXIMUM;
+const uint TokenStateMachine::MAX_REPETITIONS;
+const uint TokenStateMachine::FILE_VERSION;
+const size_t TokenStateMachine::DEFAULT_PAIR_TABLE_SIZE;
+
 const std::string TokenStateMachine::DIGITS = "0123456789"; // \d
 const std::string TokenStateMachine::WORD = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_"; // \w
 const std::string TokenStateMachine::WHITESPACE = " \t\r\f\n\v"; // \s
 const std::string TokenStateMachine::LOWERCASE = "abcdefghijklmnopqrstuvwxyz"; // \l
 const std::string TokenStateMachine::UPPERCASE = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"; // \u
 const std::string TokenStateMachine::HEXDIGITS = "0123456789abcdefABCDEF"; // \h
+const std::string TokenStateMachine::IGNORE_CASE = "(?i)";
 
-TokenStateMachine::Iterator::Iterator(TokenStateMachine* my_machine) {
+TokenStateMachine::Iterator::Iterator(TokenStateMachine* my_machine, uint mode) {
 	TokenStateMachine::machineAssert(my_machine != NULL, "token state machine is null");
+	TokenStateMachine::machineAssert(mode < my_machine->modes(), "mode does not exist");
+	if (my_machine->table_dirty) my_machine->buildTable();
 	this->my_machine = my_machine;
-	this->state = 1;
+	this->state = my_machine->start_states[mode];
 	this->type = -1;
 }
 
-void TokenStateMachine::Iterator::nextState(char c) {
-	machineAssert(state < my_machine->state_transitions.size(), "state out of bounds");
-	const std::map<char, uint>& transitions = my_machine->state_transitions[state];
-	auto it = transitions.find(c);
-	if (it != transitions.end()) {
-		state = it->second;
-	} else {
-		state = 0;
-	}
-	int new_type = my_machine->state_types[state];
-	type = (new_type != -1) ? new_type : type;
+// continues from the state and type another iterator of the same table had
+TokenStateMachine::Iterator::Iterator(TokenStateMachine* my_machine, State state, int type) {
+	TokenStateMachine::machineAssert(my_machine != NULL, "token state machine is null");
+	if (my_machine->table_dirty) my_machine->buildTable();
+	TokenStateMachine::machineAssert(state < my_machine->state_types.size(), "state does not exist");
+	this->my_machine = my_machine;
+	this->state = state;
+	this->type = type;
 }
 
 TokenStateMachine::TokenStateMachine() {
 	// state 0 is the end state
 	state_transitions.resize(2);
 	state_types.resize(2, -1);
+	start_states.push_back(1);
+	fold_case = false;
+	table_dirty = true;
+	memory_usage = 0;
+	num_classes = 0;
+	pair_row_shift = 0;
+	max_pair_table_size = DEFAULT_PAIR_TABLE_SIZE;
 }
 
 TokenStateMachine::TokenStateMachine(uint rows, const std::map<char, uint>* state_changes, const int* types) {
@@ -45,67 +60,328 @@ TokenStateMachine::TokenStateMachine(uint rows, const std::map<char, uint>* stat
 		state_transitions[r+1] = state_changes[r];
 		state_types[r+1] = types[r];
 	}
+	start_states.push_back(1);
+	fold_case = false;
+	table_dirty = true;
+	memory_usage = 0;
+	num_classes = 0;
+	pair_row_shift = 0;
+	max_pair_table_size = DEFAULT_PAIR_TABLE_SIZE;
 }
 
+/*
+files start with "TSM <version>" followed by the number of rows and each row's
+type and transitions (byte value and next state), then the start state of each
+mode. Files without the header are from before bytes were saved as numbers
+*/
 bool TokenStateMachine::saveToFile(std::string filename) {
+	if (table_dirty) buildTable();
 	std::ofstream fout(filename.c_str());
 	if (fout.is_open()) {
+		fout << "TSM " << FILE_VERSION << ' ';
 		fout << (state_transitions.size()-1) << ' ';
 		for(uint row = 1; row < state_transitions.size(); row++) {
 			fout << state_types[row] << ' ';
 			const std::map<char, uint>& transitions = state_transitions[row];
 			fout << transitions.size() << ' ';
 			for(auto it = transitions.begin(); it != transitions.end(); it++) {
-				fout << it->first <<  ' ' << it->second << ' ';
+				fout << (uint)(unsigned char)it->first <<  ' ' << it->second << ' ';
 			}
 		}
+		fout << start_states.size() << ' ';
+		for(uint mode = 0; mode < start_states.size(); mode++) {
+			fout << start_states[mode] << ' ';
+		}
 		fout.close();
-		return true;
+		return !fout.fail();
 	}
 	return false;
 }
 
 bool TokenStateMachine::loadFromFile(std::string filename) {
 	std::ifstream fin(filename.c_str());
+	if (!fin.is_open()) return false;
+
+	std::string header;
+	uint version = 0;
 	uint rows;
-	if (fin.is_open()) {
-		fin >> rows;
-		state_transitions.resize(rows + 1);
-		state_types.resize(rows + 1);
+	fin >> header;
+	if (header == "TSM") {
+		fin >> version >> rows;
+		if (version > FILE_VERSION) return false;
+	} else {
+		rows = std::strtoul(header.c_str(), NULL, 10);
+	}
 
-		for(uint row = 0; row < rows; row++) {
-			fin >> state_types[row + 1];
-			uint changes;
-			fin >> changes;
-			std::map<char, uint>& transitions = state_transitions[row + 1];
-			for(uint i = 0; i < changes; i++) {
-				char c;
-				uint state;
-				fin >> c >> state;
-				transitions[c] = state;
+	TokenStateMachine machine;
+	machine.state_transitions.assign(rows + 1, std::map<char, uint>());
+	machine.state_types.assign(rows + 1, -1);
+
+	for(uint row = 0; row < rows && fin; row++) {
+		fin >> machine.state_types[row + 1];
+		uint changes;
+		fin >> changes;
+		std::map<char, uint>& transitions = machine.state_transitions[row + 1];
+		for(uint i = 0; i < changes && fin; i++) {
+			char c;
+			uint state;
+			if (version > 0) {
+				uint byte;
+				fin >> byte;
+				c = (char)byte;
+			} else {
+				fin >> c;
 			}
+			fin >> state;
+			if (state > rows) return false;
+			transitions[c] = state;
 		}
-		fin.close();
-		return true;
 	}
-	return false;
+	if (fin.fail()) return false;
+
+	// files without modes only have a start state for mode 0
+	uint modes;
+	if (fin >> modes) {
+		machine.start_states.resize(modes);
+		for(uint mode = 0; mode < modes; mode++) {
+			fin >> machine.start_states[mode];
+		}
+		if (fin.fail()) return false;
+	}
+	fin.close();
+
+	machine.max_pair_table_size = max_pair_table_size;
+	*this = machine;
+	table_dirty = true;
+	return true;
 }
 
 void TokenStateMachine::machineAssert(bool condition, std::string message) {
 	if (!condition) throw std::runtime_error(message);
 }
 
-void TokenStateMachine::addRule(std::string str, int type) {
+void TokenStateMachine::addRule(const std::string& str, int type, uint mode) {
 	machineAssert(str.size() > 0, "string cannot be empty");
-	States end_states = compileRegexSequence(States(1, 1), str);
+	machineAssert(mode < start_states.size(), "mode does not exist");
+
+	fold_case = (str.compare(0, IGNORE_CASE.size(), IGNORE_CASE) == 0);
+	uint begin = fold_case ? IGNORE_CASE.size() : 0;
+	machineAssert(begin < str.size(), "string cannot be empty");
+
+	// rules that only match one string skip the regex parser
+	std::string literal;
+	if (parseLiteral(str.substr(begin), literal)) {
+		setStateType(compileLiteral(start_states[mode], literal), type);
+		table_dirty = true;
+		return;
+	}
+
+	States end_states = compileRegexSequence(States(1, start_states[mode]), str, begin, str.size());
 
 	for(uint i = 0; i < end_states.size(); i++) {
 		setStateType(end_states[i], type);
 	}
+	table_dirty = true;
+}
+
+void TokenStateMachine::addLiteral(const std::string& literal, int type, uint mode) {
+	machineAssert(literal.size() > 0, "string cannot be empty");
+	machineAssert(mode < start_states.size(), "mode does not exist");
+	fold_case = false;
+	setStateType(compileLiteral(start_states[mode], literal), type);
+	table_dirty = true;
+}
+
+void TokenStateMachine::buildTable() {
+	uint rows = (state_transitions.size() > state_types.size())
+		? state_transitions.size() : state_types.size();
+	state_transitions.resize(rows);
+	state_types.resize(rows, -1);
+
+	table.assign(rows << 8, 0);
+	size_t num_transitions = 0;
+	for(uint row = 0; row < rows; row++) {
+		const std::map<char, uint>& transitions = state_transitions[row];
+		for(auto it = transitions.begin(); it != transitions.end(); it++) {
+			table[(row << 8) | (unsigned char)it->first] = it->second;
+		}
+		num_transitions += transitions.size();
+	}
+	buildByteClasses();
+	buildPairTable();
+	table_dirty = false;
+
+	// map nodes also hold 3 pointers and a colour
+	memory_usage = table.capacity() * sizeof(State) + state_types.capacity() * sizeof(int)
+		+ pair_table.capacity() * sizeof(Pair)
+		+ state_transitions.capacity() * sizeof(std::map<char, uint>)
+		+ num_transitions * (sizeof(std::pair<const char, uint>) + 4 * sizeof(void*));
+}
+
+// bytes go in the same class when every state changes to the same state on them
+void TokenStateMachine::buildByteClasses() {
+	uint rows = state_types.size();
+	std::map<std::vector<State>, uint> classes;
+	std::vector<State> column(rows);
+	for(uint byte = 0; byte < 256; byte++) {
+		for(uint row = 0; row < rows; row++) {
+			column[row] = table[(row << 8) | byte];
+		}
+		auto it = classes.insert(std::make_pair(column, (uint)classes.size())).first;
+		byte_classes[byte] = it->second;
+	}
+	num_classes = classes.size();
 }
 
-TokenStateMachine::Iterator TokenStateMachine::begin() {
-	return Iterator(this);
+// only built when it fits in max_pair_table_size
+void TokenStateMachine::buildPairTable() {
+	pair_table.clear();
+	for(pair_row_shift = 0; (1u << pair_row_shift) < num_classes * num_classes; pair_row_shift++);
+	uint rows = state_types.size();
+	if (((size_t)rows << pair_row_shift) * sizeof(Pair) > max_pair_table_size) {
+		pair_table.shrink_to_fit();
+		return;
+	}
+
+	// any byte of a class stands for the whole class
+	std::vector<unsigned char> class_bytes(num_classes);
+	for(uint byte = 256; byte-- > 0;) {
+		class_bytes[byte_classes[byte]] = byte;
+	}
+
+	Pair end_pair = { 0, -1 };
+	pair_table.assign((size_t)rows << pair_row_shift, end_pair);
+	for(uint row = 1; row < rows; row++) {
+		for(uint first = 0; first < num_classes; first++) {
+			State middle = table[(row << 8) | class_bytes[first]];
+			if (middle == 0) continue;
+			for(uint second = 0; second < num_classes; second++) {
+				State last = table[(middle << 8) | class_bytes[second]];
+				if (last == 0) continue;
+				Pair& pair = pair_table[(row << pair_row_shift) + first * num_classes + second];
+				pair.row = last << pair_row_shift;
+				pair.type = (state_types[last] != -1) ? state_types[last] : state_types[middle];
+			}
+		}
+	}
+}
+
+uint TokenStateMachine::addMode() {
+	start_states.push_back(addState());
+	table_dirty = true;
+	return start_states.size() - 1;
+}
+
+/*
+replaces this machine with one matching the rules of both it and other, made of
+a state for each pair of their states that some text reaches. Each mode matches
+the rules of that mode in both, and a mode only one of them has keeps its own
+rules. States are numbered in the order they are reached, so merging the same
+machines always gives the same table
+*/
+void TokenStateMachine::merge(const TokenStateMachine& other, MergeConflict conflict) {
+	typedef std::pair<State, State> StatePair;
+	const std::map<char, uint> no_transitions;
+	TokenStateMachine machine;
+	std::map<StatePair, State> pair_states;
+	std::vector<StatePair> pairs(1, StatePair(0, 0)); // indexed by state of machine
+	pair_states[pairs[0]] = 0;
+
+	uint num_modes = (modes() > other.modes()) ? modes() : other.modes();
+	for(uint mode = 0; mode < num_modes; mode++) {
+		State state = (mode == 0) ? machine.start_states[0] : machine.start_states[machine.addMode()];
+		StatePair pair((mode < modes()) ? start_states[mode] : 0, (mode < other.modes()) ? other.start_states[mode] : 0);
+		pairs.resize(state + 1);
+		pairs[state] = pair;
+		pair_states[pair] = state;
+	}
+
+	for(State state = 1; state < pairs.size(); state++) {
+		StatePair pair = pairs[state];
+		if (machine.state_types.size() <= state) machine.state_types.resize(state + 1, -1);
+		machine.state_types[state] = mergeTypes(stateType(pair.first), other.stateType(pair.second), conflict);
+
+		// both maps are in the same order, so the bytes either one changes on are walked together
+		const std::map<char, uint>& first = (pair.first < state_transitions.size())
+			? state_transitions[pair.first] : no_transitions;
+		const std::map<char, uint>& second = (pair.second < other.state_transitions.size())
+			? other.state_transitions[pair.second] : no_transitions;
+		auto a = first.begin();
+		auto b = second.begin();
+		while(a != first.end() || b != second.end()) {
+			char c;
+			StatePair next(0, 0);
+			if (b == second.end() || (a != first.end() && a->first < b->first)) {
+				c = a->first;
+				next.first = a->second;
+				a++;
+			} else if (a == first.end() || b->first < a->first) {
+				c = b->first;
+				next.second = b->second;
+				b++;
+			} else {
+				c = a->first;
+				next = StatePair(a->second, b->second);
+				a++;
+				b++;
+			}
+
+			auto it = pair_states.find(next);
+			State next_state;
+			if (it != pair_states.end()) {
+				next_state = it->second;
+			} else {
+				next_state = machine.addState();
+				pairs.push_back(next);
+				pair_states[next] = next_state;
+			}
+			if (next_state == 0) continue;
+			machineAssert(!machine.isStartState(next_state), "cannot go back to start state");
+			std::map<char, uint>& transitions = machine.state_transitions[state];
+			transitions.emplace_hint(transitions.end(), c, next_state);
+		}
+	}
+
+	machine.state_types.resize(machine.state_transitions.size(), -1);
+	machine.max_pair_table_size = max_pair_table_size;
+	*this = machine;
+	table_dirty = true;
+}
+
+// static
+int TokenStateMachine::mergeTypes(int first, int second, MergeConflict conflict) {
+	if (first == -1 || first == second) return second;
+	if (second == -1) return first;
+	machineAssert(conflict != THROW_ON_CONFLICT, "merged machines give a state types "
+		+ std::to_string(first) + " and " + std::to_string(second));
+	return (conflict == KEEP_FIRST) ? first : second;
+}
+
+TokenStateMachine::Iterator TokenStateMachine::begin(uint mode) {
+	return Iterator(this, mode);
+}
+
+// approximate bytes used by the rules and table
+size_t TokenStateMachine::memoryUsage() {
+	if (table_dirty) buildTable();
+	return memory_usage;
+}
+
+uint TokenStateMachine::byteClasses() {
+	if (table_dirty) buildTable();
+	return num_classes;
+}
+
+// true if iterators can step over two bytes at a time with nextPairs()
+bool TokenStateMachine::usesPairs() {
+	if (table_dirty) buildTable();
+	return !pair_table.empty();
+}
+
+// 0 never builds a pair table
+void TokenStateMachine::setPairTableSize(size_t max_size) {
+	max_pair_table_size = max_size;
+	table_dirty = true;
 }
 
 void TokenStateMachine::setStateType(State state, int type) {
@@ -120,23 +396,32 @@ void TokenStateMachine::setStateType(State state, int type) {
 }
 
 void TokenStateMachine::setStateChange(State from_state, char c, State to_state) {
+	setStateChanges(from_state, (unsigned char)c, (unsigned char)c, to_state);
+}
+
+// sets the state change for every byte in [first, last] with a single map lookup
+void TokenStateMachine::setStateChanges(State from_state, unsigned char first, unsigned char last, State to_state) {
 	machineAssert(from_state != 0, "cannot change end state");
-	machineAssert(to_state != 1, "cannot go back to start state");
+	machineAssert(!isStartState(to_state), "cannot go back to start state");
 
 	// resize matrix
 	State max_state = (from_state > to_state) ? from_state : to_state;
 	if (max_state >= state_transitions.size()) {
 		state_transitions.resize(max_state + 1);
 	}
-		
+
+	// ranges never cross 0x80 so they are in order as chars too
 	std::map<char, uint>& transitions = state_transitions[from_state];
-	auto it = transitions.find(c);
-	if (it == transitions.end()) {
-		transitions[c] = to_state;
-	} else {
-		machineAssert(it->second == to_state, "trying to override state change "
-			+ std::to_string(from_state) + " on " + std::string(1, c) + " from "
-			+ std::to_string(it->second) + " to " + std::to_string(to_state));
+	auto it = transitions.lower_bound((char)first);
+	for(uint c = first; c <= last; c++) {
+		if (it != transitions.end() && it->first == (char)c) {
+			machineAssert(it->second == to_state, "trying to override state change "
+				+ std::to_string(from_state) + " on " + std::string(1, (char)c) + " from "
+				+ std::to_string(it->second) + " to " + std::to_string(to_state));
+		} else {
+			it = transitions.emplace_hint(it, (char)c, to_state);
+		}
+		it++;
 	}
 }
 
@@ -173,27 +458,32 @@ ex) "-128", DECIMAL
 ex) "\"((\\.)|[^\\\"])*\""
 */
 
-States TokenStateMachine::compileRegexSequence(States start_states, std::string str) {
+States TokenStateMachine::compileRegexSequence(const States& start_states, const std::string& str,
+		uint begin, uint end) {
 	States end_states;
-	uint index = 0;
+	States next_end_states;
+	std::vector<std::pair<uint, uint>> groups;
+	const States* cur_start_states = &start_states;
+	uint index = begin;
 
-	while(index < str.size()) {
-		end_states.clear();
+	while(index < end) {
+		next_end_states.clear();
+		groups.clear();
 
 		// parse all group options
 		// ex) (ab)|(de)|(fg)
-		std::vector<std::string> groups;
 		bool add_option;
 
 		do {
-			std::string group = parseRegexGroup(str, index);
+			uint group_begin = index;
+			parseRegexGroup(str, index, end);
 			add_option = false;
-			if (group.size() > 0) {
-				groups.push_back(group);
+			if (index > group_begin) {
+				groups.push_back(std::make_pair(group_begin, index));
 
-				if (index < str.size() && str[index] == '|') {
+				if (index < end && str[index] == '|') {
 					index++;
-					machineAssert(index < str.size(), "no group on right side of bar");
+					machineAssert(index < end, "no group on right side of bar");
 					add_option = true;
 				}
 			}
@@ -201,63 +491,124 @@ States TokenStateMachine::compileRegexSequence(States start_states, std::string
 
 		// compile each sub-sequence
 		for(uint i = 0; i < groups.size(); i++) {
-			States cur_end_states = compileRegexGroup(start_states, groups[i]);
-			end_states.insert(end_states.end(), cur_end_states.begin(), cur_end_states.end());
+			States cur_end_states = compileRegexGroup(*cur_start_states, str, groups[i].first, groups[i].second);
+			next_end_states.insert(next_end_states.end(), cur_end_states.begin(), cur_end_states.end());
 		}
 
 		// prepare for next iteration
-		start_states = end_states;
+		end_states.swap(next_end_states);
+		cur_start_states = &end_states;
 	}
 	return end_states;
 }
 
-std::string TokenStateMachine::parseRegexGroup(const std::string& str, uint& index) {
-	std::string substr;
-	if (index < str.size()) {
+// advances index past the group (an atom and its quantifiers) starting at str[index]
+void TokenStateMachine::parseRegexGroup(const std::string& str, uint& index, uint end) {
+	if (index < end) {
+		parseRegexAtom(str, index, end);
+
+		uint min_passes;
+		uint max_passes;
+		while(parseQuantifier(str, index, end, min_passes, max_passes));
+	}
+}
+
+// advances index past the character, class or bracketed group starting at str[index]
+void TokenStateMachine::parseRegexAtom(const std::string& str, uint& index, uint end) {
+	if (index < end) {
 		char c = str[index++];
 		machineAssert(!isQuantifier(c),
 			"group cannot start with quantifier");
 
 		if (c == '(' || c == '[') {
 			index--;
-			substr = parseMatchingBrackets(str, index);
+			parseMatchingBrackets(str, index, end);
 		} else {
+			bool escaped = false;
 			if (c == '\\') {
-				machineAssert(index < str.size(),
+				machineAssert(index < end,
 					"no character after escape");
 
-				substr += '\\';
+				escaped = true;
 				c = str[index++];
 			}
 
-			substr += c;
-		}
+			if (escaped && (c == 'x' || c == 'p') && index < end && str[index] == '{') {
+				// \x{code point} or \p{category}
+				size_t close = str.find('}', index);
+				machineAssert(close < end, "no closing brace");
+				index = close + 1;
+			}
 
-		while((index < str.size()) && isQuantifier(str[index])){
-			substr += str[index++];
+			// keep multi-byte characters together so quantifiers apply to all of it
+			while(index < end && utf8::isContinuation(str[index])) {
+				index++;
+			}
 		}
 	}
+}
 
-	return substr;
+/*
+advances index past the quantifier (?, +, *, {m}, {m,} or {m,n}) starting at
+str[index] and returns true, or returns false if there is none. A brace that
+does not start a repetition is an ordinary character
+*/
+bool TokenStateMachine::parseQuantifier(const std::string& str, uint& index, uint end,
+		uint& min_passes, uint& max_passes) {
+	if (index >= end) return false;
+
+	char q = str[index];
+	if (isQuantifier(q)) {
+		min_passes = (q == '+') ? 1 : 0;
+		max_passes = (q == '?') ? 1 : NO_MAXIMUM;
+		index++;
+		return true;
+	}
+	if (q != '{') return false;
+
+	uint cur = index + 1;
+	uint first_digit = cur;
+	uint min_value = 0;
+	while(cur < end && isdigit((unsigned char)str[cur]) && cur - first_digit < 5) {
+		min_value = min_value * 10 + (str[cur++] - '0');
+	}
+	if (cur == first_digit || cur >= end) return false;
+
+	uint max_value = min_value;
+	if (str[cur] == ',') {
+		cur++;
+		first_digit = cur;
+		max_value = 0;
+		while(cur < end && isdigit((unsigned char)str[cur]) && cur - first_digit < 5) {
+			max_value = max_value * 10 + (str[cur++] - '0');
+		}
+		if (cur == first_digit) max_value = NO_MAXIMUM;
+	}
+	if (cur >= end || str[cur] != '}') return false;
+
+	machineAssert(min_value <= max_value, "repetition minimum is more than its maximum");
+	machineAssert(min_value <= MAX_REPETITIONS && (max_value <= MAX_REPETITIONS || max_value == NO_MAXIMUM),
+		"too many repetitions");
+	min_passes = min_value;
+	max_passes = max_value;
+	index = cur + 1;
+	return true;
 }
 
-std::string TokenStateMachine::parseMatchingBrackets(const std::string& str, uint& index) {
-	std::string substr;
-	machineAssert(index < str.size(), "index out of bounds");
+void TokenStateMachine::parseMatchingBrackets(const std::string& str, uint& index, uint end) {
+	machineAssert(index < end, "index out of bounds");
 	char open_bracket = str[index];
-	char close_bracket;
+	char close_bracket = ')';
 	switch(open_bracket) {
 		case '(': close_bracket = ')'; break;
 		case '[': close_bracket = ']'; break;
 		default: machineAssert(false, "invalid open bracket");
 	}
-	substr += open_bracket;
 	uint bracket_depth = 1;
 	index++;
 	bool escaped = false;
-	while(index < str.size() && bracket_depth > 0) {
+	while(index < end && bracket_depth > 0) {
 		char c = str[index++];
-		substr += c;
 
 		if (!escaped) {
 			if (c == '\\') escaped = true;
@@ -268,184 +619,356 @@ std::string TokenStateMachine::parseMatchingBrackets(const std::string& str, uin
 		}
 	}
 	machineAssert(bracket_depth == 0, "number of brackets do not match");
-
-	return substr;
 }
 
-States TokenStateMachine::compileRegexGroup(States start_states, std::string str) {
+States TokenStateMachine::compileRegexGroup(const States& start_states, const std::string& str,
+		uint begin, uint end) {
 	States end_states;
 
-	machineAssert(str.size() > 0, "group string is empty");
-	char back = str.back();
-	char front = str.front();
+	machineAssert(end > begin, "group string is empty");
+	char front = str[begin];
+	uint atom_end = begin;
+	parseRegexAtom(str, atom_end, end);
 
-	if (isQuantifier(back) && (str.size() > 1) && (str[str.size()-2] != '\\')) {
-		end_states = compileRegexQuantifier(start_states, str);
+	if (atom_end < end) {
+		end_states = compileRegexQuantifier(start_states, str, begin, end);
 	} else if (front == '[') {
-		std::string substr(str, 1, str.size()-2);
-		end_states = compileRegexBracketExpression(start_states, substr);
+		end_states = compileRegexBracketExpression(start_states, str, begin + 1, end - 1);
 	} else if (front == '(') {
-		std::string substr(str, 1, str.size()-2);
-		end_states = compileRegexSequence(start_states, substr);
+		end_states = compileRegexSequence(start_states, str, begin + 1, end - 1);
+	} else if (front == '.') {
+		utf8::CodePointSet any;
+		utf8::getCategory("Any", any);
+		end_states = compileRegexCodePoints(start_states, any);
 	} else {
-		char c = front;
-		if (c == '.') {
-			std::string char_group;
-			for(int c = 1; c < 128; c++) {
-				if (c == '\\') char_group += (char)c;
-				char_group += (char)c;
-			}
-			end_states = compileRegexBracketExpression(start_states, char_group);
+		uint index = begin;
+		utf8::CodePoint cp;
+		utf8::CodePointSet char_class;
+		bool is_char_class = parseRegexCharacter(str, index, end, cp, char_class);
+		if (index != end) {
+			machineAssert(false, "unexpected characters in group " + str.substr(begin, end - begin));
+		}
+
+		if (is_char_class) {
+			end_states = compileRegexCodePoints(start_states, char_class);
+		} else if (cp >= 0x80 || (fold_case && isalpha((int)cp))) {
+			char_class.add(cp);
+			end_states = compileRegexCodePoints(start_states, char_class);
 		} else {
-			bool is_char_class = false;
-			std::string char_class;
+			// encode state change on input c
+			char c = (char)cp;
+			State next_state = chooseState(start_states[0], c);
 
-			if (c == '\\') {
-				machineAssert(str.size() == 2, "no character after escape");
-				c = str[1];
-				is_char_class = true;
-				switch(c) {
-					case 'd': char_class = DIGITS; break;
-					case 'w': char_class = WORD; break;
-					case 's': char_class = WHITESPACE; break;
-					case 'l': char_class = LOWERCASE; break;
-					case 'u': char_class = UPPERCASE; break;
-					case 'h': char_class = HEXDIGITS; break;
-
-					default:
-						is_char_class = false;
-						c = getEscapedCharacter(c);
-				}
+			for(uint i = 0; i < start_states.size(); i++) {
+				setStateChange(start_states[i], c, next_state);
 			}
 
-			if (is_char_class) {
-				machineAssert(char_class.size(), "character class is empty");
-				end_states = compileRegexBracketExpression(start_states, char_class);
-			} else {
-				// encode state change on input c
-				State next_state = chooseState(start_states[0], c);
-
-				for(uint i = 0; i < start_states.size(); i++) {
-					setStateChange(start_states[i], c, next_state);
-				}
-
-				end_states.push_back(next_state);
-			}
+			end_states.push_back(next_state);
 		}
 	}
 	return end_states;
 }
 
-States TokenStateMachine::compileRegexQuantifier(States start_states, std::string str) {
-	States end_states;
-	States second_pass_start_states;
-	States should_be_the_same;
-	std::string substr;
+// the last quantifier applies to everything before it
+States TokenStateMachine::compileRegexQuantifier(const States& start_states, const std::string& str,
+		uint begin, uint end) {
+	uint index = begin;
+	parseRegexAtom(str, index, end);
+
+	uint last = index;
+	uint min_passes = 0;
+	uint max_passes = 0;
+	while(index < end) {
+		last = index;
+		machineAssert(parseQuantifier(str, index, end, min_passes, max_passes),
+			"back character is not a quantifier");
+	}
+	machineAssert(last > begin && last < end, "back character is not a quantifier");
 
-	char q = str.back();
-	machineAssert(isQuantifier(q), "back character is not a quantifier");
+	return compileRegexRepetition(start_states, str, begin, last, min_passes, max_passes);
+}
 
-	int min_passes = (q == '+') ? 1 : 0;
-	bool infinite_passes = (q == '?') ? false : true;
+/*
+compiles min_passes copies of the group one after another, then either one more
+copy that loops back on itself (no maximum) or a chain of optional copies each
+starting where the last one ended, so {m,n} only adds the states n copies need
+*/
+States TokenStateMachine::compileRegexRepetition(const States& start_states, const std::string& str,
+		uint begin, uint end, uint min_passes, uint max_passes) {
+	States cur_states = start_states;
+	bool infinite_passes = (max_passes == NO_MAXIMUM);
+	uint required_passes = (infinite_passes && min_passes > 0) ? min_passes - 1 : min_passes;
+	for(uint i = 0; i < required_passes; i++) {
+		cur_states = compileRegexGroup(cur_states, str, begin, end);
+	}
 
-	substr = std::string(str, 0, str.size()-1);
-	end_states = compileRegexGroup(start_states, substr);
+	States end_states;
 	if (infinite_passes) {
-		second_pass_start_states = end_states;
-		second_pass_start_states.insert(second_pass_start_states.begin(), start_states[0]);
-		should_be_the_same = compileRegexGroup(second_pass_start_states, substr);
+		end_states = compileRegexGroup(cur_states, str, begin, end);
+
+		States second_pass_start_states;
+		second_pass_start_states.reserve(end_states.size() + 1);
+		second_pass_start_states.push_back(cur_states[0]);
+		second_pass_start_states.insert(second_pass_start_states.end(), end_states.begin(), end_states.end());
+		States should_be_the_same = compileRegexGroup(second_pass_start_states, str, begin, end);
 		machineAssert(end_states == should_be_the_same, "states should be the same");
-	}
 
-	if (min_passes == 0) {
-		// concatenate end states with start states
-		end_states.insert(end_states.end(), start_states.begin(), start_states.end());
+		if (min_passes == 0) {
+			// concatenate end states with start states
+			end_states.insert(end_states.end(), cur_states.begin(), cur_states.end());
+		}
+	} else {
+		// the states after the most passes come first
+		end_states = cur_states;
+		for(uint i = min_passes; i < max_passes; i++) {
+			cur_states = compileRegexGroup(cur_states, str, begin, end);
+			end_states.insert(end_states.begin(), cur_states.begin(), cur_states.end());
+		}
 	}
-
 	return end_states;
 }
 
-States TokenStateMachine::compileRegexBracketExpression(States start_states, std::string str) {
-	machineAssert(str.size() > 0, "bracket expression string is empty");
-	States end_states;
-	std::string char_group;
+States TokenStateMachine::compileRegexBracketExpression(const States& start_states, const std::string& str,
+		uint begin, uint end) {
+	return compileRegexCodePoints(start_states, parseBracketExpression(str, begin, end, fold_case));
+}
+
+/*
+the characters matched by the bracket expression str[begin, end) without its
+brackets. Brackets can be nested to add their characters, and && intersects
+everything before it with everything after it up to the next &&
+ex) [\w&&[^\d_]] is a letter, [\p{L}&&\x{0}-\x{FF}] is a latin-1 letter
+
+with fold_case letters are folded before ^ takes the complement, so [^a] matches
+neither a nor A
+*/
+utf8::CodePointSet TokenStateMachine::parseBracketExpression(const std::string& str, uint begin, uint end,
+		bool fold_case) {
+	machineAssert(end > begin, "bracket expression string is empty");
+	utf8::CodePointSet char_group;
+	utf8::CodePointSet intersected_group;
+	bool intersecting = false;
 	bool excluded = false;
 	bool spanning = false;
-	bool escaped = false;
-	for(uint i = 0; i < str.size(); i++) {
-		char c = str[i];
-		if (c == '\\' && !escaped) {
-			escaped = true;
+	bool can_span = false;
+	utf8::CodePoint last_cp = 0;
+	uint index = begin;
+
+	if (str[index] == '^') {
+		excluded = true;
+		index++;
+	}
+
+	while(index < end) {
+		uint item_start = index;
+
+		if (str[index] == '&' && index + 1 < end && str[index + 1] == '&') {
+			machineAssert(!spanning, "intersection cannot end a span");
+			intersected_group = intersecting ? intersected_group.intersection(char_group) : char_group;
+			intersecting = true;
+			char_group = utf8::CodePointSet();
+			can_span = false;
+			index += 2;
+			continue;
+		}
+
+		if (str[index] == '[') {
+			machineAssert(!spanning, "bracket expression cannot end a span");
+			parseMatchingBrackets(str, index, end);
+			char_group.add(parseBracketExpression(str, item_start + 1, index - 1, fold_case));
+			can_span = false;
+			continue;
+		}
+
+		utf8::CodePoint cp;
+		utf8::CodePointSet char_class;
+		bool is_char_class = parseRegexCharacter(str, index, end, cp, char_class);
+
+		if (is_char_class) {
+			machineAssert(!spanning, "character class cannot end a span");
+			char_group.add(char_class);
+			can_span = false;
+		} else if (can_span && str[item_start] == '-' && index < end) {
+			spanning = true;
+			can_span = false;
+		} else if (spanning) {
+			machineAssert(last_cp <= cp, "span is out of order");
+			char_group.add(last_cp, cp);
+			spanning = false;
 		} else {
-			bool is_char_class = false;
-			std::string char_class;
-			if (escaped) {
-				is_char_class = true;
-				switch(c) {
-					case 'd': char_class = DIGITS; break;
-					case 'w': char_class = WORD; break;
-					case 's': char_class = WHITESPACE; break;
-					case 'l': char_class = LOWERCASE; break;
-					case 'u': char_class = UPPERCASE; break;
-					case 'h': char_class = HEXDIGITS; break;
-
-					default:
-						is_char_class = false;
-						c = getEscapedCharacter(c);
-				}
-				escaped = false;
+			char_group.add(cp);
+			last_cp = cp;
+			can_span = true;
+		}
+	}
+
+	if (intersecting) {
+		char_group = intersected_group.intersection(char_group);
+	}
+	if (fold_case) {
+		char_group = char_group.caseFolded();
+	}
+	if (excluded) {
+		char_group = char_group.complement();
+	}
+	return char_group;
+}
+
+States TokenStateMachine::compileRegexCodePoints(const States& start_states, const utf8::CodePointSet& char_group) {
+	machineAssert(!char_group.empty(), "character group is empty");
+	std::vector<utf8::ByteSequence> sequences = utf8::sequences(fold_case ? char_group.caseFolded() : char_group);
+
+	// every character ends in the same state
+	State end_state = chooseState(start_states[0], sequences);
+	if (end_state == 0) end_state = addState();
+
+	for(uint i = 0; i < sequences.size(); i++) {
+		const utf8::ByteSequence& sequence = sequences[i];
+
+		// the first byte leaves every start state, the rest continue from a single state
+		const State* cur_states = &start_states[0];
+		uint num_cur_states = start_states.size();
+		State cur_state;
+
+		for(uint b = 0; b < sequence.size(); b++) {
+			const utf8::ByteRange& range = sequence[b];
+			State next_state = end_state;
+			if (b + 1 < sequence.size()) {
+				next_state = getNextState(cur_states[0], (char)range.first);
+				if (next_state == 0) next_state = addState();
 			}
 
-			if (is_char_class) {
-				machineAssert(char_class.size(), "character class is empty");
-				for(uint i = 0; i < char_class.size(); i++) {
-					char_group += char_class[i];
-				}
-			} else if (i == 0 && c == '^') {
-				excluded = true;
-			} else if ((i > excluded) && (i < str.size()-1) && (c == '-')) {
-				spanning = true;
-			} else if (spanning) {
-				for(char cc = char_group.back()+1; cc <= c; cc++) {
-					char_group += cc;
-				}
-				spanning = false;
-			} else {
-				char_group += c;
+			for(uint s = 0; s < num_cur_states; s++) {
+				setStateChanges(cur_states[s], range.first, range.last, next_state);
 			}
+			cur_state = next_state;
+			cur_states = &cur_state;
+			num_cur_states = 1;
 		}
 	}
 
-	if (excluded) {
-		char_group = getExclusion(char_group);
+	return States(1, end_state);
+}
+
+// follows (or adds) one state per character, so literals sharing a prefix share states like a trie
+State TokenStateMachine::compileLiteral(State start_state, const std::string& literal) {
+	State state = start_state;
+	uint index = 0;
+	while(index < literal.size()) {
+		char c = literal[index];
+		if ((unsigned char)c < 0x80 && !(fold_case && isalpha((unsigned char)c))) {
+			State next_state = chooseState(state, c);
+			setStateChange(state, c, next_state);
+			state = next_state;
+			index++;
+		} else {
+			// numbered the same as when the character is part of a regex
+			utf8::CodePoint cp;
+			utf8::CodePointSet char_group;
+			machineAssert(utf8::decode(literal, index, cp), "invalid UTF-8 in rule");
+			char_group.add(cp);
+			state = compileRegexCodePoints(States(1, state), char_group)[0];
+		}
 	}
+	return state;
+}
+
+/*
+returns true if the rule only matches one string (no groups, classes or
+quantifiers) and puts that string in literal
+*/
+// static
+bool TokenStateMachine::parseLiteral(const std::string& str, std::string& literal) {
+	literal.clear();
+	literal.reserve(str.size());
+	for(uint index = 0; index < str.size(); index++) {
+		char c = str[index];
+		switch(c) {
+			case '(': case ')': case '[': case ']': case '|':
+			case '?': case '+': case '*': case '.': case '{':
+				return false;
+
+			case '\\':
+				if (++index == str.size()) return false;
+				c = str[index];
+				// escaped letters other than control characters are classes or code points
+				if ((unsigned char)c >= 0x80 || (isalnum((unsigned char)c) && getEscapedCharacter(c) == c)) {
+					return false;
+				}
+				literal += getEscapedCharacter(c);
+				break;
 
-	State next_state = chooseState(start_states[0], char_group[0]);
-	for(uint s = 0; s < start_states.size(); s++) {
-		State state = start_states[s];
-		for(uint i = 0; i < char_group.size(); i++) {
-			setStateChange(state, char_group[i], next_state);
+			default:
+				literal += c;
+				break;
 		}
 	}
-	end_states.push_back(next_state);
-	return end_states;
+
+	return true;
 }
 
-std::string TokenStateMachine::getExclusion(const std::string& excluded) {
-	std::string included;
-	bool include_chars[128];
-	for(uint i = 1; i < 128; i++) include_chars[i] = true;
-	for(uint i = 0; i < excluded.size(); i++) {
-		char c = excluded[i];
-		include_chars[(uint)c] = false;
+// static
+bool TokenStateMachine::getCharacterClass(char c, utf8::CodePointSet& char_class) {
+	const std::string* chars;
+	switch(c) {
+		case 'd': chars = &DIGITS; break;
+		case 'w': chars = &WORD; break;
+		case 's': chars = &WHITESPACE; break;
+		case 'l': chars = &LOWERCASE; break;
+		case 'u': chars = &UPPERCASE; break;
+		case 'h': chars = &HEXDIGITS; break;
+		default: return false;
 	}
-	for(uint i = 1; i < 128; i++) {
-		if (include_chars[i]) {
-			included += (char)i;
+	for(uint i = 0; i < chars->size(); i++) {
+		char_class.add((unsigned char)(*chars)[i]);
+	}
+	return true;
+}
+
+/*
+parses a single (possibly escaped or multi-byte) character starting at
+str[index]. Returns true if it was a character class, in which case char_class
+holds its characters, otherwise cp holds the character
+*/
+// static
+bool TokenStateMachine::parseRegexCharacter(const std::string& str, uint& index, uint end,
+		utf8::CodePoint& cp, utf8::CodePointSet& char_class) {
+	machineAssert(index < end, "index out of bounds");
+
+	if (str[index] != '\\') {
+		machineAssert(utf8::decode(str, index, cp) && index <= end, "invalid UTF-8 in rule");
+		return false;
+	}
+
+	index++;
+	machineAssert(index < end, "no character after escape");
+	char c = str[index++];
+
+	if ((c == 'x' || c == 'p') && index < end && str[index] == '{') {
+		size_t close = str.find('}', index);
+		machineAssert(close < end, "no closing brace");
+		std::string name(str, index + 1, close - index - 1);
+		index = close + 1;
+
+		if (c == 'p') {
+			machineAssert(utf8::getCategory(name, char_class), "unknown category " + name);
+			return true;
 		}
+
+		machineAssert(name.size() > 0 && name.size() <= 6
+			&& name.find_first_not_of(HEXDIGITS) == std::string::npos,
+			"invalid code point " + name);
+		cp = std::stoul(name, NULL, 16);
+		machineAssert(cp > 0 && cp <= utf8::MAX_CODE_POINT
+			&& (cp < utf8::SURROGATE_FIRST || cp > utf8::SURROGATE_LAST),
+			"invalid code point " + name);
+		return false;
 	}
 
-	return included;
+	if (getCharacterClass(c, char_class)) return true;
+
+	cp = (unsigned char)getEscapedCharacter(c);
+	return false;
 }
 
 void TokenStateMachine::debug() {
@@ -471,4 +994,29 @@ bool TokenStateMachine::isQuantifier(char c) {
 State TokenStateMachine::chooseState(State cur_state, char c) const {
 	State existing_state = getNextState(cur_state, c);
 	return (existing_state == 0) ? newState() : existing_state;
+}
+
+// returns the state an existing rule already reaches on one of the sequences, or 0
+State TokenStateMachine::chooseState(State cur_state, const std::vector<utf8::ByteSequence>& sequences) const {
+	for(uint i = 0; i < sequences.size(); i++) {
+		State state = cur_state;
+		for(uint b = 0; b < sequences[i].size() && state != 0; b++) {
+			state = getNextState(state, (char)sequences[i][b].first);
+		}
+		if (state != 0) return state;
+	}
+	return 0;
+}
+
+bool TokenStateMachine::isStartState(State state) const {
+	for(uint mode = 0; mode < start_states.size(); mode++) {
+		if (start_states[mode] == state) return true;
+	}
+	return false;
+}
+
+State TokenStateMachine::addState() {
+	State state = newState();
+	state_transitions.resize(state + 1);
+	return state;
 }
\ No newline at end of file
@@ -9,6 +9,37 @@ whatever type the iterator contains is the type of token that was parsed before
 the last character (a type less than 0 denotes an invalid token). Once state 0
 is hit the last character that was parsed should be put back into the stream
 from which it was read
+
+Rules operate on UTF-8 encoded text. Any unicode character (or set of characters)
+in a rule is split into byte sequences so the table only ever changes state on
+single bytes. Once rules are added the maps are flattened into a table of 256
+states per row which the iterator steps through
+
+The classes \w, \d, \s, \l, \u and \h (and the predefined rules of the
+tokenizer built on them) stay ASCII, and \p{L} and \p{N} are used for other
+scripts. A token never backs up to the last state that had a type, so a class
+of multi-byte letters would carry a word into a following symbol that shares
+their first byte (like U+20AC) and cut that character in two
+
+Bytes that every state treats the same are put in one byte class. When there
+are few enough classes a second table is built that steps over two bytes at a
+time, indexed by a state and the classes of both bytes. It halves the chain of
+dependent loads through long tokens. A pair whose bytes end the token gives
+state 0, and the iterator is stepped one byte at a time instead
+
+Rules can be split into modes. Each mode has its own start state in the same
+table (mode 0 starts at state 1) so a rule only competes with rules of its own
+mode
+
+Compiled machines can be merged with merge(), which walks pairs of their states
+instead of compiling either from its rules again. A state both machines give a
+type to takes the type of the conflict policy, so a dialect can add its
+keywords on top of the identifiers of a base language. Machines loaded from
+files merge the same way
+
+A rule starting with (?i) matches ASCII letters in either case. Both cases of a
+letter are compiled as one set, so they go to the same state and end up in the
+same byte class, and the table is no larger than for the rule in one case
 */
 
 #ifndef TOKEN_STATE_MACHINE_HPP
@@ -18,19 +49,51 @@ from which it was read
 #include <map>
 #include <string>
 #include <stdexcept>
+#include "utf8.hpp"
 
 typedef unsigned int uint;
 typedef uint State;
 typedef std::vector<State> States;
 
 class TokenStateMachine {
+	friend class TokenizerBatch;
+	friend class LazyStateMachine;
+
 public:
 	class Iterator {
 	public:
-		Iterator(TokenStateMachine* my_machine);
-		void nextState(char c);
-		uint getState() { return state; }
-		int getType() { return type; }
+		Iterator(TokenStateMachine* my_machine, uint mode = 0);
+		Iterator(TokenStateMachine* my_machine, State state, int type);
+		void nextState(char c) {
+			state = my_machine->table[(state << 8) | (unsigned char)c];
+			int new_type = my_machine->state_types[state];
+			type = (new_type != -1) ? new_type : type;
+		}
+
+		/*
+		steps over two bytes at a time until fewer than two are left or a pair
+		would end the token, and returns where it stopped. The rest is stepped
+		with nextState(). Needs a machine that usesPairs()
+		*/
+		const char* nextPairs(const char* cur, const char* end) {
+			const Pair* pairs = my_machine->pair_table.data();
+			const unsigned char* classes = my_machine->byte_classes;
+			uint num_classes = my_machine->num_classes;
+			uint shift = my_machine->pair_row_shift;
+			uint row = state << shift;
+			while(end - cur >= 2) {
+				const Pair& pair = pairs[row + classes[(unsigned char)cur[0]] * num_classes
+					+ classes[(unsigned char)cur[1]]];
+				if (pair.row == 0) break;
+				row = pair.row;
+				type = (pair.type != -1) ? pair.type : type;
+				cur += 2;
+			}
+			state = row >> shift;
+			return cur;
+		}
+		uint getState() const { return state; }
+		int getType() const { return type; }
 		bool atEnd() { return state == 0; }
 
 	private:
@@ -39,15 +102,50 @@ public:
 		TokenStateMachine* my_machine;
 	};
 
+	// increased whenever the same rules would compile to a different table
+	static const uint COMPILER_VERSION = 2;
+	static const uint FILE_VERSION = 1;
+
+	// {m,n} limits, {m,} has no maximum
+	static const uint NO_MAXIMUM = 0xFFFFFFFF;
+	static const uint MAX_REPETITIONS = 1000;
+
+	// prefix of a rule that ignores the case of ASCII letters
+	static const std::string IGNORE_CASE;
+
+	// largest pair table built by default, in bytes
+	static const size_t DEFAULT_PAIR_TABLE_SIZE = 1 << 20;
+
+	// the type of a state both merged machines give a different type
+	enum MergeConflict {
+		THROW_ON_CONFLICT,
+		KEEP_FIRST,
+		KEEP_SECOND
+	};
+
 	TokenStateMachine();
 	TokenStateMachine(uint rows, const std::map<char, uint>* state_changes, const int* types);
-	void addRule(std::string simple_regex, int type);
-	Iterator begin();
+	void addRule(const std::string& simple_regex, int type, uint mode = 0);
+	void addLiteral(const std::string& literal, int type, uint mode = 0);
+	uint addMode();
+	void merge(const TokenStateMachine& other, MergeConflict conflict = THROW_ON_CONFLICT);
+	uint modes() const { return start_states.size(); }
+	Iterator begin(uint mode = 0);
+	size_t memoryUsage();
+	uint byteClasses();
+	bool usesPairs();
+	void setPairTableSize(size_t max_size);
 	void debug();
 	bool saveToFile(std::string filename);
 	bool loadFromFile(std::string filename);
 
 private:
+	// the row of the state after two bytes and the last type either of them reached
+	struct Pair {
+		uint row;
+		int type;
+	};
+
 	enum RegexGroupType {
 		SINGLE,
 		SEQUENCE,
@@ -61,27 +159,67 @@ private:
 	static const std::string UPPERCASE;
 	static const std::string HEXDIGITS;
 
+	// set by addRule() for the rule being compiled
+	bool fold_case;
+
 	std::vector<std::map<char, uint>> state_transitions;
 	std::vector<int> state_types;
+	States start_states; // indexed by mode
+
+	// flattened state_transitions, rebuilt when the rules change
+	std::vector<State> table;
+	bool table_dirty;
+	size_t memory_usage;
 
+	unsigned char byte_classes[256];
+	uint num_classes;
+	std::vector<Pair> pair_table; // empty when it would be larger than max_pair_table_size
+	uint pair_row_shift; // rows are num_classes squared rounded up to a power of 2
+	size_t max_pair_table_size;
+
+	void buildTable();
+	void buildByteClasses();
+	void buildPairTable();
 	void setStateType(uint state, int type);
 	void setStateChange(uint state, char c, uint next_state);
+	void setStateChanges(uint state, unsigned char first, unsigned char last, uint next_state);
 	uint getNextState(uint state, char c) const;
 
-	States compileRegexSequence(States start_states, std::string str);
-	States compileRegexGroup(States start_states, std::string str);
-	States compileRegexBracketExpression(States start_states, std::string str);
-	States compileRegexQuantifier(States start_states, std::string str);
+	// regexes are compiled from str[begin, end) so groups are never copied
+	States compileRegexSequence(const States& start_states, const std::string& str, uint begin, uint end);
+	States compileRegexGroup(const States& start_states, const std::string& str, uint begin, uint end);
+	States compileRegexBracketExpression(const States& start_states, const std::string& str, uint begin, uint end);
+	States compileRegexQuantifier(const States& start_states, const std::string& str, uint begin, uint end);
+	States compileRegexRepetition(const States& start_states, const std::string& str, uint begin, uint end,
+		uint min_passes, uint max_passes);
+	States compileRegexCodePoints(const States& start_states, const utf8::CodePointSet& char_group);
+	State compileLiteral(State start_state, const std::string& literal);
 
 	State newState() const { return state_transitions.size(); }
+	State addState();
+	bool isStartState(State state) const;
+	int stateType(State state) const { return (state < state_types.size()) ? state_types[state] : -1; }
+	static int mergeTypes(int first, int second, MergeConflict conflict);
 	State chooseState(State cur_state, char c) const;
+	State chooseState(State cur_state, const std::vector<utf8::ByteSequence>& sequences) const;
 
 	static char getEscapedCharacter(char c);
 	static bool isQuantifier(char c);
-	static std::string parseRegexGroup(const std::string& str, uint& index);
-	static std::string parseMatchingBrackets(const std::string& str, uint& index);
-	static std::string getExclusion(const std::string& excluded);
+	static void parseRegexGroup(const std::string& str, uint& index, uint end);
+	static void parseRegexAtom(const std::string& str, uint& index, uint end);
+	static bool parseQuantifier(const std::string& str, uint& index, uint end, uint& min_passes, uint& max_passes);
+	static utf8::CodePointSet parseBracketExpression(const std::string& str, uint begin, uint end, bool fold_case);
+	static void parseMatchingBrackets(const std::string& str, uint& index, uint end);
+	static bool parseLiteral(const std::string& str, std::string& literal);
+	static bool getCharacterClass(char c, utf8::CodePointSet& char_class);
+	static bool parseRegexCharacter(const std::string& str, uint& index, uint end,
+		utf8::CodePoint& cp, utf8::CodePointSet& char_class);
 	static void machineAssert(bool condition, std::string message);
+
+	// literal messages are only made into strings when the assertion fails
+	static void machineAssert(bool condition, const char* message) {
+		if (!condition) throw std::runtime_error(message);
+	}
 };
 
 #endif
\ No newline at end of file
@@ -1,91 +1,879 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
 #include <sstream>
 #include "tokenizer.hpp"
 
-const char* Tokenizer::WHITESPACE = "\\s+";
-const char* Tokenizer::WORD_RULE = "[\\l\\u_][\\w]*";
-const char* Tokenizer::DECIMAL_RULE = "-?[1-9][\\d]*";
-const char* Tokenizer::MALFORMED_DECIMAL_RULE = "(-[0\\l\\u_])|(-?[1-9][\\d]*[\\l\\u_])[\\w]*";
-const char* Tokenizer::HEX_RULE = "$|(0x)[\\h]+";
-const char* Tokenizer::MALFORMED_HEX_RULE = "$|(0x)([\\h]*[g-zG-Z_][\\w]*)?";
-const char* Tokenizer::OCTAL_RULE = "0[0-7]*";
-const char* Tokenizer::MALFORMED_OCTAL_RULE = "0[0-7]*[89ac-wyz\\u_][\\w]*";
-const char* Tokenizer::BINARY_RULE = "0b[01]+";
-const char* Tokenizer::MALFORMED_BINARY_RULE = "0b[01]*[2-9\\l\\u_][\\w]*";
-const char* Tokenizer::DQ_STRING_RULE = "\"((\\\\.)|[^\"\\\\])*\"";
-const char* Tokenizer::SQ_STRING_RULE = "'((\\\\.)|[^\"\\\\])*'";
-const char* Tokenizer::CHARACTER_RULE = "'(\\\\.)|[^'\\\\]'";
-const char* Tokenizer::MALFORMED_CHARACTER_RULE = "'(\\\\.)|[^'\\\\]((\\\\.)|[^'\\\\])+'";
+constexpr const char* Tokenizer::WHITESPACE;
+constexpr const char* Tokenizer::WORD_RULE;
+constexpr const char* Tokenizer::DECIMAL_RULE;
+constexpr const char* Tokenizer::MALFORMED_DECIMAL_RULE;
+constexpr const char* Tokenizer::HEX_RULE;
+constexpr const char* Tokenizer::MALFORMED_HEX_RULE;
+constexpr const char* Tokenizer::OCTAL_RULE;
+constexpr const char* Tokenizer::MALFORMED_OCTAL_RULE;
+constexpr const char* Tokenizer::BINARY_RULE;
+constexpr const char* Tokenizer::MALFORMED_BINARY_RULE;
+constexpr const char* Tokenizer::DQ_STRING_RULE;
+constexpr const char* Tokenizer::SQ_STRING_RULE;
+constexpr const char* Tokenizer::CHARACTER_RULE;
+constexpr const char* Tokenizer::MALFORMED_CHARACTER_RULE;
+
+const uint Tokenizer::DEFAULT_MODE;
+const uint Tokenizer::CHECKPOINT_VERSION;
+
+Tokenizer::Tokenizer()
+	: token_list(NULL), token_buffer(NULL), mode_names(1, "default"), mode_actions(1), mode_stack(1, DEFAULT_MODE),
+	compiled(true), structural(false), lazy(false), row(1), column(1), num_errors(0), text_offset(0), feeding(false), token_iterator(&state_machine),
+	lazy_iterator(&lazy_machine),
+	token_row(1), token_column(1), unmatched_bytes(0), token_length(0), segmented(false),
+	max_token_length(0), long_token_action(TRUNCATE_TOKEN), max_tokens(0), memory_budget(0), segment_size(0),
+	call_status(COMPLETE), call_tokens(0), call_bytes(0), resume_data(NULL), resume_size(0),
+	resume_stream(NULL), resume_finish(false), metrics(NULL) {}
+
+Tokenizer::Tokenizer(const Tokenizer& other)
+	: token_iterator(&state_machine), lazy_iterator(&lazy_machine), metrics(NULL) {
+	*this = other;
+}
+
+// the iterators and resume_data point into the tokenizer itself, so a copy
+// points them at its own machines and buffer
+Tokenizer& Tokenizer::operator=(const Tokenizer& other) {
+	if (this == &other) return *this;
+	state_machine = other.state_machine;
+	token_list = other.token_list;
+	token_buffer = other.token_buffer;
+	ignore_types = other.ignore_types;
+	mode_names = other.mode_names;
+	mode_actions = other.mode_actions;
+	mode_stack = other.mode_stack;
+	rules = other.rules;
+	cache_directory = other.cache_directory;
+	compiled = other.compiled;
+	structural = other.structural;
+	classifiers = other.classifiers;
+	lazy = other.lazy;
+	lazy_machine = other.lazy_machine;
+	row = other.row;
+	column = other.column;
+	num_errors = other.num_errors;
+	text_offset = other.text_offset;
+	feeding = other.feeding;
+	token_iterator = TokenStateMachine::Iterator(&state_machine, other.token_iterator.getState(),
+		other.token_iterator.getType());
+	lazy_iterator = LazyStateMachine::Iterator(&lazy_machine, other.lazy_iterator);
+	partial_token = other.partial_token;
+	token_row = other.token_row;
+	token_column = other.token_column;
+	unmatched_bytes = other.unmatched_bytes;
+	token_length = other.token_length;
+	segmented = other.segmented;
+	max_token_length = other.max_token_length;
+	long_token_action = other.long_token_action;
+	max_tokens = other.max_tokens;
+	memory_budget = other.memory_budget;
+	segment_size = other.segment_size;
+	segment_sink = other.segment_sink;
+	call_status = other.call_status;
+	call_tokens = other.call_tokens;
+	call_bytes = other.call_bytes;
+	resume_buffer = other.resume_buffer;
+	bool buffered = other.resume_data != NULL && other.resume_data >= other.resume_buffer.data()
+		&& other.resume_data <= other.resume_buffer.data() + other.resume_buffer.size();
+	resume_data = buffered ? resume_buffer.data() + (other.resume_data - other.resume_buffer.data()) : other.resume_data;
+	resume_size = other.resume_size;
+	resume_stream = other.resume_stream;
+	resume_finish = other.resume_finish;
+	setMetrics(other.metrics);
+	return *this;
+}
+
+Tokenizer::~Tokenizer() {
+	if (metrics != NULL) metrics->removeMemoryUsage(this);
+}
+
+// memory is recorded per tokenizer, so move it out of the old metrics
+void Tokenizer::setMetrics(TokenizerMetrics* metrics) {
+	if (this->metrics != NULL && this->metrics != metrics) this->metrics->removeMemoryUsage(this);
+	this->metrics = metrics;
+}
 
 void Tokenizer::addRule(std::string rule, int token_type, bool ignore) {
-	state_machine.addRule(rule, token_type);
-	if (ignore) {
+	addRule(DEFAULT_MODE, rule, token_type, ignore);
+}
+
+void Tokenizer::addRule(uint mode, std::string rule, int token_type, bool ignore) {
+	if (mode >= mode_names.size()) throw std::runtime_error("mode does not exist");
+	if (lazy) {
+		lazy_machine.addRule(rule, token_type, mode);
+	} else if (cache_directory.empty()) {
+		if (metrics == NULL) {
+			state_machine.addRule(rule, token_type, mode);
+		} else {
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			state_machine.addRule(rule, token_type, mode);
+			metrics->recordCompile(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start).count());
+		}
+	} else {
+		compiled = false;
+	}
+	Rule entry = { mode, rule, token_type, ignore };
+	rules.push_back(entry);
+	classifiers.clear();
+
+	if (ignore && !isIgnored(token_type)) {
 		ignore_types.push_back(token_type);
 	}
 }
 
+// adds a rule matching exactly the given string, regex characters included
+void Tokenizer::addLiteral(const std::string& literal, int token_type, bool ignore) {
+	addLiteral(DEFAULT_MODE, literal, token_type, ignore);
+}
+
+void Tokenizer::addLiteral(uint mode, const std::string& literal, int token_type, bool ignore) {
+	std::string rule;
+	rule.reserve(literal.size() * 2);
+	for(uint i = 0; i < literal.size(); i++) {
+		switch(literal[i]) {
+			case '\\': case '(': case ')': case '[': case ']': case '|':
+			case '?': case '+': case '*': case '.': case '{':
+				rule += '\\';
+				break;
+			default:
+				break;
+		}
+		rule += literal[i];
+	}
+	addRule(mode, rule, token_type, ignore);
+}
+
+uint Tokenizer::addMode(const std::string& name) {
+	for(uint i = 0; i < mode_names.size(); i++) {
+		if (mode_names[i] == name) throw std::runtime_error("mode already exists: " + name);
+	}
+	uint mode = mode_names.size();
+	if (lazy) {
+		lazy_machine.addMode();
+	} else if (cache_directory.empty()) {
+		state_machine.addMode();
+	} else {
+		compiled = false;
+	}
+	mode_names.push_back(name);
+	mode_actions.resize(mode_names.size());
+	classifiers.clear();
+	return mode;
+}
+
+uint Tokenizer::getMode(const std::string& name) const {
+	for(uint i = 0; i < mode_names.size(); i++) {
+		if (mode_names[i] == name) return i;
+	}
+	throw std::runtime_error("mode does not exist: " + name);
+}
+
+void Tokenizer::addModeChange(uint mode, int token_type, ModeChange change, uint next_mode) {
+	if (mode >= mode_names.size() || next_mode >= mode_names.size()) {
+		throw std::runtime_error("mode does not exist");
+	}
+	ModeAction action = { change, next_mode };
+	mode_actions[mode][token_type] = action;
+}
+
+void Tokenizer::setCacheDirectory(const std::string& directory) {
+	if (!rules.empty() || mode_names.size() > 1) {
+		throw std::runtime_error("cache directory must be set before adding rules or modes");
+	}
+	if (lazy) throw std::runtime_error("a lazy machine compiles no rules to cache");
+	cache_directory = directory;
+}
+
+// the pre-pass is only used by tokenize(), feed() and resume(), and never with a lazy machine
+void Tokenizer::setStructuralPrepass(bool enabled) {
+	structural = enabled;
+}
+
+// rules are compiled one at a time and combined while lexing, see LazyStateMachine
+void Tokenizer::useLazyMachine(size_t cache_size) {
+	if (!rules.empty() || mode_names.size() > 1) {
+		throw std::runtime_error("lazy machine must be chosen before adding rules or modes");
+	}
+	if (!cache_directory.empty()) throw std::runtime_error("a lazy machine compiles no rules to cache");
+	lazy = true;
+	lazy_machine.setCacheSize(cache_size);
+}
+
+// 64 bit FNV-1a hash of the compiler version, modes and rules in order
+std::string Tokenizer::cacheKey() const {
+	std::string key = "v" + std::to_string(TokenStateMachine::COMPILER_VERSION)
+		+ " modes " + std::to_string(mode_names.size());
+	for(uint i = 0; i < rules.size(); i++) {
+		const Rule& rule = rules[i];
+		key += '\0' + std::to_string(rule.mode) + ' ' + std::to_string(rule.type)
+			+ ' ' + (rule.ignore ? '1' : '0') + ' ' + rule.rule;
+	}
+
+	uint64_t hash = 14695981039346656037ull;
+	for(uint i = 0; i < key.size(); i++) {
+		hash ^= (unsigned char)key[i];
+		hash *= 1099511628211ull;
+	}
+
+	char hex[17];
+	std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+	return hex;
+}
+
+void Tokenizer::compile() {
+	// the table is built here so lexing only reads a compiled tokenizer, and threads can share it
+	if (compiled) {
+		state_machine.memoryUsage();
+		return;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::string filename = cache_directory + "/" + cacheKey() + ".tsm";
+	TokenStateMachine machine;
+	if (!machine.loadFromFile(filename) || machine.modes() != mode_names.size()) {
+		machine = TokenStateMachine();
+		for(uint mode = 1; mode < mode_names.size(); mode++) {
+			machine.addMode();
+		}
+		for(uint i = 0; i < rules.size(); i++) {
+			machine.addRule(rules[i].rule, rules[i].type, rules[i].mode);
+		}
+
+		// write to a temporary file first so other processes never load half a file
+		std::string temp_filename = filename + "." + std::to_string(
+			std::chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+		if (machine.saveToFile(temp_filename)) {
+			if (std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+				std::remove(temp_filename.c_str());
+			}
+		} else {
+			std::remove(temp_filename.c_str());
+		}
+	}
+
+	state_machine = machine;
+	state_machine.memoryUsage();
+	compiled = true;
+
+	if (metrics != NULL) {
+		metrics->recordCompile(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count());
+	}
+}
+
 bool Tokenizer::tokenize(std::istream* stream, std::vector<Token>* token_list) {
+	reset();
+	startCall(token_list);
+	if (!feedStream(stream)) return num_errors > 0;
+	return finishCall();
+}
+
+bool Tokenizer::tokenize(const std::string& str, std::vector<Token>* token_list) {
+	return tokenize(str.data(), str.size(), token_list);
+}
+
+bool Tokenizer::tokenize(const char* data, size_t size, std::vector<Token>* token_list) {
+	reset();
+	startCall(token_list);
+	return tokenizeCall(data, size);
+}
+
+// adds to the buffer, reusing the tokens (and string memory) it kept when it was cleared
+bool Tokenizer::tokenize(const std::string& str, TokenBuffer* token_buffer) {
+	return tokenize(str.data(), str.size(), token_buffer);
+}
+
+bool Tokenizer::tokenize(const char* data, size_t size, TokenBuffer* token_buffer) {
+	reset();
+	startCall(NULL, token_buffer);
+	return tokenizeCall(data, size);
+}
+
+bool Tokenizer::tokenizeCall(const char* data, size_t size) {
+	size_t consumed = feedChunk(data, size);
+	if (call_status != COMPLETE) {
+		stopCall(data + consumed, size - consumed, NULL, true);
+		return num_errors > 0;
+	}
+	return finishCall();
+}
+
+void Tokenizer::feed(const char* data, size_t size, std::vector<Token>* token_list) {
+	if (!feeding) reset();
+	startCall(token_list);
+	size_t consumed = feedChunk(data, size);
+	if (call_status != COMPLETE) {
+		stopCall(data + consumed, size - consumed, NULL, false);
+	}
+}
+
+bool Tokenizer::finish(std::vector<Token>* token_list) {
+	if (!feeding) reset();
+	startCall(token_list);
+	return finishCall();
+}
+
+bool Tokenizer::finishCall() {
+	if (!partial_token.empty()) {
+		int type = (unmatched_bytes > 0) ? -1 : tokenType();
+		endToken(NULL, NULL, type);
+	}
+	feeding = false;
+
+	if (metrics != NULL) recordMetrics(0, std::chrono::steady_clock::now());
+
+	return num_errors > 0;
+}
+
+/*
+the state of fed text as a line of numbers followed by the bytes of the token
+cut off at the end of the last chunk. A lazy machine's states are only numbered
+in its cache, so its token is stepped through again by restore() instead, which
+needs all of it
+*/
+std::string Tokenizer::checkpoint() const {
+	if (lazy && partial_token.size() != token_length) {
+		throw std::runtime_error("a lazy machine can only checkpoint a token it holds whole");
+	}
+
+	std::ostringstream out;
+	out << "TCP " << CHECKPOINT_VERSION << ' ' << cacheKey() << ' ' << text_offset << ' '
+		<< row << ' ' << column << ' ' << num_errors << ' ' << (feeding ? 1 : 0) << ' ' << mode_stack.size();
+	for(uint i = 0; i < mode_stack.size(); i++) {
+		out << ' ' << mode_stack[i];
+	}
+	State state = lazy ? 0 : token_iterator.getState();
+	out << ' ' << state << ' ' << tokenType() << ' ' << token_row << ' ' << token_column << ' '
+		<< token_length << ' ' << unmatched_bytes << ' ' << (segmented ? 1 : 0) << ' ' << partial_token.size() << '\n';
+	out.write(partial_token.data(), partial_token.size());
+	return out.str();
+}
+
+// returns false (leaving the tokenizer as it was) if the checkpoint is unreadable or of other rules
+bool Tokenizer::restore(const std::string& checkpoint) {
+	std::istringstream in(checkpoint);
+	std::string header, key;
+	uint version = 0;
+	in >> header >> version >> key;
+	if (!in || header != "TCP" || version > CHECKPOINT_VERSION || key != cacheKey()) return false;
+
+	uint64_t offset;
+	uint saved_row, saved_column, saved_errors, saved_feeding, stack_size;
+	in >> offset >> saved_row >> saved_column >> saved_errors >> saved_feeding >> stack_size;
+	if (!in || stack_size == 0) return false;
+	std::vector<uint> stack(stack_size);
+	for(uint i = 0; i < stack_size && in; i++) {
+		in >> stack[i];
+		if (stack[i] >= mode_names.size()) return false;
+	}
+
+	State state;
+	int type;
+	uint saved_token_row, saved_token_column, saved_unmatched, saved_segmented = 0;
+	size_t saved_length, partial_size;
+	in >> state >> type >> saved_token_row >> saved_token_column >> saved_length >> saved_unmatched;
+	if (version >= 2) in >> saved_segmented;
+	in >> partial_size;
+	if (!in || in.get() != '\n' || partial_size > saved_length) return false;
+	std::string partial(partial_size, '\0');
+	in.read(&partial[0], partial_size);
+	if ((size_t)in.gcount() != partial_size) return false;
+
+	compile();
+	TokenStateMachine::Iterator iterator(&state_machine);
+	if (!lazy) {
+		try {
+			iterator = TokenStateMachine::Iterator(&state_machine, state, type);
+		} catch(const std::runtime_error&) {
+			return false;
+		}
+	}
+
+	reset();
+	token_iterator = iterator;
+	text_offset = offset;
+	row = saved_row;
+	column = saved_column;
+	num_errors = saved_errors;
+	feeding = (saved_feeding != 0);
+	mode_stack = stack;
+	token_row = saved_token_row;
+	token_column = saved_token_column;
+	token_length = saved_length;
+	unmatched_bytes = saved_unmatched;
+	segmented = (saved_segmented != 0);
+	partial_token = partial;
+	if (lazy) {
+		startToken(mode_stack.back());
+		for(uint i = 0; i < partial_token.size() && unmatched_bytes == 0; i++) {
+			lazy_iterator.nextState(partial_token[i]);
+		}
+	}
+	return true;
+}
+
+// largest table (in bytes) for stepping over two bytes at a time, 0 never uses one
+void Tokenizer::setPairTableSize(size_t max_size) {
+	state_machine.setPairTableSize(max_size);
+}
+
+void Tokenizer::setMaxTokenLength(size_t length, LongTokenAction action) {
+	max_token_length = length;
+	long_token_action = action;
+}
+
+void Tokenizer::setMaxTokens(size_t count) {
+	max_tokens = count;
+}
+
+// bytes of tokens (including their text) a single call may add
+void Tokenizer::setMemoryBudget(size_t bytes) {
+	memory_budget = bytes;
+}
+
+/*
+tokens longer than segment_size bytes are given to sink a segment at a time
+(the last one may be shorter) and added without their text. Ignored tokens are
+segmented too, since the type is only known once the token ends. A long token
+limit only decides whether the type is -1, the sink gets every byte.
+segment_size 0 keeps every token whole
+*/
+void Tokenizer::setSegmentSink(size_t segment_size, SegmentSink sink) {
+	if (segment_size > 0 && !sink) throw std::runtime_error("segment sink is empty");
+	this->segment_size = segment_size;
+	segment_sink = sink;
+}
+
+/*
+continues a call that was stopped by a limit, including reading the rest of a
+stream and finishing a tokenize(). The text given to a stopped tokenize() or
+feed() must still exist
+*/
+bool Tokenizer::resume(std::vector<Token>* token_list) {
+	if (call_status == COMPLETE) return num_errors > 0;
+	startCall(token_list);
+	return resumeCall();
+}
+
+bool Tokenizer::resume(TokenBuffer* token_buffer) {
+	if (call_status == COMPLETE) return num_errors > 0;
+	startCall(NULL, token_buffer);
+	return resumeCall();
+}
+
+bool Tokenizer::resumeCall() {
+	size_t consumed = feedChunk(resume_data, resume_size);
+	if (call_status != COMPLETE) {
+		resume_data += consumed;
+		resume_size -= consumed;
+		return num_errors > 0;
+	}
+	if (resume_stream != NULL && !feedStream(resume_stream)) return num_errors > 0;
+	if (resume_finish) return finishCall();
+	return num_errors > 0;
+}
+
+// tokens are added to token_buffer instead of token_list if it is given
+void Tokenizer::startCall(std::vector<Token>* token_list, TokenBuffer* token_buffer) {
 	this->token_list = token_list;
-	this->stream = stream;
+	this->token_buffer = token_buffer;
+	call_status = COMPLETE;
+	call_tokens = 0;
+	call_bytes = 0;
+}
 
-	// reset position tracker
-	row = 1;
-	column = 1;
-	num_errors = 0;
+// feeds the rest of the stream, returns false if a limit stopped it
+bool Tokenizer::feedStream(std::istream* stream) {
+	char buffer[STREAM_BUFFER_SIZE];
+	do {
+		stream->read(buffer, STREAM_BUFFER_SIZE);
+		size_t size = stream->gcount();
+		size_t consumed = feedChunk(buffer, size);
+		if (call_status != COMPLETE) {
+			resume_buffer.assign(buffer + consumed, size - consumed);
+			stopCall(resume_buffer.data(), resume_buffer.size(), stream, true);
+			return false;
+		}
+	} while(*stream);
+	return true;
+}
+
+void Tokenizer::stopCall(const char* data, size_t size, std::istream* stream, bool finish) {
+	resume_data = data;
+	resume_size = size;
+	resume_stream = stream;
+	resume_finish = finish;
+}
+
+bool Tokenizer::limitReached() {
+	if (max_tokens > 0 && call_tokens >= max_tokens) {
+		call_status = TOKEN_LIMIT_REACHED;
+	} else if (memory_budget > 0 && call_bytes >= memory_budget) {
+		call_status = MEMORY_LIMIT_REACHED;
+	}
+	return call_status != COMPLETE;
+}
+
+// returns the number of bytes used, which is less than size if a limit was reached
+size_t Tokenizer::feedChunk(const char* data, size_t size) {
+	if (metrics == NULL) {
+		size_t consumed = lexChunk(data, size);
+		text_offset += consumed;
+		return consumed;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	size_t consumed = lexChunk(data, size);
+	text_offset += consumed;
+	recordMetrics(consumed, start);
+	return consumed;
+}
 
-	while(!stream->eof()) {
+size_t Tokenizer::lexChunk(const char* data, size_t size) {
+	const char* cur = data;
+	const char* end = data + size;
+	bool use_pairs = state_machine.usesPairs();
+	bool use_classifiers = structural && !classifiers.empty();
+	StructuralScanner scanner(data, size);
+
+	// finish a character no rule starts with that was split between chunks
+	if (unmatched_bytes > 0) {
+		while(cur < end && unmatched_bytes > 0 && utf8::isContinuation(*cur)) {
+			cur++;
+			unmatched_bytes--;
+		}
+		if (cur == end && unmatched_bytes > 0) {
+			appendPartial(data, cur);
+			advance(data, cur);
+			return size;
+		}
+		unmatched_bytes = 0;
+		endToken(data, cur, -1);
+		if (limitReached()) return cur - data;
+	}
+
+	while(cur < end) {
 		// parse token
-		uint token_row = row;
-		uint token_column = column;
-		std::string cur_token;
-		TokenStateMachine::Iterator it = state_machine.begin();
-		while(!stream->eof()) {
-			char c = stream->peek();
-			it.nextState(c);
-
-			if (it.getState() == 0) {
-				break;
-			} else {
-				cur_token += c;
-				get();
+		const char* token_begin = cur;
+		if (partial_token.empty()) {
+			token_row = row;
+			token_column = column;
+
+			// single byte tokens and runs like whitespace are read from the masks of the block
+			if (use_classifiers) {
+				int type;
+				size_t length = scanner.token(classifiers[mode_stack.back()], cur - data, type);
+				if (length > 0) {
+					cur += length;
+					if (isIgnored(type) && mode_actions[mode_stack.back()].count(type) == 0
+						&& (segment_size == 0 || length <= segment_size)) {
+						// nothing to add and the state machine is still at the start
+						advance(token_begin, cur);
+						continue;
+					}
+					endToken(token_begin, cur, type);
+					if (limitReached()) return cur - data;
+					continue;
+				}
 			}
 		}
-			
-		int type = it.getType();
 
-		bool ignore = false;
-		for(uint i = 0; i < ignore_types.size(); i++) {
-			if (ignore_types[i] == type) {
-				ignore = true;
+		if (lazy) {
+			while(cur < end) {
+				lazy_iterator.nextState(*cur);
+				if (lazy_iterator.atEnd()) break;
+				cur++;
+			}
+		} else {
+			if (use_pairs) {
+				cur = token_iterator.nextPairs(cur, end);
+			}
+			while(cur < end) {
+				token_iterator.nextState(*cur);
+				if (token_iterator.atEnd()) break;
+				cur++;
+			}
+		}
+
+		if (cur == end) {
+			// the token may continue in the next chunk
+			appendPartial(token_begin, cur);
+			advance(token_begin, cur);
+			break;
+		}
+
+		int type = tokenType();
+		if (cur == token_begin && partial_token.empty()) {
+			// no rule starts with this character, consume it as an invalid token
+			uint length = utf8::sequenceLength(*cur);
+			cur = utf8::nextCharacter(cur, end);
+			if (cur == end && (uint)(cur - token_begin) < length) {
+				unmatched_bytes = length - (cur - token_begin);
+				appendPartial(token_begin, cur);
+				advance(token_begin, cur);
 				break;
 			}
+			type = -1;
+		}
+
+		endToken(token_begin, cur, type);
+		if (limitReached()) return cur - data;
+	}
+	return size;
+}
+
+/*
+counts the tokens of each (non negative, not ignored) type in type_counts
+without making any tokens and returns the number of invalid tokens. If
+stop_on_error is true counting stops at the first invalid token
+*/
+uint Tokenizer::count(const char* data, size_t size, std::vector<uint>* type_counts, bool stop_on_error) {
+	compile();
+	feeding = false;
+	call_status = COMPLETE;
+	num_errors = 0;
+	mode_stack.assign(1, DEFAULT_MODE);
+	if (lazy) lazy_machine.newText();
+	std::chrono::steady_clock::time_point start;
+	if (metrics != NULL) {
+		metrics->setMemoryUsage(this, memoryUsage());
+		start = std::chrono::steady_clock::now();
+	}
+
+	const char* cur = data;
+	const char* end = data + size;
+	bool use_pairs = state_machine.usesPairs();
+	while(cur < end) {
+		const char* token_begin = cur;
+		int type;
+		if (lazy) {
+			LazyStateMachine::Iterator iterator = lazy_machine.begin(mode_stack.back());
+			while(cur < end) {
+				iterator.nextState(*cur);
+				if (iterator.atEnd()) break;
+				cur++;
+			}
+			type = iterator.getType();
+		} else {
+			TokenStateMachine::Iterator iterator = state_machine.begin(mode_stack.back());
+			if (use_pairs) {
+				cur = iterator.nextPairs(cur, end);
+			}
+			while(cur < end) {
+				iterator.nextState(*cur);
+				if (iterator.atEnd()) break;
+				cur++;
+			}
+			type = iterator.getType();
+		}
+
+		if (cur == token_begin) {
+			// no rule starts with this character
+			cur = utf8::nextCharacter(cur, end);
+			type = -1;
 		}
 
-		if (!ignore) {
+		if (!isIgnored(type)) {
+			if (metrics != NULL) countMetric(type);
 			if (type < 0) {
 				num_errors++;
+				if (stop_on_error) break;
+			} else if (type_counts != NULL) {
+				if ((uint)type >= type_counts->size()) type_counts->resize(type + 1, 0);
+				(*type_counts)[type]++;
 			}
+		}
+		changeMode(type, mode_stack);
+	}
+
+	if (metrics != NULL) recordMetrics(cur - data, start);
+	return num_errors;
+}
+
+uint Tokenizer::count(const std::string& str, std::vector<uint>* type_counts, bool stop_on_error) {
+	return count(str.data(), str.size(), type_counts, stop_on_error);
+}
 
-			token_list->push_back(Token(type, cur_token, token_row, token_column));
+// returns true if the text has no invalid tokens, stopping at the first one
+bool Tokenizer::validate(const char* data, size_t size) {
+	return count(data, size, NULL, true) == 0;
+}
+
+bool Tokenizer::validate(const std::string& str) {
+	return validate(str.data(), str.size());
+}
+
+// starts a new text, dropping any fed text that was not finished and a stopped call
+void Tokenizer::reset() {
+	compile();
+	if (structural && !lazy && classifiers.empty()) {
+		for(uint mode = 0; mode < mode_names.size(); mode++) {
+			classifiers.push_back(StructuralClassifier(state_machine, mode));
 		}
 	}
 
-	return num_errors > 0;
+	// reset position tracker
+	row = 1;
+	column = 1;
+	num_errors = 0;
+	text_offset = 0;
+	mode_stack.assign(1, DEFAULT_MODE);
+
+	partial_token.clear();
+	unmatched_bytes = 0;
+	token_length = 0;
+	segmented = false;
+	if (lazy) lazy_machine.newText();
+	startToken(DEFAULT_MODE);
+	feeding = true;
+	call_status = COMPLETE;
+	resume_stream = NULL;
+
+	if (metrics != NULL) metrics->setMemoryUsage(this, memoryUsage());
 }
 
-bool Tokenizer::tokenize(const std::string& str, std::vector<Token>* token_list) {
-	std::stringstream ss(str);
-	return tokenize(&ss, token_list);
+// adds [begin, end) to the token being parsed, keeping at most max_token_length bytes
+void Tokenizer::appendPartial(const char* begin, const char* end) {
+	size_t length = end - begin;
+	token_length += length;
+	if (segment_size > 0) {
+		appendSegments(begin, end);
+		return;
+	}
+	if (max_token_length > 0 && partial_token.size() + length > max_token_length) {
+		length = (partial_token.size() < max_token_length) ? max_token_length - partial_token.size() : 0;
+	}
+	partial_token.append(begin, length);
+}
+
+/*
+gives the sink whole segments from partial_token followed by [begin, end) for
+as long as more than a segment is left, so partial_token never holds more than
+segment_size bytes. Segments that lie entirely in [begin, end) are not copied
+*/
+void Tokenizer::appendSegments(const char* begin, const char* end) {
+	while(partial_token.size() + (end - begin) > segment_size) {
+		const char* segment_end = begin + (segment_size - partial_token.size());
+		SegmentPart part = segmented ? CONTINUE_SEGMENT : BEGIN_SEGMENT;
+		if (partial_token.empty()) {
+			segment_sink(part, -1, begin, segment_end, token_row, token_column);
+		} else {
+			partial_token.append(begin, segment_end);
+			const char* partial = partial_token.data();
+			segment_sink(part, -1, partial, partial + partial_token.size(), token_row, token_column);
+			partial_token.clear();
+		}
+		segmented = true;
+		begin = segment_end;
+	}
+	partial_token.append(begin, end);
+}
+
+// gives the sink the last segment of the token and adds the token without its text
+void Tokenizer::endSegments(const char* begin, const char* end, int type) {
+	token_length += end - begin;
+	appendSegments(begin, end);
+	bool ignored = isIgnored(type);
+	if (isTooLong(token_length) && long_token_action == REJECT_TOKEN) type = -1;
+	const char* partial = partial_token.data();
+	segment_sink(END_SEGMENT, type, partial, partial + partial_token.size(), token_row, token_column);
+	segmented = false;
+	if (!ignored) addToken(type, partial, partial, token_row, token_column);
 }
 
-char Tokenizer::get() {
-	char c = stream->get();
-	if (c == '\n') {
-		row++;
-		column = 1;
+// ends the token made of partial_token followed by [begin, end)
+void Tokenizer::endToken(const char* begin, const char* end, int type) {
+	advance(begin, end);
+
+	if (segment_size > 0 && (segmented || partial_token.size() + (end - begin) > segment_size)) {
+		endSegments(begin, end, type);
+	} else if (!isIgnored(type)) {
+		if (partial_token.empty() && !isTooLong(end - begin)) {
+			addToken(type, begin, end, token_row, token_column);
+		} else {
+			appendPartial(begin, end);
+			bool rejected = isTooLong(token_length) && long_token_action == REJECT_TOKEN;
+			size_t length = partial_token.size();
+			if (max_token_length > 0 && length > max_token_length) length = max_token_length;
+			const char* partial = partial_token.data();
+			addToken(rejected ? -1 : type, partial, partial + length, token_row, token_column);
+		}
+	}
+	partial_token.clear();
+	token_length = 0;
+
+	changeMode(type, mode_stack);
+	startToken(mode_stack.back());
+}
+
+void Tokenizer::startToken(uint mode) {
+	if (lazy) {
+		lazy_iterator = lazy_machine.begin(mode);
 	} else {
-		column++;
+		token_iterator = state_machine.begin(mode);
+	}
+}
+
+bool Tokenizer::isIgnored(int type) const {
+	for(uint i = 0; i < ignore_types.size(); i++) {
+		if (ignore_types[i] == type) {
+			return true;
+		}
 	}
-	return c;
+	return false;
+}
+
+// applies the mode change (if any) of the current mode for the given type
+void Tokenizer::changeMode(int type, std::vector<uint>& stack) const {
+	const std::map<int, ModeAction>& actions = mode_actions[stack.back()];
+	if (actions.empty()) return;
+
+	auto it = actions.find(type);
+	if (it == actions.end()) return;
+
+	const ModeAction& action = it->second;
+	switch(action.change) {
+		case PUSH_MODE: stack.push_back(action.next_mode); break;
+		case POP_MODE: if (stack.size() > 1) stack.pop_back(); break;
+		case SWITCH_MODE: stack.back() = action.next_mode; break;
+	}
+}
+
+void Tokenizer::addToken(int type, const char* begin, const char* end, uint token_row, uint token_column) {
+	if (type < 0) {
+		num_errors++;
+	}
+
+	if (token_buffer != NULL) {
+		token_buffer->add(type, begin, end, token_row, token_column);
+	} else {
+		token_list->emplace_back(type, std::string(begin, end), token_row, token_column);
+	}
+	call_tokens++;
+	call_bytes += sizeof(Token) + (end - begin);
+	if (metrics != NULL) countMetric(type);
+}
+
+void Tokenizer::countMetric(int type) {
+	metric_counts.add(type);
+}
+
+// adds the tokens counted since the last call to the metrics
+void Tokenizer::recordMetrics(uint64_t bytes, std::chrono::steady_clock::time_point start) {
+	uint64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	metrics->recordLex(bytes, nanoseconds, metric_counts);
+}
+
+// updates row and column past the given text
+void Tokenizer::advance(const char* begin, const char* end) {
+	utf8::advancePosition(begin, end, row, column);
 }
 /*
 uint Tokenizer::errors() {
@@ -7,57 +7,286 @@ a type value. Negative types are considered invalid tokens. Tokens of specific
 types can be excluded from the vector by calling ignoreType(). Each token
 records the raw string parsed, its type, row, and column. Each token is added to
 the vector provided. For each invalid token parsed the number of errors is
-incremented.
+incremented. Text is expected to be UTF-8, columns count characters rather than
+bytes.
+
+Rules can be added to named modes (start conditions). Only rules of the current
+mode are matched, and parsing a token of a given type can push, pop or switch
+the current mode, so text like strings or embedded languages can be tokenized in
+the same pass as the surrounding text.
+
+tokenize() can also fill a TokenBuffer, which keeps its tokens and their
+string memory when cleared so repeated calls on similar text do not allocate.
+
+Text can also be pushed in chunks of any size with feed(). Tokens are added as
+soon as they are complete, and a token cut off at the end of a chunk is kept
+(along with its state) until the next chunk or finish(), so only the longest
+token ever needs to be buffered. reset() drops a text that was not finished,
+so the next feed() starts a new one.
+
+Limits can be put on the length of a token, and on the number of tokens and
+bytes of token text added by a single call, so untrusted text cannot use
+unbounded memory. A long token is cut short (and optionally made invalid) but
+still parsed to its end. When a call reaches the token or memory limit it
+stops after that token and status() says why. resume() continues it from
+there with a fresh allowance.
+
+count() and validate() run the same rules and modes without making any tokens,
+for when only the number of tokens of each type or whether the text has any
+invalid tokens matters.
+
+Compiled rules can be cached on disk with setCacheDirectory(). Rules are then
+only recorded by addRule() and compiled (or loaded from a file named after a
+hash of the rules) the first time they are needed.
+
+setStructuralPrepass() lets tokenize() and feed() take tokens made of a
+single punctuation byte, or a run of bytes like whitespace, from masks of 64
+byte blocks (see StructuralClassifier) instead of stepping the state machine
+through them. The tokens are the same either way.
+
+useLazyMachine() keeps each rule compiled on its own and builds the states of
+the combined rules as text reaches them, in a cache of bounded size (see
+LazyStateMachine). Rules can then overlap, the one added first taking priority,
+and a large rule set does not have to be compiled up front. It has to be chosen
+before any rules or modes are added, and only the tokenizer itself (not a
+TokenizerCore or TokenizerBatch) can lex with it.
+
+checkpoint() saves where fed text has got to (the offset into it, position,
+errors, modes and the token cut off at the end of the last chunk) as a string.
+restore() puts a tokenizer with the same rules back in that state, possibly in
+another process, and feeding the text from the offset on gives the same tokens
+the first tokenizer would have.
+
+setSegmentSink() gives tokens longer than a segment size to a function in
+pieces of that size (begin, continue, end) instead of holding them whole, so a
+multi megabyte string or blob only ever needs a segment of memory. The token
+is still added, without its text, in its place among the others.
+
+setMetrics() adds the bytes, tokens of each type and time of every call (and
+the time spent compiling rules) to a TokenizerMetrics shared by any number of
+tokenizers. Without one nothing is timed or counted.
 */
 
 #ifndef TOKENIZER_HPP
 #define TOKENIZER_HPP
 
 #include <istream>
+#include <chrono>
 #include <string>
 #include <vector>
+#include <map>
+#include <functional>
 #include <cctype>
+#include <cstddef>
 #include <stdexcept>
 #include "token.hpp"
+#include "token_buffer.hpp"
 #include "token_state_machine.hpp"
+#include "lazy_state_machine.hpp"
+#include "structural_classifier.hpp"
+#include "tokenizer_metrics.hpp"
 
 typedef unsigned int uint;
 
 class Tokenizer {
+	template<class Position, class Sink, class Errors, class Source, class Ignore, class Modes>
+	friend class TokenizerCore;
+	friend class TokenizerBatch;
+	friend struct IgnoreTypes;
+	friend struct NoModes;
+	friend struct UseModes;
+
 public:
+	enum ModeChange {
+		PUSH_MODE,
+		POP_MODE,
+		SWITCH_MODE
+	};
+
+	enum LongTokenAction {
+		TRUNCATE_TOKEN,
+		REJECT_TOKEN
+	};
+
+	enum Status {
+		COMPLETE,
+		TOKEN_LIMIT_REACHED,
+		MEMORY_LIMIT_REACHED
+	};
+
+	enum SegmentPart {
+		BEGIN_SEGMENT,
+		CONTINUE_SEGMENT,
+		END_SEGMENT
+	};
+
+	// type is only known (and not -1) at END_SEGMENT, row and column are where the token starts
+	typedef std::function<void(SegmentPart part, int type, const char* begin, const char* end, uint row, uint column)> SegmentSink;
+
+	static const uint DEFAULT_MODE = 0;
+
+	Tokenizer();
+	Tokenizer(const Tokenizer& other);
+	Tokenizer& operator=(const Tokenizer& other);
+	~Tokenizer();
 	void addRule(std::string rule, int token_type, bool ignore = false);
+	void addRule(uint mode, std::string rule, int token_type, bool ignore = false);
+	void addLiteral(const std::string& literal, int token_type, bool ignore = false);
+	void addLiteral(uint mode, const std::string& literal, int token_type, bool ignore = false);
+	uint addMode(const std::string& name);
+	uint getMode(const std::string& name) const;
+	void addModeChange(uint mode, int token_type, ModeChange change, uint next_mode = DEFAULT_MODE);
+	uint mode() const { return mode_stack.back(); }
+	void setCacheDirectory(const std::string& directory);
+	void setPairTableSize(size_t max_size);
+	void setStructuralPrepass(bool enabled);
+	void useLazyMachine(size_t cache_size = LazyStateMachine::DEFAULT_CACHE_SIZE);
+	const LazyStateMachine* lazyMachine() const { return lazy ? &lazy_machine : NULL; }
+	void compile();
+	std::string cacheKey() const;
 	bool tokenize(std::istream* stream, std::vector<Token>* token_list);
 	bool tokenize(const std::string& str, std::vector<Token>* token_list);
+	bool tokenize(const char* data, size_t size, std::vector<Token>* token_list);
+	bool tokenize(const std::string& str, TokenBuffer* token_buffer);
+	bool tokenize(const char* data, size_t size, TokenBuffer* token_buffer);
+	void feed(const char* data, size_t size, std::vector<Token>* token_list);
+	bool finish(std::vector<Token>* token_list);
+	void reset();
+	std::string checkpoint() const;
+	bool restore(const std::string& checkpoint);
+	uint64_t offset() const { return text_offset; }
+	void setMaxTokenLength(size_t length, LongTokenAction action = TRUNCATE_TOKEN);
+	void setMaxTokens(size_t count);
+	void setMemoryBudget(size_t bytes);
+	size_t maxTokens() const { return max_tokens; }
+	size_t memoryBudget() const { return memory_budget; }
+	void setSegmentSink(size_t segment_size, SegmentSink sink);
+	Status status() const { return call_status; }
+	bool resume(std::vector<Token>* token_list);
+	bool resume(TokenBuffer* token_buffer);
+	uint count(const char* data, size_t size, std::vector<uint>* type_counts, bool stop_on_error = false);
+	uint count(const std::string& str, std::vector<uint>* type_counts, bool stop_on_error = false);
+	bool validate(const char* data, size_t size);
+	bool validate(const std::string& str);
 	unsigned int errors(){ return num_errors; }
+	void setMetrics(TokenizerMetrics* metrics);
 
-	// predefined rules you can use
-	static const char* WHITESPACE; // \s+
-	static const char* WORD_RULE; // [\l\u][\w]*
-	static const char* DECIMAL_RULE; // -?[1-9][0-9]*
-	static const char* MALFORMED_DECIMAL_RULE;
-	static const char* HEX_RULE; // ($|0x)[\\x]+
-	static const char* MALFORMED_HEX_RULE;
-	static const char* OCTAL_RULE; // 0[0-7]*
-	static const char* MALFORMED_OCTAL_RULE;
-	static const char* BINARY_RULE; // 0b[01]+
-	static const char* MALFORMED_BINARY_RULE;
-	static const char* DQ_STRING_RULE;
-	static const char* SQ_STRING_RULE;
-	static const char* CHARACTER_RULE; // single or escaped character in single quotes
-	static const char* MALFORMED_CHARACTER_RULE; // more than 1 character in single quotes
+	// predefined rules you can use, their classes are ASCII only (see token_state_machine.hpp)
+	static constexpr const char* WHITESPACE = "\\s+"; // \s+
+	static constexpr const char* WORD_RULE = "[\\l\\u_][\\w]*"; // [\l\u][\w]*
+	static constexpr const char* DECIMAL_RULE = "-?[1-9][\\d]*"; // -?[1-9][0-9]*
+	static constexpr const char* MALFORMED_DECIMAL_RULE = "(-[0\\l\\u_])|(-?[1-9][\\d]*[\\l\\u_])[\\w]*";
+	static constexpr const char* HEX_RULE = "$|(0x)[\\h]+"; // ($|0x)[\\x]+
+	static constexpr const char* MALFORMED_HEX_RULE = "$|(0x)([\\h]*[g-zG-Z_][\\w]*)?";
+	static constexpr const char* OCTAL_RULE = "0[0-7]*"; // 0[0-7]*
+	static constexpr const char* MALFORMED_OCTAL_RULE = "0[0-7]*[89ac-wyz\\u_][\\w]*";
+	static constexpr const char* BINARY_RULE = "0b[01]+"; // 0b[01]+
+	static constexpr const char* MALFORMED_BINARY_RULE = "0b[01]*[2-9\\l\\u_][\\w]*";
+	static constexpr const char* DQ_STRING_RULE = "\"((\\\\.)|[^\"\\\\])*\"";
+	static constexpr const char* SQ_STRING_RULE = "'((\\\\.)|[^\"\\\\])*'";
+	static constexpr const char* CHARACTER_RULE = "'(\\\\.)|[^'\\\\]'"; // single or escaped character in single quotes
+	static constexpr const char* MALFORMED_CHARACTER_RULE = "'(\\\\.)|[^'\\\\]((\\\\.)|[^'\\\\])+'"; // more than 1 character in single quotes
 
 private:
+	struct ModeAction {
+		ModeChange change;
+		uint next_mode;
+	};
+
+	struct Rule {
+		uint mode;
+		std::string rule;
+		int type;
+		bool ignore;
+	};
+
+	static const uint STREAM_BUFFER_SIZE = 4096;
+	static const uint CHECKPOINT_VERSION = 2;
+
 	TokenStateMachine state_machine;
 	std::vector<Token>* token_list;
-	std::istream* stream;
+	TokenBuffer* token_buffer;
 
 	std::vector<int> ignore_types;
+	std::vector<std::string> mode_names;
+	std::vector<std::map<int, ModeAction>> mode_actions; // indexed by mode
+	std::vector<uint> mode_stack;
+
+	std::vector<Rule> rules;
+	std::string cache_directory;
+	bool compiled;
+
+	// indexed by mode, built when first needed
+	bool structural;
+	std::vector<StructuralClassifier> classifiers;
+
+	// rules go to lazy_machine instead of state_machine
+	bool lazy;
+	LazyStateMachine lazy_machine;
 
 	uint row;
 	uint column;
 	uint num_errors;
+	uint64_t text_offset; // bytes lexed since the text began
+
+	// state of the token being parsed between calls to feed()
+	bool feeding;
+	TokenStateMachine::Iterator token_iterator;
+	LazyStateMachine::Iterator lazy_iterator;
+	std::string partial_token;
+	uint token_row;
+	uint token_column;
+	uint unmatched_bytes;
+	size_t token_length; // bytes in the token so far, partial_token may be cut short
+	bool segmented; // the sink has had the first segment of the token, partial_token holds the rest
+
+	// limits, 0 means no limit
+	size_t max_token_length;
+	LongTokenAction long_token_action;
+	size_t max_tokens;
+	size_t memory_budget;
+
+	// tokens longer than segment_size go to segment_sink in pieces, 0 keeps them whole
+	size_t segment_size;
+	SegmentSink segment_sink;
+
+	// progress of the current call, and where to resume it if a limit stopped it
+	Status call_status;
+	size_t call_tokens;
+	size_t call_bytes;
+	const char* resume_data;
+	size_t resume_size;
+	std::istream* resume_stream;
+	std::string resume_buffer;
+	bool resume_finish;
+
+	// NULL unless metrics are recorded
+	TokenizerMetrics* metrics;
+	TokenizerMetrics::TypeCounts metric_counts;
 
-	char get();
+	void startCall(std::vector<Token>* token_list, TokenBuffer* token_buffer = NULL);
+	bool tokenizeCall(const char* data, size_t size);
+	bool finishCall();
+	bool resumeCall();
+	size_t feedChunk(const char* data, size_t size);
+	size_t lexChunk(const char* data, size_t size);
+	bool feedStream(std::istream* stream);
+	void stopCall(const char* data, size_t size, std::istream* stream, bool finish);
+	bool limitReached();
+	bool isTooLong(size_t length) const { return max_token_length > 0 && length > max_token_length; }
+	void startToken(uint mode);
+	int tokenType() const { return lazy ? lazy_iterator.getType() : token_iterator.getType(); }
+	size_t memoryUsage() { return lazy ? lazy_machine.cacheUsage() : state_machine.memoryUsage(); }
+	void appendPartial(const char* begin, const char* end);
+	void appendSegments(const char* begin, const char* end);
+	void endSegments(const char* begin, const char* end, int type);
+	void endToken(const char* begin, const char* end, int type);
+	void advance(const char* begin, const char* end);
+	bool isIgnored(int type) const;
+	void changeMode(int type, std::vector<uint>& stack) const;
+	void addToken(int type, const char* begin, const char* end, uint token_row, uint token_column);
+	void countMetric(int type);
+	void recordMetrics(uint64_t bytes, std::chrono::steady_clock::time_point start);
 };
 
 #endif
\ No newline at end of file
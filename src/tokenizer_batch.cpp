@@ -0,0 +1,109 @@
+#include <stdexcept>
+#include <utility>
+#include "tokenizer_batch.hpp"
+#include "utf8.hpp"
+
+const uint TokenizerBatch::DEFAULT_LANES;
+const uint TokenizerBatch::MAX_LANES;
+
+TokenizerBatch::TokenizerBatch(Tokenizer& tokenizer, uint lanes)
+	: tokenizer(tokenizer), num_lanes(lanes), texts(NULL), num_texts(0), next_text(0), token_lists(NULL) {
+	if (lanes == 0 || lanes > MAX_LANES) throw std::runtime_error("a batch needs 1 to 16 lanes");
+}
+
+bool TokenizerBatch::tokenize(const std::vector<std::string>& texts, std::vector<std::vector<Token>>* token_lists) {
+	token_lists->resize(texts.size());
+	return tokenize(texts.data(), texts.size(), token_lists->data());
+}
+
+bool TokenizerBatch::tokenize(const std::string* texts, size_t count, std::vector<Token>* token_lists) {
+	if (tokenizer.lazy) throw std::runtime_error("a lazy machine can only be lexed by its tokenizer");
+	tokenizer.compile();
+	TokenStateMachine& machine = tokenizer.state_machine;
+	if (machine.table_dirty) machine.buildTable();
+	this->texts = texts;
+	this->token_lists = token_lists;
+	num_texts = count;
+	next_text = 0;
+	num_errors.assign(count, 0);
+
+	uint active = 0;
+	while(active < num_lanes && startText(active)) active++;
+
+	// every turn steps each active lane one byte so their table lookups overlap
+	const State* table = machine.table.data();
+	const int* state_types = machine.state_types.data();
+	while(active > 0) {
+		for(uint i = 0; i < active; i++) {
+			State state = table[(states[i] << 8) | (unsigned char)*curs[i]];
+			int type = state_types[state];
+			states[i] = state;
+			types[i] = (type != -1) ? type : types[i];
+			if (state != 0 && ++curs[i] < ends[i]) continue;
+			if (endToken(i) || startText(i)) continue;
+
+			// no texts are left, the last active lane takes this one's place next turn
+			active--;
+			swapLanes(i, active);
+		}
+	}
+
+	for(size_t i = 0; i < count; i++) {
+		if (num_errors[i] > 0) return true;
+	}
+	return false;
+}
+
+// gives the lane the next text that is not empty, returns false if there are none left
+bool TokenizerBatch::startText(uint lane) {
+	while(next_text < num_texts && texts[next_text].empty()) next_text++;
+	if (next_text == num_texts) return false;
+
+	const std::string& text = texts[next_text];
+	Lane& info = lane_info[lane];
+	info.text = next_text++;
+	info.token_begin = text.data();
+	info.end = text.data() + text.size();
+	info.position = RowColumnPosition();
+	info.mode_stack.assign(1, Tokenizer::DEFAULT_MODE);
+	curs[lane] = info.token_begin;
+	ends[lane] = info.end;
+	states[lane] = tokenizer.state_machine.start_states[Tokenizer::DEFAULT_MODE];
+	types[lane] = -1;
+	return true;
+}
+
+// ends the token before the lane's cursor and starts the next one, returns false at the end of the text
+bool TokenizerBatch::endToken(uint lane) {
+	Lane& info = lane_info[lane];
+	const char* cur = curs[lane];
+	int type = types[lane];
+	if (cur == info.token_begin) {
+		// no rule starts with this character, it is an invalid token
+		cur = utf8::nextCharacter(cur, info.end);
+		type = -1;
+	}
+
+	if (!tokenizer.isIgnored(type)) {
+		if (type < 0) num_errors[info.text]++;
+		token_lists[info.text].emplace_back(type, std::string(info.token_begin, cur),
+			info.position.row(), info.position.column());
+	}
+	info.position.advance(info.token_begin, cur);
+	tokenizer.changeMode(type, info.mode_stack);
+
+	if (cur == info.end) return false;
+	info.token_begin = cur;
+	curs[lane] = cur;
+	states[lane] = tokenizer.state_machine.start_states[info.mode_stack.back()];
+	types[lane] = -1;
+	return true;
+}
+
+void TokenizerBatch::swapLanes(uint a, uint b) {
+	std::swap(curs[a], curs[b]);
+	std::swap(ends[a], ends[b]);
+	std::swap(states[a], states[b]);
+	std::swap(types[a], types[b]);
+	std::swap(lane_info[a], lane_info[b]);
+}
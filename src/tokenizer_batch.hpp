@@ -0,0 +1,84 @@
+/*
+Tokenizer batch lexes many independent texts at once. Lexing one text waits on
+a chain of table lookups, each needing the state found by the one before it, so
+most of the time the CPU is idle. The batch keeps a number of lanes (4 to 16),
+each lexing its own text, and steps every lane by one byte per turn. The
+lookups of different lanes do not depend on each other, so they overlap and
+many small or medium texts are lexed faster on one thread than one at a time.
+The gain is largest for long tokens (strings, comments, long words). Every end
+of a token is a branch the CPU cannot predict, so texts of very short tokens
+gain little, and too many lanes only add work to each turn.
+
+When a lane finishes its text it takes the next one, so texts of different
+lengths keep every lane busy. Each text gets its own token list, rows, columns
+and modes, the same as tokenize() would give it. Limits and metrics of the
+tokenizer are not applied, and no rules should be added while a batch runs.
+
+ex)
+TokenizerBatch batch(tokenizer);
+std::vector<std::vector<Token>> token_lists;
+batch.tokenize(documents, &token_lists);
+for(size_t i = 0; i < documents.size(); i++) {
+	if (batch.errors(i) == 0) index(documents[i], token_lists[i]);
+}
+*/
+
+#ifndef TOKENIZER_BATCH_HPP
+#define TOKENIZER_BATCH_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include "token.hpp"
+#include "tokenizer.hpp"
+#include "tokenizer_core.hpp"
+#include "token_state_machine.hpp"
+
+class TokenizerBatch {
+public:
+	static const uint DEFAULT_LANES = 4;
+	static const uint MAX_LANES = 16;
+
+	explicit TokenizerBatch(Tokenizer& tokenizer, uint lanes = DEFAULT_LANES);
+
+	// tokenizes texts[i] into token_lists[i], returns true if any text had invalid tokens
+	bool tokenize(const std::string* texts, size_t count, std::vector<Token>* token_lists);
+	bool tokenize(const std::vector<std::string>& texts, std::vector<std::vector<Token>>* token_lists);
+
+	// invalid tokens in text index of the last call
+	uint errors(size_t index) const { return num_errors[index]; }
+	uint lanes() const { return num_lanes; }
+
+private:
+	// what a lane only needs when a token ends
+	struct Lane {
+		const char* token_begin;
+		const char* end;
+		size_t text;
+		RowColumnPosition position;
+		std::vector<uint> mode_stack;
+	};
+
+	Tokenizer& tokenizer;
+	uint num_lanes;
+	std::vector<uint> num_errors;
+
+	// stepped every turn, kept apart from the rest of each lane so the loop stays small
+	const char* curs[MAX_LANES];
+	const char* ends[MAX_LANES];
+	State states[MAX_LANES];
+	int types[MAX_LANES];
+	Lane lane_info[MAX_LANES];
+
+	// the call being run
+	const std::string* texts;
+	size_t num_texts;
+	size_t next_text;
+	std::vector<Token>* token_lists;
+
+	bool startText(uint lane);
+	bool endToken(uint lane);
+	void swapLanes(uint a, uint b);
+};
+
+#endif
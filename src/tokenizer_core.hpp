@@ -0,0 +1,335 @@
+/*
+TokenizerCore runs the rules and modes of a Tokenizer with a loop put together
+at compile time from policies, so a caller only pays for what it uses:
+
+Position	NoPosition, OffsetPosition (bytes) or RowColumnPosition (rows,
+			columns and bytes) is tracked and given to the sink with each token
+Sink		VectorSink (Tokens), BufferSink (Tokens reused from a TokenBuffer),
+			ColumnSink (type, offset and length arrays) or CallbackSink (any
+			function taking type, begin, end and position)
+Errors		KeepErrors gives invalid tokens to the sink, SkipErrors only counts
+			them, StopAtError stops at the first one and ThrowOnError throws
+Source		MemorySource is lexed in one pass. StreamSource (or anything with
+			CHUNKED and read()) is read in chunks, keeping the unfinished token
+Ignore		NoIgnore gives ignored types to the sink like any other, IgnoreTypes
+			leaves out the types the tokenizer ignores
+Modes		NoModes lexes every token in the default mode and refuses a
+			tokenizer with mode changes, UseModes applies them like tokenize()
+
+Every policy is a plain struct whose functions are inlined, and disabled
+features are compile time constants, so each combination compiles to its own
+loop without checks for what it does not need. The default loop has no ignore
+lookup or mode change per token, so IgnoreTypes and UseModes are needed for the
+same tokens as tokenize(). The tokenizer should not have rules added while it
+is being used by a core.
+
+ex)
+TokenizerCore<OffsetPosition, ColumnSink, SkipErrors, MemorySource, IgnoreTypes> core(tokenizer);
+core.tokenize(MemorySource(text));
+for(size_t i = 0; i < core.sink().size(); i++) {
+	handle(core.sink().types[i], text.substr(core.sink().offsets[i], core.sink().lengths[i]));
+}
+*/
+
+#ifndef TOKENIZER_CORE_HPP
+#define TOKENIZER_CORE_HPP
+
+#include <istream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <cstddef>
+#include "token.hpp"
+#include "token_buffer.hpp"
+#include "tokenizer.hpp"
+#include "token_state_machine.hpp"
+#include "utf8.hpp"
+
+struct NoPosition {
+	void advance(const char*, const char*) {}
+	uint row() const { return 0; }
+	uint column() const { return 0; }
+	size_t offset() const { return 0; }
+};
+
+struct OffsetPosition {
+	size_t bytes = 0;
+
+	void advance(const char* begin, const char* end) { bytes += end - begin; }
+	uint row() const { return 0; }
+	uint column() const { return 0; }
+	size_t offset() const { return bytes; }
+};
+
+// columns count characters rather than bytes, like Tokenizer
+struct RowColumnPosition {
+	uint cur_row = 1;
+	uint cur_column = 1;
+	size_t bytes = 0;
+
+	void advance(const char* begin, const char* end) {
+		bytes += end - begin;
+		utf8::advancePosition(begin, end, cur_row, cur_column);
+	}
+	uint row() const { return cur_row; }
+	uint column() const { return cur_column; }
+	size_t offset() const { return bytes; }
+};
+
+struct VectorSink {
+	std::vector<Token>* token_list;
+
+	explicit VectorSink(std::vector<Token>* token_list = NULL) : token_list(token_list) {}
+
+	template<class Position>
+	void token(int type, const char* begin, const char* end, const Position& position) {
+		token_list->emplace_back(type, std::string(begin, end), position.row(), position.column());
+	}
+};
+
+// reuses the tokens a cleared buffer kept
+struct BufferSink {
+	TokenBuffer* token_buffer;
+
+	explicit BufferSink(TokenBuffer* token_buffer = NULL) : token_buffer(token_buffer) {}
+
+	template<class Position>
+	void token(int type, const char* begin, const char* end, const Position& position) {
+		token_buffer->add(type, begin, end, position.row(), position.column());
+	}
+};
+
+// a structure of arrays, the text of each token is found in the source at its offset
+struct ColumnSink {
+	std::vector<int> types;
+	std::vector<size_t> offsets;
+	std::vector<uint> lengths;
+
+	template<class Position>
+	void token(int type, const char* begin, const char* end, const Position& position) {
+		types.push_back(type);
+		offsets.push_back(position.offset());
+		lengths.push_back(end - begin);
+	}
+	size_t size() const { return types.size(); }
+	void clear() {
+		types.clear();
+		offsets.clear();
+		lengths.clear();
+	}
+};
+
+template<class Function>
+struct CallbackSink {
+	Function function;
+
+	explicit CallbackSink(Function function) : function(function) {}
+
+	template<class Position>
+	void token(int type, const char* begin, const char* end, const Position& position) {
+		function(type, begin, end, position);
+	}
+};
+
+template<class Function>
+CallbackSink<Function> callbackSink(Function function) {
+	return CallbackSink<Function>(function);
+}
+
+// error policies, the position is left at the start of a token that stops the loop
+struct KeepErrors {
+	static const bool KEEP = true;
+	static const bool STOP = false;
+	static void error(const char*, const char*) {}
+};
+
+struct SkipErrors {
+	static const bool KEEP = false;
+	static const bool STOP = false;
+	static void error(const char*, const char*) {}
+};
+
+struct StopAtError {
+	static const bool KEEP = false;
+	static const bool STOP = true;
+	static void error(const char*, const char*) {}
+};
+
+struct ThrowOnError {
+	static const bool KEEP = false;
+	static const bool STOP = true;
+	static void error(const char* begin, const char* end) {
+		throw std::runtime_error("invalid token: " + std::string(begin, end));
+	}
+};
+
+struct MemorySource {
+	static const bool CHUNKED = false;
+	const char* data;
+	size_t size;
+
+	MemorySource(const char* data, size_t size) : data(data), size(size) {}
+	MemorySource(const std::string& str) : data(str.data()), size(str.size()) {}
+};
+
+// any source with CHUNKED true and read() returning 0 at the end can be used
+struct StreamSource {
+	static const bool CHUNKED = true;
+	std::istream* stream;
+
+	explicit StreamSource(std::istream* stream) : stream(stream) {}
+	size_t read(char* buffer, size_t size) {
+		stream->read(buffer, size);
+		return stream->gcount();
+	}
+};
+
+// ignore policies, the constant answer of NoIgnore compiles the check away
+struct NoIgnore {
+	bool ignored(const Tokenizer&, int) const { return false; }
+};
+
+struct IgnoreTypes {
+	bool ignored(const Tokenizer& tokenizer, int type) const { return tokenizer.isIgnored(type); }
+};
+
+// mode policies, start() is called before each text
+struct NoModes {
+	void start(const Tokenizer& tokenizer) {
+		for(size_t i = 0; i < tokenizer.mode_actions.size(); i++) {
+			if (!tokenizer.mode_actions[i].empty()) throw std::runtime_error("the tokenizer changes modes, use UseModes");
+		}
+	}
+	uint mode() const { return Tokenizer::DEFAULT_MODE; }
+	void change(const Tokenizer&, int) {}
+};
+
+struct UseModes {
+	std::vector<uint> stack;
+
+	UseModes() : stack(1, Tokenizer::DEFAULT_MODE) {}
+	void start(const Tokenizer&) { stack.assign(1, Tokenizer::DEFAULT_MODE); }
+	uint mode() const { return stack.back(); }
+	void change(const Tokenizer& tokenizer, int type) { tokenizer.changeMode(type, stack); }
+};
+
+template<class Position = RowColumnPosition, class Sink = VectorSink, class Errors = KeepErrors,
+	class Source = MemorySource, class Ignore = NoIgnore, class Modes = NoModes>
+class TokenizerCore {
+public:
+	static const size_t CHUNK_SIZE = 4096;
+
+	explicit TokenizerCore(Tokenizer& tokenizer, Sink sink = Sink())
+		: tokenizer(tokenizer), my_sink(sink), num_errors(0) {}
+
+	// returns true if there were any invalid tokens, like Tokenizer::tokenize()
+	bool tokenize(Source source) {
+		if (tokenizer.lazy) throw std::runtime_error("a lazy machine can only be lexed by its tokenizer");
+		tokenizer.compile();
+		modes.start(tokenizer);
+		cur_position = Position();
+		num_errors = 0;
+		lexSource(source, std::integral_constant<bool, Source::CHUNKED>());
+		return num_errors > 0;
+	}
+
+	uint errors() const { return num_errors; }
+	uint mode() const { return modes.mode(); }
+	const Position& position() const { return cur_position; }
+	Sink& sink() { return my_sink; }
+
+private:
+	Tokenizer& tokenizer;
+	Sink my_sink;
+	Position cur_position;
+	uint num_errors;
+	Ignore ignore;
+	Modes modes;
+
+	void lexSource(Source& source, std::false_type) {
+		lex<true>(source.data, source.data + source.size);
+	}
+
+	/*
+	an unfinished token at the end of a chunk is kept and lexed again with the
+	next one. At least as much as is kept is read each time, so a long token is
+	never lexed more than about twice over
+	*/
+	void lexSource(Source& source, std::true_type) {
+		std::string buffer;
+		while(true) {
+			size_t kept = buffer.size();
+			size_t read_size = std::max<size_t>(CHUNK_SIZE, kept);
+			buffer.resize(kept + read_size);
+			size_t size = source.read(&buffer[kept], read_size);
+			buffer.resize(kept + size);
+
+			const char* data = buffer.data();
+			if (size == 0) {
+				lex<true>(data, data + buffer.size());
+				return;
+			}
+			const char* stop = lex<false>(data, data + buffer.size());
+			if (stop == NULL) return;
+			buffer.erase(0, stop - data);
+		}
+	}
+
+	/*
+	lexes [cur, end) and returns where the unfinished token at the end begins,
+	or NULL if an invalid token stopped it. If LAST every token ends by end
+	*/
+	template<bool LAST>
+	const char* lex(const char* cur, const char* end) {
+		bool use_pairs = tokenizer.state_machine.usesPairs();
+		while(cur < end) {
+			const char* token_begin = cur;
+			TokenStateMachine::Iterator iterator = tokenizer.state_machine.begin(modes.mode());
+			if (use_pairs) {
+				cur = iterator.nextPairs(cur, end);
+			}
+			while(cur < end) {
+				iterator.nextState(*cur);
+				if (iterator.atEnd()) break;
+				cur++;
+			}
+
+			int type = iterator.getType();
+			if (cur == token_begin) {
+				// no rule starts with this character, it is an invalid token
+				const char* next = utf8::nextCharacter(cur, end);
+				if (!LAST && next == end && (uint)(next - cur) < utf8::sequenceLength(*cur)) return token_begin;
+				cur = next;
+				type = -1;
+			} else if (!LAST && cur == end) {
+				return token_begin;
+			}
+
+			if (!endToken(type, token_begin, cur)) return NULL;
+		}
+		return end;
+	}
+
+	bool endToken(int type, const char* begin, const char* end) {
+		if (!ignore.ignored(tokenizer, type)) {
+			if (type >= 0) {
+				my_sink.token(type, begin, end, cur_position);
+			} else {
+				num_errors++;
+				Errors::error(begin, end);
+				if (Errors::STOP) return false;
+				if (Errors::KEEP) my_sink.token(type, begin, end, cur_position);
+			}
+		}
+		cur_position.advance(begin, end);
+		modes.change(tokenizer, type);
+		return true;
+	}
+};
+
+template<class Position, class Sink, class Errors, class Source, class Ignore, class Modes>
+const size_t TokenizerCore<Position, Sink, Errors, Source, Ignore, Modes>::CHUNK_SIZE;
+
+#endif
@@ -0,0 +1,193 @@
+#include <thread>
+#include <functional>
+#include <cstdio>
+#include "tokenizer_metrics.hpp"
+
+const uint32_t TokenizerMetrics::NUM_SHARDS;
+const size_t TokenizerMetrics::TypeCounts::TABLE_SIZE;
+
+void TokenizerMetrics::TypeCounts::add(const TypeCounts& counts) {
+	if (table.size() < counts.table.size()) table.resize(counts.table.size(), 0);
+	for(size_t i = 0; i < counts.table.size(); i++) {
+		table[i] += counts.table[i];
+	}
+	for(std::map<int, uint64_t>::const_iterator it = counts.overflow.begin(); it != counts.overflow.end(); ++it) {
+		if (it->second != 0) overflow[it->first] += it->second;
+	}
+}
+
+uint64_t TokenizerMetrics::TypeCounts::count(int type) const {
+	size_t index = typeIndex(type);
+	if (index < TABLE_SIZE) return (index < table.size()) ? table[index] : 0;
+	std::map<int, uint64_t>::const_iterator it = overflow.find(type);
+	return (it != overflow.end()) ? it->second : 0;
+}
+
+void TokenizerMetrics::TypeCounts::addTo(std::map<int, uint64_t>& totals) const {
+	for(size_t i = 0; i < table.size(); i++) {
+		if (table[i] != 0) totals[indexType(i)] += table[i];
+	}
+	for(std::map<int, uint64_t>::const_iterator it = overflow.begin(); it != overflow.end(); ++it) {
+		if (it->second != 0) totals[it->first] += it->second;
+	}
+}
+
+void TokenizerMetrics::TypeCounts::zero() {
+	table.assign(table.size(), 0);
+	for(std::map<int, uint64_t>::iterator it = overflow.begin(); it != overflow.end(); ++it) {
+		it->second = 0;
+	}
+}
+
+void TokenizerMetrics::TypeCounts::clear() {
+	table.clear();
+	overflow.clear();
+}
+
+TokenizerMetrics::TokenizerMetrics() : compile_nanoseconds(0), compiles(0) {
+	for(uint32_t i = 0; i < NUM_SHARDS; i++) {
+		shards[i].bytes = 0;
+		shards[i].nanoseconds = 0;
+	}
+}
+
+TokenizerMetrics::Shard& TokenizerMetrics::threadShard() {
+	size_t hash = std::hash<std::thread::id>()(std::this_thread::get_id());
+	return shards[hash % NUM_SHARDS];
+}
+
+void TokenizerMetrics::recordLex(uint64_t bytes, uint64_t nanoseconds, TypeCounts& type_counts) {
+	Shard& shard = threadShard();
+	{
+		std::lock_guard<std::mutex> guard(shard.lock);
+		shard.bytes += bytes;
+		shard.nanoseconds += nanoseconds;
+		shard.type_counts.add(type_counts);
+	}
+	type_counts.zero();
+}
+
+void TokenizerMetrics::recordCompile(uint64_t nanoseconds) {
+	compile_nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+	compiles.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TokenizerMetrics::setMemoryUsage(const void* tokenizer, uint64_t bytes) {
+	std::lock_guard<std::mutex> guard(memory_lock);
+	memory_bytes[tokenizer] = bytes;
+}
+
+void TokenizerMetrics::removeMemoryUsage(const void* tokenizer) {
+	std::lock_guard<std::mutex> guard(memory_lock);
+	memory_bytes.erase(tokenizer);
+}
+
+TokenizerMetrics::Totals TokenizerMetrics::totals() const {
+	Totals result;
+	result.bytes = 0;
+	result.lex_nanoseconds = 0;
+	for(uint32_t i = 0; i < NUM_SHARDS; i++) {
+		const Shard& shard = shards[i];
+		std::lock_guard<std::mutex> guard(shard.lock);
+		result.bytes += shard.bytes;
+		result.lex_nanoseconds += shard.nanoseconds;
+		shard.type_counts.addTo(result.type_counts);
+	}
+	result.compile_nanoseconds = compile_nanoseconds.load(std::memory_order_relaxed);
+	result.compiles = compiles.load(std::memory_order_relaxed);
+	result.memory_bytes = 0;
+	std::lock_guard<std::mutex> guard(memory_lock);
+	for(std::map<const void*, uint64_t>::const_iterator it = memory_bytes.begin(); it != memory_bytes.end(); ++it) {
+		result.memory_bytes += it->second;
+	}
+	return result;
+}
+
+uint64_t TokenizerMetrics::tokens(int type) const {
+	uint64_t total = 0;
+	for(uint32_t i = 0; i < NUM_SHARDS; i++) {
+		std::lock_guard<std::mutex> guard(shards[i].lock);
+		total += shards[i].type_counts.count(type);
+	}
+	return total;
+}
+
+static std::string seconds(uint64_t nanoseconds) {
+	char buffer[32];
+	std::snprintf(buffer, sizeof(buffer), "%.9f", nanoseconds / 1e9);
+	return buffer;
+}
+
+// text exposition format, token and error counts are labelled with their type
+std::string TokenizerMetrics::toPrometheus(const std::string& prefix) const {
+	Totals total = totals();
+	std::string out;
+
+	out += "# HELP " + prefix + "_bytes_total Bytes of text lexed.\n";
+	out += "# TYPE " + prefix + "_bytes_total counter\n";
+	out += prefix + "_bytes_total " + std::to_string(total.bytes) + "\n";
+
+	out += "# HELP " + prefix + "_tokens_total Valid tokens lexed by type.\n";
+	out += "# TYPE " + prefix + "_tokens_total counter\n";
+	std::map<int, uint64_t>::const_iterator first_token = total.type_counts.lower_bound(0);
+	for(std::map<int, uint64_t>::const_iterator it = first_token; it != total.type_counts.end(); ++it) {
+		out += prefix + "_tokens_total{type=\"" + std::to_string(it->first) + "\"} "
+			+ std::to_string(it->second) + "\n";
+	}
+
+	out += "# HELP " + prefix + "_errors_total Invalid tokens lexed by type.\n";
+	out += "# TYPE " + prefix + "_errors_total counter\n";
+	for(std::map<int, uint64_t>::const_iterator it = total.type_counts.begin(); it != first_token; ++it) {
+		out += prefix + "_errors_total{type=\"" + std::to_string(it->first) + "\"} "
+			+ std::to_string(it->second) + "\n";
+	}
+
+	out += "# HELP " + prefix + "_lex_seconds_total Time spent lexing.\n";
+	out += "# TYPE " + prefix + "_lex_seconds_total counter\n";
+	out += prefix + "_lex_seconds_total " + seconds(total.lex_nanoseconds) + "\n";
+
+	out += "# HELP " + prefix + "_compile_seconds_total Time spent compiling rules.\n";
+	out += "# TYPE " + prefix + "_compile_seconds_total counter\n";
+	out += prefix + "_compile_seconds_total " + seconds(total.compile_nanoseconds) + "\n";
+
+	out += "# HELP " + prefix + "_compiles_total Rules compiled or loaded from the cache.\n";
+	out += "# TYPE " + prefix + "_compiles_total counter\n";
+	out += prefix + "_compiles_total " + std::to_string(total.compiles) + "\n";
+
+	out += "# HELP " + prefix + "_machine_memory_bytes Memory used by the compiled rules.\n";
+	out += "# TYPE " + prefix + "_machine_memory_bytes gauge\n";
+	out += prefix + "_machine_memory_bytes " + std::to_string(total.memory_bytes) + "\n";
+	return out;
+}
+
+std::string TokenizerMetrics::toJson() const {
+	Totals total = totals();
+	std::string tokens;
+	std::string errors;
+	for(std::map<int, uint64_t>::const_iterator it = total.type_counts.begin(); it != total.type_counts.end(); ++it) {
+		std::string& out = (it->first >= 0) ? tokens : errors;
+		if (!out.empty()) out += ",";
+		out += "\"" + std::to_string(it->first) + "\":" + std::to_string(it->second);
+	}
+
+	return "{\"bytes\":" + std::to_string(total.bytes)
+		+ ",\"tokens\":{" + tokens + "}"
+		+ ",\"errors\":{" + errors + "}"
+		+ ",\"lex_seconds\":" + seconds(total.lex_nanoseconds)
+		+ ",\"compile_seconds\":" + seconds(total.compile_nanoseconds)
+		+ ",\"compiles\":" + std::to_string(total.compiles)
+		+ ",\"machine_memory_bytes\":" + std::to_string(total.memory_bytes) + "}";
+}
+
+void TokenizerMetrics::reset() {
+	for(uint32_t i = 0; i < NUM_SHARDS; i++) {
+		std::lock_guard<std::mutex> guard(shards[i].lock);
+		shards[i].bytes = 0;
+		shards[i].nanoseconds = 0;
+		shards[i].type_counts.clear();
+	}
+	compile_nanoseconds.store(0, std::memory_order_relaxed);
+	compiles.store(0, std::memory_order_relaxed);
+	std::lock_guard<std::mutex> guard(memory_lock);
+	memory_bytes.clear();
+}
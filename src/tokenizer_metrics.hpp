@@ -0,0 +1,111 @@
+/*
+Tokenizer metrics collects running totals from any number of tokenizers, on any
+number of threads, for monitoring. A tokenizer given a metrics object with
+setMetrics() records the bytes it lexes, the tokens of each type it makes
+(errors are the negative types), the time spent lexing and compiling rules, and
+how much memory its compiled rules use.
+
+Tokenizers only count tokens locally while lexing and add them to the totals
+once per chunk of text, into one of several shards picked by thread, so threads
+rarely wait on each other. The shards are summed when the totals are exported
+as Prometheus text or JSON. Memory is kept per tokenizer and summed, so a
+metrics object must outlive the tokenizers that record into it.
+
+ex)
+TokenizerMetrics metrics;
+tokenizer.setMetrics(&metrics);
+...
+std::cout << metrics.toPrometheus("lexer");
+*/
+
+#ifndef TOKENIZER_METRICS_HPP
+#define TOKENIZER_METRICS_HPP
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+class TokenizerMetrics {
+public:
+	static const uint32_t NUM_SHARDS = 16;
+
+	struct Totals {
+		uint64_t bytes;
+		uint64_t lex_nanoseconds;
+		uint64_t compile_nanoseconds;
+		uint64_t compiles;
+		uint64_t memory_bytes;
+		std::map<int, uint64_t> type_counts; // types with any tokens
+	};
+
+	// token counts by type, small types are in a table indexed by typeIndex() and
+	// the rest in a sorted map, so a large type costs one entry instead of a table
+	class TypeCounts {
+	public:
+		static const size_t TABLE_SIZE = 256;
+
+		void add(int type) {
+			size_t index = typeIndex(type);
+			if (index >= TABLE_SIZE) {
+				overflow[type]++;
+				return;
+			}
+			if (index >= table.size()) table.resize(index + 1, 0);
+			table[index]++;
+		}
+		void add(const TypeCounts& counts);
+		uint64_t count(int type) const;
+		void addTo(std::map<int, uint64_t>& totals) const;
+		// zeroes the counts but keeps the entries, so counting again does not allocate
+		void zero();
+		void clear();
+
+	private:
+		std::vector<uint64_t> table;
+		std::map<int, uint64_t> overflow;
+	};
+
+	TokenizerMetrics();
+	TokenizerMetrics(const TokenizerMetrics&) = delete;
+	TokenizerMetrics& operator=(const TokenizerMetrics&) = delete;
+
+	// index of a token type in a table, 0, -1, 1, -2, 2... so both signs fit one vector
+	static size_t typeIndex(int type) { return (type >= 0) ? (size_t)type * 2 : (size_t)(-(type + 1)) * 2 + 1; }
+	static int indexType(size_t index) { return (index % 2 == 0) ? (int)(index / 2) : -(int)(index / 2) - 1; }
+
+	// adds type_counts to the totals and zeroes it
+	void recordLex(uint64_t bytes, uint64_t nanoseconds, TypeCounts& type_counts);
+	void recordCompile(uint64_t nanoseconds);
+	// memory used by the rules of one tokenizer, the totals sum every tokenizer
+	void setMemoryUsage(const void* tokenizer, uint64_t bytes);
+	void removeMemoryUsage(const void* tokenizer);
+
+	Totals totals() const;
+	uint64_t tokens(int type) const;
+	std::string toPrometheus(const std::string& prefix = "tokenizer") const;
+	std::string toJson() const;
+	void reset();
+
+private:
+	// kept on separate cache lines so threads of different shards do not contend
+	struct alignas(64) Shard {
+		mutable std::mutex lock;
+		uint64_t bytes;
+		uint64_t nanoseconds;
+		TypeCounts type_counts;
+	};
+
+	Shard shards[NUM_SHARDS];
+	std::atomic<uint64_t> compile_nanoseconds;
+	std::atomic<uint64_t> compiles;
+	mutable std::mutex memory_lock;
+	std::map<const void*, uint64_t> memory_bytes;
+
+	Shard& threadShard();
+};
+
+#endif
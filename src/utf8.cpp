@@ -0,0 +1,227 @@
+#include <algorithm>
+#include "utf8.hpp"
+#include "utf8_categories.hpp"
+
+namespace utf8 {
+
+static const Category* findCategory(const std::string& name) {
+	for(unsigned int i = 0; i < NUM_CATEGORIES; i++) {
+		if (name == CATEGORIES[i].name) return &CATEGORIES[i];
+	}
+	return NULL;
+}
+
+bool getCategory(const std::string& name, CodePointSet& set) {
+	if (name == "L") {
+		for(unsigned int i = 0; i < NUM_LETTER_CATEGORIES; i++) {
+			getCategory(LETTER_CATEGORIES[i], set);
+		}
+		return true;
+	}
+
+	const Category* category = findCategory(name);
+	if (category == NULL) return false;
+	for(unsigned int i = 0; i < category->size; i++) {
+		set.add(category->ranges[i].first, category->ranges[i].last);
+	}
+	return true;
+}
+
+void CodePointSet::add(CodePoint first, CodePoint last) {
+	if (first > last) std::swap(first, last);
+
+	// find the first range that could touch [first, last]
+	std::vector<Range>::iterator it = range_list.begin();
+	while(it != range_list.end() && it->last + 1 < first) it++;
+
+	Range merged = { first, last };
+	std::vector<Range>::iterator merge_end = it;
+	while(merge_end != range_list.end() && merge_end->first <= last + 1) {
+		merged.first = std::min(merged.first, merge_end->first);
+		merged.last = std::max(merged.last, merge_end->last);
+		merge_end++;
+	}
+	it = range_list.erase(it, merge_end);
+	range_list.insert(it, merged);
+}
+
+void CodePointSet::add(const CodePointSet& other) {
+	for(unsigned int i = 0; i < other.range_list.size(); i++) {
+		add(other.range_list[i].first, other.range_list[i].last);
+	}
+}
+
+bool CodePointSet::contains(CodePoint cp) const {
+	for(unsigned int i = 0; i < range_list.size(); i++) {
+		if (cp < range_list[i].first) return false;
+		if (cp <= range_list[i].last) return true;
+	}
+	return false;
+}
+
+CodePointSet CodePointSet::complement() const {
+	CodePointSet result;
+	CodePoint next = 1;
+	for(unsigned int i = 0; i < range_list.size(); i++) {
+		const Range& range = range_list[i];
+		if (range.first > next) result.add(next, range.first - 1);
+		next = std::max(next, range.last + 1);
+	}
+	if (next <= MAX_CODE_POINT) result.add(next, MAX_CODE_POINT);
+
+	// surrogates are not characters
+	CodePointSet valid;
+	for(unsigned int i = 0; i < result.range_list.size(); i++) {
+		Range range = result.range_list[i];
+		if (range.first < SURROGATE_FIRST) {
+			valid.add(range.first, std::min(range.last, SURROGATE_FIRST - 1));
+		}
+		if (range.last > SURROGATE_LAST) {
+			valid.add(std::max(range.first, SURROGATE_LAST + 1), range.last);
+		}
+	}
+	return valid;
+}
+
+// the ranges of both sets are sorted, so they can be walked together
+CodePointSet CodePointSet::intersection(const CodePointSet& other) const {
+	CodePointSet result;
+	unsigned int i = 0;
+	unsigned int j = 0;
+	while(i < range_list.size() && j < other.range_list.size()) {
+		const Range& a = range_list[i];
+		const Range& b = other.range_list[j];
+		CodePoint first = std::max(a.first, b.first);
+		CodePoint last = std::min(a.last, b.last);
+		if (first <= last) result.range_list.push_back({ first, last });
+		if (a.last < b.last) i++;
+		else j++;
+	}
+	return result;
+}
+
+CodePointSet CodePointSet::caseFolded() const {
+	CodePointSet result = *this;
+	for(unsigned int i = 0; i < range_list.size(); i++) {
+		const Range& range = range_list[i];
+		CodePoint first = std::max<CodePoint>(range.first, 'A');
+		CodePoint last = std::min<CodePoint>(range.last, 'Z');
+		if (first <= last) result.add(first + ('a' - 'A'), last + ('a' - 'A'));
+		first = std::max<CodePoint>(range.first, 'a');
+		last = std::min<CodePoint>(range.last, 'z');
+		if (first <= last) result.add(first - ('a' - 'A'), last - ('a' - 'A'));
+	}
+	return result;
+}
+
+unsigned int encode(CodePoint cp, char* buffer) {
+	if (cp < 0x80) {
+		buffer[0] = (char)cp;
+		return 1;
+	} else if (cp < 0x800) {
+		buffer[0] = (char)(0xC0 | (cp >> 6));
+		buffer[1] = (char)(0x80 | (cp & 0x3F));
+		return 2;
+	} else if (cp < 0x10000) {
+		buffer[0] = (char)(0xE0 | (cp >> 12));
+		buffer[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+		buffer[2] = (char)(0x80 | (cp & 0x3F));
+		return 3;
+	} else {
+		buffer[0] = (char)(0xF0 | (cp >> 18));
+		buffer[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+		buffer[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+		buffer[3] = (char)(0x80 | (cp & 0x3F));
+		return 4;
+	}
+}
+
+std::string encode(CodePoint cp) {
+	char buffer[MAX_SEQUENCE_LENGTH];
+	unsigned int length = encode(cp, buffer);
+	return std::string(buffer, length);
+}
+
+bool decode(const std::string& str, unsigned int& index, CodePoint& cp) {
+	unsigned char lead = str[index];
+	unsigned int length = sequenceLength(lead);
+	if (length == 1) {
+		cp = lead;
+		index++;
+		return lead < 0x80;
+	}
+	if (index + length > str.size()) return false;
+
+	cp = lead & (0xFF >> (length + 1));
+	for(unsigned int i = 1; i < length; i++) {
+		unsigned char c = str[index + i];
+		if (!isContinuation(c)) return false;
+		cp = (cp << 6) | (c & 0x3F);
+	}
+
+	if (!isValidCodePoint(cp, length)) return false;
+	index += length;
+	return true;
+}
+
+static void splitRange(CodePoint first, CodePoint last, std::vector<ByteSequence>& result) {
+	if (first > last) return;
+
+	// surrogates cannot be encoded
+	if (first <= SURROGATE_LAST && last >= SURROGATE_FIRST) {
+		if (first < SURROGATE_FIRST) splitRange(first, SURROGATE_FIRST - 1, result);
+		if (last > SURROGATE_LAST) splitRange(SURROGATE_LAST + 1, last, result);
+		return;
+	}
+
+	// every character in a range must have the same encoded length
+	static const CodePoint LENGTH_LIMITS[] = { 0x7F, 0x7FF, 0xFFFF };
+	for(unsigned int i = 0; i < 3; i++) {
+		CodePoint limit = LENGTH_LIMITS[i];
+		if (first <= limit && last > limit) {
+			splitRange(first, limit, result);
+			splitRange(limit + 1, last, result);
+			return;
+		}
+	}
+
+	// continuation bytes can only span a range if all lower bytes span everything
+	for(unsigned int i = 1; i < MAX_SEQUENCE_LENGTH; i++) {
+		CodePoint mask = (1u << (6 * i)) - 1;
+		if ((first & ~mask) != (last & ~mask)) {
+			if ((first & mask) != 0) {
+				splitRange(first, first | mask, result);
+				splitRange((first | mask) + 1, last, result);
+				return;
+			}
+			if ((last & mask) != mask) {
+				splitRange(first, (last & ~mask) - 1, result);
+				splitRange(last & ~mask, last, result);
+				return;
+			}
+		}
+	}
+
+	char first_bytes[MAX_SEQUENCE_LENGTH];
+	char last_bytes[MAX_SEQUENCE_LENGTH];
+	unsigned int length = encode(first, first_bytes);
+	encode(last, last_bytes);
+
+	ByteSequence sequence(length);
+	for(unsigned int i = 0; i < length; i++) {
+		sequence[i].first = (unsigned char)first_bytes[i];
+		sequence[i].last = (unsigned char)last_bytes[i];
+	}
+	result.push_back(sequence);
+}
+
+std::vector<ByteSequence> sequences(const CodePointSet& set) {
+	std::vector<ByteSequence> result;
+	const std::vector<Range>& ranges = set.ranges();
+	for(unsigned int i = 0; i < ranges.size(); i++) {
+		splitRange(ranges[i].first, ranges[i].last, result);
+	}
+	return result;
+}
+
+}
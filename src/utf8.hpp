@@ -0,0 +1,144 @@
+/*
+UTF-8 helpers shared by the token state machine and the tokenizer. Characters
+in a rule are collected into a CodePointSet (a sorted list of code point
+ranges) which is split into sequences of byte ranges, so that any set of
+unicode characters can be encoded as byte level state changes. The tokenizer
+uses advancePosition() to track rows and columns, which skips over runs of plain
+ASCII with asciiRun(), since only multi-byte characters need any special treatment
+*/
+
+#ifndef UTF8_HPP
+#define UTF8_HPP
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace utf8 {
+	typedef uint32_t CodePoint;
+
+	const CodePoint MAX_CODE_POINT = 0x10FFFF;
+	const CodePoint SURROGATE_FIRST = 0xD800;
+	const CodePoint SURROGATE_LAST = 0xDFFF;
+	const unsigned int MAX_SEQUENCE_LENGTH = 4;
+
+	struct Range {
+		CodePoint first;
+		CodePoint last;
+	};
+
+	struct ByteRange {
+		unsigned char first;
+		unsigned char last;
+	};
+
+	typedef std::vector<ByteRange> ByteSequence;
+
+	class CodePointSet {
+	public:
+		void add(CodePoint cp) { add(cp, cp); }
+		void add(CodePoint first, CodePoint last);
+		void add(const CodePointSet& other);
+		bool contains(CodePoint cp) const;
+		bool empty() const { return range_list.empty(); }
+		const std::vector<Range>& ranges() const { return range_list; }
+
+		// every valid character (1 to MAX_CODE_POINT, excluding surrogates) not in this set
+		CodePointSet complement() const;
+		CodePointSet intersection(const CodePointSet& other) const;
+
+		// the set with the other case of every ASCII letter in it added
+		CodePointSet caseFolded() const;
+
+	private:
+		std::vector<Range> range_list; // sorted, non overlapping and non adjacent
+	};
+
+	// named unicode categories used by \p{Name}, returns false if the name is unknown
+	bool getCategory(const std::string& name, CodePointSet& set);
+
+	// splits a set into byte range sequences, in order of their first byte
+	std::vector<ByteSequence> sequences(const CodePointSet& set);
+
+	// writes the encoding of cp to buffer and returns the number of bytes written
+	unsigned int encode(CodePoint cp, char* buffer);
+	std::string encode(CodePoint cp);
+
+	// decodes the character starting at str[index] and advances index past it.
+	// returns false if the bytes are not valid UTF-8
+	bool decode(const std::string& str, unsigned int& index, CodePoint& cp);
+
+	// true if cp is a character that needs all length bytes, so no overlong
+	// encodings, surrogates or values past MAX_CODE_POINT
+	constexpr bool isValidCodePoint(CodePoint cp, unsigned int length) {
+		return cp <= MAX_CODE_POINT && (cp < SURROGATE_FIRST || cp > SURROGATE_LAST)
+			&& cp >= ((length == 4) ? 0x10000u : (length == 3) ? 0x800u : (length == 2) ? 0x80u : 0u);
+	}
+
+	// number of bytes a character with the given lead byte should have (1 for invalid bytes)
+	constexpr unsigned int sequenceLength(unsigned char lead) {
+		return (lead < 0xC2) ? 1 : (lead < 0xE0) ? 2 : (lead < 0xF0) ? 3 : (lead < 0xF5) ? 4 : 1;
+	}
+
+	constexpr bool isContinuation(unsigned char c) { return (c & 0xC0) == 0x80; }
+
+	// returns a pointer past the character (valid or not) starting at begin
+	inline const char* nextCharacter(const char* begin, const char* end) {
+		const char* stop = begin + sequenceLength((unsigned char)*begin);
+		if (stop > end) stop = end;
+		const char* it = begin + 1;
+		while(it < stop && isContinuation((unsigned char)*it)) it++;
+		return it;
+	}
+
+	// length of the run of ASCII bytes starting at begin
+	inline size_t asciiRun(const char* begin, const char* end) {
+		const char* it = begin;
+#ifdef __SSE2__
+		while(end - it >= 16) {
+			__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+			int mask = _mm_movemask_epi8(block);
+			if (mask != 0) return (it - begin) + __builtin_ctz(mask);
+			it += 16;
+		}
+#endif
+		while(end - it >= 8) {
+			uint64_t block;
+			std::memcpy(&block, it, 8);
+			if (block & 0x8080808080808080ull) break;
+			it += 8;
+		}
+		while(it < end && (unsigned char)*it < 0x80) it++;
+		return it - begin;
+	}
+
+	// moves row and column past the text, counting each character once
+	inline void advancePosition(const char* begin, const char* end, unsigned int& row, unsigned int& column) {
+		const char* cur = begin;
+		while(cur < end) {
+			// ASCII runs only need to look for new lines
+			const char* run_end = cur + asciiRun(cur, end);
+			const char* line = cur;
+			while(const char* newline = (const char*)std::memchr(line, '\n', run_end - line)) {
+				row++;
+				column = 1;
+				line = newline + 1;
+			}
+			column += run_end - line;
+			cur = run_end;
+
+			// count multi-byte characters once
+			for(; cur < end && (unsigned char)*cur >= 0x80; cur++) {
+				if (!isContinuation(*cur)) column++;
+			}
+		}
+	}
+}
+
+#endif
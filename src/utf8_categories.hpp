@@ -0,0 +1,98 @@
+/*
+Code point ranges of the categories that can be used with \p{Name} in rules.
+Kept as constant arrays in a header so they can also be read by the compile
+time state machine
+*/
+
+#ifndef UTF8_CATEGORIES_HPP
+#define UTF8_CATEGORIES_HPP
+
+#include "utf8.hpp"
+
+namespace utf8 {
+
+struct Category {
+	const char* name;
+	const Range* ranges;
+	unsigned int size;
+};
+
+// categories are approximated by unicode blocks rather than generated from the
+// full character database. Scripts leave out the digits (which are \p{N}) and
+// punctuation of their blocks, so letter and number rules can be used together
+static constexpr Range ANY[] = { {0x01, MAX_CODE_POINT} };
+static constexpr Range ASCII[] = { {0x01, 0x7F} };
+static constexpr Range LATIN[] = {
+	{0x41, 0x5A}, {0x61, 0x7A}, {0xAA, 0xAA}, {0xBA, 0xBA}, {0xC0, 0xD6},
+	{0xD8, 0xF6}, {0xF8, 0x24F}, {0x1E00, 0x1EFF}, {0x2C60, 0x2C7F},
+	{0xA720, 0xA7FF}, {0xFF21, 0xFF3A}, {0xFF41, 0xFF5A}
+};
+static constexpr Range GREEK[] = {
+	{0x370, 0x373}, {0x376, 0x377}, {0x37A, 0x37D}, {0x37F, 0x37F}, {0x386, 0x386},
+	{0x388, 0x3FF}, {0x1F00, 0x1FFF}
+};
+static constexpr Range CYRILLIC[] = {
+	{0x400, 0x481}, {0x483, 0x52F}, {0x2DE0, 0x2DFF}, {0xA640, 0xA69F}
+};
+static constexpr Range HEBREW[] = {
+	{0x591, 0x5BD}, {0x5BF, 0x5BF}, {0x5C1, 0x5C2}, {0x5C4, 0x5C5}, {0x5C7, 0x5C7},
+	{0x5D0, 0x5EA}, {0x5EF, 0x5F2}
+};
+static constexpr Range ARABIC[] = {
+	{0x610, 0x61A}, {0x620, 0x65F}, {0x66E, 0x6D3}, {0x6D5, 0x6DC}, {0x6DF, 0x6E8},
+	{0x6EA, 0x6EF}, {0x6FA, 0x6FC}, {0x6FF, 0x6FF}, {0x750, 0x77F}, {0x8A0, 0x8FF},
+	{0xFB50, 0xFD3D}, {0xFD50, 0xFDFB}, {0xFE70, 0xFEFC}
+};
+static constexpr Range DEVANAGARI[] = { {0x900, 0x963}, {0x971, 0x97F} };
+static constexpr Range THAI[] = { {0xE01, 0xE3A}, {0xE40, 0xE4E} };
+static constexpr Range HANGUL[] = { {0x1100, 0x11FF}, {0x3130, 0x318F}, {0xAC00, 0xD7AF} };
+static constexpr Range HIRAGANA[] = { {0x3040, 0x309F} };
+static constexpr Range KATAKANA[] = { {0x30A0, 0x30FF}, {0x31F0, 0x31FF}, {0xFF66, 0xFF9F} };
+static constexpr Range HAN[] = {
+	{0x2E80, 0x2FDF}, {0x3005, 0x3005}, {0x3007, 0x3007}, {0x3021, 0x3029},
+	{0x3038, 0x303B}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xF900, 0xFAFF},
+	{0x20000, 0x2FA1F}
+};
+static constexpr Range NUMBER[] = {
+	{0x30, 0x39}, {0x660, 0x669}, {0x6F0, 0x6F9}, {0x966, 0x96F}, {0xE50, 0xE59},
+	{0xFF10, 0xFF19}
+};
+static constexpr Range SPACE[] = {
+	{0x20, 0x20}, {0xA0, 0xA0}, {0x1680, 0x1680}, {0x2000, 0x200A}, {0x202F, 0x202F},
+	{0x205F, 0x205F}, {0x3000, 0x3000}
+};
+
+#define CATEGORY(name, ranges) { name, ranges, sizeof(ranges) / sizeof(Range) }
+
+static constexpr Category CATEGORIES[] = {
+	CATEGORY("Any", ANY),
+	CATEGORY("ASCII", ASCII),
+	CATEGORY("Latin", LATIN),
+	CATEGORY("Greek", GREEK),
+	CATEGORY("Cyrillic", CYRILLIC),
+	CATEGORY("Hebrew", HEBREW),
+	CATEGORY("Arabic", ARABIC),
+	CATEGORY("Devanagari", DEVANAGARI),
+	CATEGORY("Thai", THAI),
+	CATEGORY("Hangul", HANGUL),
+	CATEGORY("Hiragana", HIRAGANA),
+	CATEGORY("Katakana", KATAKANA),
+	CATEGORY("Han", HAN),
+	CATEGORY("N", NUMBER),
+	CATEGORY("Zs", SPACE)
+};
+
+#undef CATEGORY
+
+// letters (\p{L}) are the union of the script categories
+static constexpr const char* LETTER_CATEGORIES[] = {
+	"Latin", "Greek", "Cyrillic", "Hebrew", "Arabic", "Devanagari", "Thai",
+	"Hangul", "Hiragana", "Katakana", "Han"
+};
+
+const unsigned int NUM_CATEGORIES = sizeof(CATEGORIES) / sizeof(Category);
+const unsigned int NUM_LETTER_CATEGORIES = sizeof(LETTER_CATEGORIES) / sizeof(const char*);
+
+}
+
+#endif
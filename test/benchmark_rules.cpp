@@ -0,0 +1,62 @@
+/*
+Times compiling increasing numbers of literal rules (like keyword or API name
+lists) plus a few regex rules. Compile time per byte of rule should stay about
+the same as the number of rules doubles. Building the flat table is timed
+separately since it grows with the number of states (256 per state)
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <set>
+#include <string>
+#include "token_state_machine.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+static double millisecondsSince(Clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// unique pseudo random lowercase words, the same every run
+static std::set<std::string> makeWords(uint count) {
+	std::set<std::string> words;
+	uint seed = 12345;
+	while(words.size() < count) {
+		seed = seed * 1103515245 + 12345;
+		uint length = 4 + (seed >> 16) % 12;
+		std::string word;
+		for(uint i = 0; i < length; i++) {
+			seed = seed * 1103515245 + 12345;
+			word += (char)('a' + (seed >> 16) % 26);
+		}
+		words.insert(word);
+	}
+	return words;
+}
+
+int main() {
+	std::printf("%8s %10s %12s %10s %12s\n", "rules", "bytes", "compile ms", "ns/byte", "table ms");
+	for(uint count = 6250; count <= 50000; count *= 2) {
+		std::set<std::string> words = makeWords(count);
+		size_t bytes = 0;
+
+		Clock::time_point start = Clock::now();
+		TokenStateMachine sm;
+		int type = 0;
+		for(std::set<std::string>::iterator it = words.begin(); it != words.end(); it++) {
+			sm.addRule(*it, type++);
+			bytes += it->size();
+		}
+		sm.addRule("[0-9]+", type++);
+		sm.addRule("\"((\\\\.)|[^\"\\\\])*\"", type++);
+		double compile_ms = millisecondsSince(start);
+
+		start = Clock::now();
+		sm.begin();
+		double table_ms = millisecondsSince(start);
+
+		std::printf("%8u %10u %12.1f %10.1f %12.1f\n", count, (uint)bytes, compile_ms,
+			compile_ms * 1e6 / bytes, table_ms);
+	}
+	return 0;
+}
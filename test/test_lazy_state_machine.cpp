@@ -0,0 +1,166 @@
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+#include "lazy_state_machine.hpp"
+#include "token_state_machine.hpp"
+#include "testing.hpp"
+
+typedef unsigned int uint;
+typedef std::vector<std::pair<int, uint>> Tokens;
+
+enum Type {
+	KEYWORD,
+	WORD,
+	NUMBER,
+	HEX,
+	SPACE
+};
+
+// type and length of each token in the text, an unmatched byte is a token of type -1
+Tokens lex(LazyStateMachine& machine, const std::string& text) {
+	Tokens tokens;
+	uint cur = 0;
+	while(cur < text.size()) {
+		LazyStateMachine::Iterator iterator = machine.begin();
+		uint begin = cur;
+		while(cur < text.size()) {
+			iterator.nextState(text[cur]);
+			if (iterator.atEnd()) break;
+			cur++;
+		}
+		if (cur == begin) {
+			cur++;
+			tokens.push_back(std::make_pair(-1, 1u));
+		} else {
+			tokens.push_back(std::make_pair(iterator.getType(), cur - begin));
+		}
+	}
+	return tokens;
+}
+
+void setup(LazyStateMachine& machine) {
+	machine.addLiteral("if", KEYWORD);
+	machine.addLiteral("else", KEYWORD);
+	machine.addRule("[a-z]+", WORD);
+	machine.addRule("0x[0-9a-f]+", HEX);
+	machine.addRule("[0-9a-f]+", NUMBER);
+	machine.addRule(" +", SPACE);
+}
+
+const std::string text = "if iffy else 0x1f 42 beef elsewhere ?";
+const uint num_tokens = 15;
+const int expected_types[num_tokens] = {
+	KEYWORD, SPACE, WORD, SPACE, KEYWORD, SPACE, HEX, SPACE, NUMBER, SPACE, WORD, SPACE, WORD, SPACE, -1
+};
+
+bool matchesExpected(const Tokens& tokens) {
+	if (tokens.size() != num_tokens) return false;
+	for(uint i = 0; i < num_tokens; i++) {
+		if (tokens[i].first != expected_types[i]) return false;
+	}
+	return true;
+}
+
+int main() {
+	describe("lazy state machine", {
+		it("should take rules a single table rejects", {
+			TokenStateMachine table;
+			table.addRule("[a-z]+", WORD);
+			expectException(table.addLiteral("if", KEYWORD), std::runtime_error);
+
+			LazyStateMachine machine;
+			setup(machine);
+			Tokens tokens = lex(machine, text);
+			expect(matchesExpected(tokens), true);
+			expect(tokens[2].second, 4);
+			expect(tokens[12].second, 9);
+		});
+
+		it("should give the type of the rule added first", {
+			LazyStateMachine machine;
+			machine.addRule("[a-f]+", NUMBER);
+			machine.addRule("[a-z]+", WORD);
+			Tokens tokens = lex(machine, "bead");
+			expect(tokens[0].first, NUMBER);
+			tokens = lex(machine, "beads");
+			expect(tokens[0].first, WORD);
+		});
+
+		it("should only match rules of the mode", {
+			LazyStateMachine machine;
+			uint mode = machine.addMode();
+			machine.addRule("[a-z]+", WORD);
+			machine.addRule("[a-z0-9]+", NUMBER, mode);
+			LazyStateMachine::Iterator iterator = machine.begin(mode);
+			iterator.nextState('a');
+			iterator.nextState('1');
+			expect(iterator.atEnd(), false);
+			expect(iterator.getType(), NUMBER);
+			expectException(machine.addRule("a", WORD, 2), std::runtime_error);
+		});
+
+		it("should reuse cached states", {
+			LazyStateMachine machine;
+			setup(machine);
+			lex(machine, text);
+			uint states = machine.cachedStates();
+			expectGreaterThan(states, 0);
+			lex(machine, text);
+			expect(machine.cachedStates(), states);
+			expect(machine.cacheResets(), 0);
+		});
+
+		it("should empty a full cache and lex the same tokens", {
+			LazyStateMachine machine;
+			setup(machine);
+			machine.setCacheSize(3 * 1200);
+			Tokens tokens = lex(machine, text);
+			expect(matchesExpected(tokens), true);
+			expectGreaterThan(machine.cacheResets(), 0);
+			expectLesserThan(machine.cacheUsage(), 3 * 1200 + 1);
+		});
+
+		it("should step the rules when the cache thrashes", {
+			LazyStateMachine machine;
+			setup(machine);
+			machine.setCacheSize(0);
+			Tokens tokens = lex(machine, text);
+			expect(matchesExpected(tokens), true);
+			expect(machine.steppingRules(), true);
+			expect(machine.cachedStates(), 0);
+
+			machine.setCacheSize(LazyStateMachine::DEFAULT_CACHE_SIZE);
+			machine.newText();
+			expect(machine.steppingRules(), false);
+			tokens = lex(machine, text);
+			expect(matchesExpected(tokens), true);
+			expectGreaterThan(machine.cachedStates(), 0);
+		});
+
+		it("should lex a large set of overlapping rules", {
+			LazyStateMachine machine;
+			std::string keywords;
+			for(uint i = 0; i < 2000; i++) {
+				std::string keyword = "k" + std::to_string(i * 7919);
+				machine.addLiteral(keyword, KEYWORD);
+				keywords += keyword + " ";
+			}
+			machine.addRule("[a-z0-9]+", WORD);
+			machine.addRule(" ", SPACE);
+			Tokens tokens = lex(machine, keywords + "k1 kk");
+			expect(tokens.size(), 4003);
+			uint keyword_count = 0;
+			for(uint i = 0; i < tokens.size(); i++) {
+				if (tokens[i].first == KEYWORD) keyword_count++;
+			}
+			expect(keyword_count, 2000);
+			expect(tokens[4000].first, WORD);
+			expect(tokens[4002].first, WORD);
+		});
+	});
+
+	displayTestResults();
+
+	return failed();
+}
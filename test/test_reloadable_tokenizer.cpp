@@ -0,0 +1,158 @@
+#include "reloadable_tokenizer.hpp"
+#include "tokenizer_core.hpp"
+#include "tokenizer.hpp"
+#include "token_types.hpp"
+#include "token.hpp"
+#include "testing.hpp"
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// the same text gives different types under each rule set
+void wordRules(Tokenizer& tokenizer) {
+	tokenizer.addRule(Tokenizer::WHITESPACE, TokenType::WHITESPACE, true);
+	tokenizer.addRule("[a-z]+", TokenType::WORD);
+	tokenizer.addRule("[0-9]+", TokenType::DECIMAL);
+}
+
+void directiveRules(Tokenizer& tokenizer) {
+	tokenizer.addRule(Tokenizer::WHITESPACE, TokenType::WHITESPACE, true);
+	tokenizer.addRule("[a-z]+", TokenType::DIRECTIVE);
+	tokenizer.addRule("[0-9]+", TokenType::HEX);
+}
+
+// takes long enough to compile that a caller waiting on it would notice
+void slowRules(Tokenizer& tokenizer) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	directiveRules(tokenizer);
+}
+
+void badRules(Tokenizer& tokenizer) {
+	tokenizer.addRule("bad regex[", TokenType::WORD);
+}
+
+// every token of the list has one of the types of a single rule set
+bool consistent(const std::vector<Token>& token_list) {
+	if (token_list.size() != 4) return false;
+	bool words = (token_list[0].type == TokenType::WORD);
+	for(uint i = 0; i < token_list.size(); i++) {
+		bool number = (i % 2 == 1);
+		int expected = words ? (number ? TokenType::DECIMAL : TokenType::WORD)
+			: (number ? TokenType::HEX : TokenType::DIRECTIVE);
+		if (token_list[i].type != expected) return false;
+	}
+	return true;
+}
+
+int main() {
+	std::string text = "abc 123 def 456";
+
+	describe("reloadable tokenizer", {
+		it("should tokenize with the current rules", {
+			ReloadableTokenizer lexer(wordRules);
+			std::vector<Token> token_list;
+			expect(lexer.tokenize(text, &token_list), false);
+			expect(token_list.size(), 4);
+			expect(token_list[0].type, TokenType::WORD);
+			expect(lexer.version(), 1);
+
+			lexer.reload(directiveRules);
+			token_list.clear();
+			lexer.tokenize(text, &token_list);
+			expect(token_list[0].type, TokenType::DIRECTIVE);
+			expect(token_list[1].type, TokenType::HEX);
+			expect(lexer.version(), 2);
+		});
+
+		it("should keep the old rules if the new ones throw", {
+			ReloadableTokenizer lexer(wordRules);
+			expectException(lexer.reload(badRules), std::runtime_error);
+			std::future<void> result = lexer.reloadAsync(badRules);
+			expectException(result.get(), std::runtime_error);
+			expect(lexer.version(), 1);
+			std::vector<Token> token_list;
+			lexer.tokenize(text, &token_list);
+			expect(token_list[0].type, TokenType::WORD);
+		});
+
+		it("should wait for readers of the old rules", {
+			ReloadableTokenizer lexer(wordRules);
+			std::future<void> result;
+			{
+				ReloadableTokenizer::Reader reader = lexer.read();
+				result = lexer.reloadAsync(directiveRules);
+				while(lexer.version() == 1) std::this_thread::yield();
+
+				// the new rules are published but the reader keeps the old ones alive
+				expect(reader.version(), 1);
+				expect(result.wait_for(std::chrono::milliseconds(50)) == std::future_status::timeout, true);
+				std::vector<Token> token_list;
+				TokenizerCore<> core(reader.tokenizer(), VectorSink(&token_list));
+				core.tokenize(MemorySource(text));
+				expect(token_list[0].type, TokenType::WORD);
+				expect(lexer.read().version(), 2);
+			}
+			expect(result.wait_for(std::chrono::seconds(10)) == std::future_status::ready, true);
+		});
+
+		it("should not wait for a reload whose future is dropped", {
+			ReloadableTokenizer lexer(wordRules);
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			lexer.reloadAsync(slowRules);
+			long long waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - start).count();
+			expectLesserThan(waited, 100);
+			expect(lexer.version(), 1);
+			while(lexer.version() == 1) std::this_thread::yield();
+			std::vector<Token> token_list;
+			lexer.tokenize(text, &token_list);
+			expect(token_list[0].type, TokenType::DIRECTIVE);
+		});
+
+		it("should finish a reload after the handle is destroyed", {
+			ReloadableTokenizer* lexer = new ReloadableTokenizer(wordRules);
+			std::future<void> result = lexer->reloadAsync(slowRules);
+			delete lexer;
+			expect(result.wait_for(std::chrono::seconds(10)) == std::future_status::ready, true);
+			expectNoException(result.get());
+		});
+
+		it("should not disturb readers on other threads", {
+			ReloadableTokenizer lexer(wordRules);
+			std::atomic<bool> running(true);
+			std::atomic<uint> failures(0);
+			std::atomic<uint> calls(0);
+			std::vector<std::thread> threads;
+			for(uint t = 0; t < 4; t++) {
+				threads.push_back(std::thread([&]() {
+					while(running) {
+						std::vector<Token> token_list;
+						lexer.tokenize(text, &token_list);
+						if (!consistent(token_list)) failures++;
+						calls++;
+					}
+				}));
+			}
+			for(uint i = 0; i < 50; i++) {
+				lexer.reload((i % 2 == 0) ? directiveRules : wordRules);
+			}
+			// on a busy machine the reloads can finish before the readers start
+			while(calls.load() == 0) std::this_thread::yield();
+			running = false;
+			for(uint t = 0; t < threads.size(); t++) {
+				threads[t].join();
+			}
+			expect(failures.load(), 0);
+			expectGreaterThan(calls.load(), 0);
+			expect(lexer.version(), 51);
+		});
+	});
+
+	displayTestResults();
+
+	return failed();
+}
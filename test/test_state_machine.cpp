@@ -1,5 +1,8 @@
 #include <string>
 #include <fstream>
+#include <cstdio>
+#include <algorithm>
+#include <cctype>
 #include "token_state_machine.hpp"
 #include "testing.hpp"
 
@@ -17,6 +20,41 @@ const std::string keywords[num_keywords] = {
 	"epic"
 };
 
+const uint num_literals = 5;
+const std::string literal_rules[num_literals] = {
+	"int",
+	"inline",
+	"\\+\\+",
+	"caf\xC3\xA9",
+	"i"
+};
+const std::string literal_tokens[num_literals] = {
+	"int",
+	"inline",
+	"++",
+	"caf\xC3\xA9",
+	"in"
+};
+
+const uint num_repetition_rules = 5;
+const std::string repetition_rules[num_repetition_rules] = {
+	"a{3}",
+	"b{2,}",
+	"c{1,3}",
+	"(xy){0,2}z",
+	"[0-9]{1,3}(\\.[0-9]{1,3}){3}"
+};
+
+const uint num_repetition_matches = 9;
+const std::string repetition_matches[num_repetition_matches] = {
+	"aaa", "bb", "bbbbbb", "c", "ccc", "z", "xyz", "xyxyz", "192.168.0.1"
+};
+
+const uint num_repetition_mismatches = 7;
+const std::string repetition_mismatches[num_repetition_mismatches] = {
+	"aa", "aaaa", "b", "cccc", "xyxyxyz", "1921.1.1.1", "1.2.3"
+};
+
 const uint num_int_expressions = 4;
 const std::string int_expressions[num_int_expressions] = {
 	"0x[0-9a-fA-F]+",
@@ -54,6 +92,43 @@ const std::string assembly_expressions[num_assembly_expressions] = {
 	"'((\\\\.)|[^\\\\'])" // unterminated char
 };
 
+// the type of str if the whole string is matched, otherwise -1
+int matchType(TokenStateMachine& sm, const std::string& str) {
+	TokenStateMachine::Iterator iterator = sm.begin();
+	for(uint i = 0; i < str.size(); i++) {
+		iterator.nextState(str[i]);
+		if (iterator.atEnd()) return -1;
+	}
+	return iterator.getType();
+}
+
+// where, with which type and in which state the token at the start of str ends
+std::string tokenEnd(TokenStateMachine& sm, const std::string& str, bool use_pairs) {
+	TokenStateMachine::Iterator iterator = sm.begin();
+	const char* cur = str.data();
+	const char* end = cur + str.size();
+	if (use_pairs) cur = iterator.nextPairs(cur, end);
+	while(cur < end) {
+		iterator.nextState(*cur);
+		if (iterator.atEnd()) break;
+		cur++;
+	}
+	return std::to_string(cur - str.data()) + " " + std::to_string(iterator.getType())
+		+ " " + std::to_string(iterator.getState());
+}
+
+const uint num_pair_strings = 8;
+const std::string pair_strings[num_pair_strings] = {
+	"identifier_1 = 0x12fg",
+	"0b1011 0572 -1234",
+	"\"a \\\"string\\\"\" x",
+	"; a comment\nabc",
+	"'a' 'ab' '\\n",
+	"$ff, #12",
+	"\"unterminated",
+	".directive:"
+};
+
 int main() {
 	describe("token state machine", {
 		describe("addRule()", {
@@ -108,6 +183,13 @@ int main() {
 				}
 			});
 
+			it("should accept the same rule in different modes", {
+				TokenStateMachine sm;
+				uint mode = sm.addMode();
+				expectNoException(sm.addRule("[a-z]+", 5));
+				expectNoException(sm.addRule("[a-z]+", 6, mode));
+			});
+
 			it("should throw error on unmatched brackets", {
 				TokenStateMachine sm;
 				expectException(sm.addRule("bad regex[", 5), std::runtime_error);
@@ -410,6 +492,232 @@ int main() {
 				});
 			});
 
+			describe("unicode", {
+				it("should get correct type from multi-byte literal", {
+					TokenStateMachine sm;
+					int type = 5;
+					std::string str = "\xCE\xBB\xCE\xBB";
+					sm.addRule("\xCE\xBB+", type);
+					TokenStateMachine::Iterator iterator = sm.begin();
+					for(unsigned int i = 0; i < str.size(); i++) {
+						iterator.nextState(str[i]);
+					}
+					expect(iterator.getType(), type);
+				});
+
+				it("should get correct type from code point span", {
+					TokenStateMachine sm;
+					int type = 5;
+					std::string str = "\xCE\xB2\xE2\x82\xAC";
+					sm.addRule("[\\x{3B1}-\\x{3C9}\\x{20AC}]+", type);
+					TokenStateMachine::Iterator iterator = sm.begin();
+					for(unsigned int i = 0; i < str.size(); i++) {
+						iterator.nextState(str[i]);
+					}
+					expect(iterator.getType(), type);
+				});
+
+				it("should get correct type from category", {
+					TokenStateMachine sm;
+					int type = 5;
+					std::string str = "\xE6\x97\xA5\xE6\x9C\xAC";
+					sm.addRule("\\p{Han}+", type);
+					TokenStateMachine::Iterator iterator = sm.begin();
+					for(unsigned int i = 0; i < str.size(); i++) {
+						iterator.nextState(str[i]);
+					}
+					expect(iterator.getType(), type);
+				});
+
+				it("should match any character with '.'", {
+					TokenStateMachine sm;
+					int type = 5;
+					std::string str = "<a\xC3\xA9\xF0\x9F\x98\x80>";
+					sm.addRule("<.*>", type);
+					TokenStateMachine::Iterator iterator = sm.begin();
+					for(unsigned int i = 0; i < str.size(); i++) {
+						iterator.nextState(str[i]);
+					}
+					expect(iterator.getType(), type);
+				});
+
+				it("should exclude multi-byte characters", {
+					TokenStateMachine sm;
+					int type = 5;
+					std::string str = "a\xC3\xA9\xC3\xA8";
+					sm.addRule("[^\xC3\xA8]+", type);
+					TokenStateMachine::Iterator iterator = sm.begin();
+					for(unsigned int i = 0; i < 3; i++) {
+						iterator.nextState(str[i]);
+					}
+					expect(iterator.getType(), type);
+					iterator.nextState(str[3]);
+					iterator.nextState(str[4]);
+					expect(iterator.atEnd(), true);
+				});
+
+				it("should keep digits and punctuation out of letters", {
+					TokenStateMachine sm;
+					sm.addRule("\\p{L}+", 5);
+					sm.addRule("\\p{N}+", 6);
+					expect(matchType(sm, "\xD8\xB3\xD9\x84\xD8\xA7\xD9\x85"), 5);
+					expect(matchType(sm, "\xD9\xA3\xD9\xA4"), 6);
+					expect(matchType(sm, "\xE0\xA5\xA7"), 6);
+					expect(matchType(sm, "\xE0\xB9\x95"), 6);
+					expect(matchType(sm, "\xD7\xA9\xD7\x9C"), 5);
+					expect(matchType(sm, "\xD6\xBE"), -1);
+
+					TokenStateMachine identifiers;
+					expectNoException(identifiers.addRule("[\\p{L}_][\\p{L}\\p{N}_]*", 5));
+					expectNoException(identifiers.addRule("\\p{N}+", 6));
+					expect(matchType(identifiers, "x\xD9\xA3"), 5);
+				});
+
+				it("should throw error on unknown category", {
+					TokenStateMachine sm;
+					expectException(sm.addRule("\\p{Klingon}", 5), std::runtime_error);
+				});
+
+				it("should throw error on surrogate code point", {
+					TokenStateMachine sm;
+					expectException(sm.addRule("\\x{D800}", 5), std::runtime_error);
+				});
+			});
+
+			describe("repetition", {
+				it("should match {m}, {m,} and {m,n}", {
+					TokenStateMachine sm;
+					for(uint i = 0; i < num_repetition_rules; i++) {
+						sm.addRule(repetition_rules[i], i);
+					}
+					for(uint i = 0; i < num_repetition_matches; i++) {
+						expectNotEqual(matchType(sm, repetition_matches[i]), -1);
+					}
+					for(uint i = 0; i < num_repetition_mismatches; i++) {
+						expect(matchType(sm, repetition_mismatches[i]), -1);
+					}
+				});
+
+				it("should only add the states it needs", {
+					TokenStateMachine sm;
+					sm.addRule("a{2,4}", 5);
+					TokenStateMachine::Iterator iterator = sm.begin();
+					for(uint i = 0; i < 4; i++) {
+						iterator.nextState('a');
+					}
+					expect(iterator.getState(), 5);
+					expect(iterator.getType(), 5);
+				});
+
+				it("should treat other braces as characters", {
+					TokenStateMachine sm;
+					sm.addRule("a{b}", 5);
+					sm.addRule("c{,2}", 6);
+					sm.addRule("d\\{2}", 7);
+					expect(matchType(sm, "a{b}"), 5);
+					expect(matchType(sm, "c{,2}"), 6);
+					expect(matchType(sm, "d{2}"), 7);
+					expect(matchType(sm, "dd"), -1);
+				});
+
+				it("should throw error on invalid repetition", {
+					TokenStateMachine sm;
+					expectException(sm.addRule("a{3,2}", 5), std::runtime_error);
+					expectException(sm.addRule("a{1001}", 5), std::runtime_error);
+				});
+			});
+
+			describe("pair table", {
+				it("should step over pairs like single bytes", {
+					TokenStateMachine sm;
+					for(uint i = 0; i < num_assembly_expressions; i++) {
+						sm.addRule(assembly_expressions[i], i);
+					}
+					sm.setPairTableSize(8 << 20);
+					expect(sm.usesPairs(), true);
+					expectLesserThan(sm.byteClasses(), 64);
+					for(uint i = 0; i < num_pair_strings; i++) {
+						// every length ends a token or the text at both even and odd offsets
+						for(uint length = 1; length <= pair_strings[i].size(); length++) {
+							std::string str = pair_strings[i].substr(0, length);
+							expect(tokenEnd(sm, str, true), tokenEnd(sm, str, false));
+						}
+					}
+				});
+
+				it("should only be built when it fits", {
+					TokenStateMachine sm;
+					sm.addRule("[a-z]+", 5);
+					expect(sm.usesPairs(), true);
+					expect(sm.byteClasses(), 2);
+					sm.setPairTableSize(0);
+					expect(sm.usesPairs(), false);
+					sm.setPairTableSize(TokenStateMachine::DEFAULT_PAIR_TABLE_SIZE);
+					expect(matchType(sm, "abc"), 5);
+					expect(sm.usesPairs(), true);
+				});
+			});
+
+			it("should intersect bracket expressions", {
+				TokenStateMachine sm;
+				sm.addRule("[\\w&&[^\\d_]]+", 5);
+				sm.addRule("[\\p{L}&&\\x{80}-\\x{FF}]", 6);
+				expect(matchType(sm, "abc"), 5);
+				expect(matchType(sm, "a1"), -1);
+				expect(matchType(sm, "\xC3\xA9"), 6);
+				expect(matchType(sm, "\xCE\xBB"), -1);
+			});
+
+			it("should ignore case in rules starting with (?i)", {
+				TokenStateMachine sm;
+				sm.addRule("(?i)mov", 5);
+				sm.addRule("(?i)\\.data_[a-c]+", 6);
+				sm.addRule("(?i)'[^x]'", 7);
+				expect(matchType(sm, "mov"), 5);
+				expect(matchType(sm, "MOV"), 5);
+				expect(matchType(sm, "mOv"), 5);
+				expect(matchType(sm, ".DaTa_aBC"), 6);
+				expect(matchType(sm, "'y'"), 7);
+				expect(matchType(sm, "'X'"), -1);
+				expectException(sm.addRule("(?i)", 8), std::runtime_error);
+			});
+
+			it("should not add states or byte classes to ignore case", {
+				TokenStateMachine folded;
+				TokenStateMachine exact;
+				for(uint i = 0; i < num_keywords; i++) {
+					folded.addRule("(?i)" + keywords[i], i);
+					exact.addRule(keywords[i], i);
+				}
+				folded.addRule("(?i)#[a-z_]+", num_keywords);
+				exact.addRule("#[a-z_]+", num_keywords);
+				expect(folded.byteClasses(), exact.byteClasses());
+				expect(matchType(folded, "#Ab_C"), num_keywords);
+				for(uint i = 0; i < num_keywords; i++) {
+					std::string upper = keywords[i];
+					std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+					expect(matchType(folded, upper), i);
+					expect(tokenEnd(folded, upper, false), tokenEnd(exact, keywords[i], false));
+				}
+			});
+
+			it("should get correct type in each mode", {
+				TokenStateMachine sm;
+				uint mode = sm.addMode();
+				sm.addRule("[a-z]+", 5);
+				sm.addRule("[a-z]+9", 6, mode);
+				std::string str = "ab9";
+				TokenStateMachine::Iterator iterator = sm.begin();
+				TokenStateMachine::Iterator mode_iterator = sm.begin(mode);
+				for(unsigned int i = 0; i < str.size(); i++) {
+					iterator.nextState(str[i]);
+					mode_iterator.nextState(str[i]);
+				}
+				expect(iterator.getType(), 5);
+				expect(iterator.atEnd(), true);
+				expect(mode_iterator.getType(), 6);
+			});
+
 			it("should get correct type from or groups", {
 				TokenStateMachine sm;
 				int type = 7;
@@ -460,6 +768,39 @@ int main() {
 				}
 			});
 
+			it("should compile literal rules the same as regex rules", {
+				TokenStateMachine literal_sm;
+				TokenStateMachine regex_sm;
+				for(uint i = 0; i < num_literals; i++) {
+					literal_sm.addRule(literal_rules[i], i);
+					regex_sm.addRule("(" + literal_rules[i] + ")", i);
+				}
+
+				for(uint i = 0; i < num_literals; i++) {
+					TokenStateMachine::Iterator literal_iterator = literal_sm.begin();
+					TokenStateMachine::Iterator regex_iterator = regex_sm.begin();
+					for(uint j = 0; j < literal_tokens[i].size(); j++) {
+						literal_iterator.nextState(literal_tokens[i][j]);
+						regex_iterator.nextState(literal_tokens[i][j]);
+						expect(literal_iterator.getState(), regex_iterator.getState());
+					}
+					expect(literal_iterator.getType(), regex_iterator.getType());
+				}
+				expectException(literal_sm.addRule("int", 5), std::runtime_error);
+				expectException(literal_sm.addRule("\xC3", 5), std::runtime_error);
+			});
+
+			it("should add literals containing regex characters", {
+				TokenStateMachine sm;
+				sm.addLiteral("a+(b)", 6);
+				std::string str = "a+(b)";
+				TokenStateMachine::Iterator iterator = sm.begin();
+				for(uint i = 0; i < str.size(); i++) {
+					iterator.nextState(str[i]);
+				}
+				expect(iterator.getType(), 6);
+			});
+
 			it("should get correct types from multiple tokens with option groups", {
 				TokenStateMachine sm;
 
@@ -477,8 +818,90 @@ int main() {
 			});
 		});
 
+		describe("merge", {
+			it("should match the rules of both machines", {
+				TokenStateMachine base;
+				TokenStateMachine dialect;
+				TokenStateMachine combined;
+				for(uint i = 0; i < num_keywords; i++) {
+					base.addRule(keywords[i], i);
+					combined.addRule(keywords[i], i);
+				}
+				for(uint i = 0; i < num_int_expressions; i++) {
+					dialect.addRule(int_expressions[i], 10 + i);
+					combined.addRule(int_expressions[i], 10 + i);
+				}
+				base.merge(dialect);
+
+				for(uint i = 0; i < num_keywords; i++) {
+					for(uint length = 1; length <= keywords[i].size(); length++) {
+						expect(matchType(base, keywords[i].substr(0, length)), matchType(combined, keywords[i].substr(0, length)));
+					}
+				}
+				for(uint i = 0; i < num_int_expressions; i++) {
+					for(uint length = 1; length <= int_tokens[i].size(); length++) {
+						expect(matchType(base, int_tokens[i].substr(0, length)), matchType(combined, int_tokens[i].substr(0, length)));
+					}
+				}
+				// no larger than compiling every rule into one machine
+				size_t combined_usage = combined.memoryUsage() + 1;
+				expectLesserThan(base.memoryUsage(), combined_usage);
+			});
+
+			it("should resolve states both machines accept in by the conflict policy", {
+				TokenStateMachine words;
+				words.addRule("[a-z]+", 1);
+				TokenStateMachine keywords;
+				keywords.addRule("if", 2);
+
+				TokenStateMachine thrown = words;
+				expectException(thrown.merge(keywords), std::runtime_error);
+
+				TokenStateMachine first = words;
+				first.merge(keywords, TokenStateMachine::KEEP_FIRST);
+				expect(matchType(first, "if"), 1);
+
+				TokenStateMachine second = words;
+				second.merge(keywords, TokenStateMachine::KEEP_SECOND);
+				expect(matchType(second, "i"), 1);
+				expect(matchType(second, "if"), 2);
+				expect(matchType(second, "ifs"), 1);
+				expect(matchType(second, "iff"), 1);
+			});
+
+			it("should merge machines loaded from files and keep their modes", {
+				std::string filename = "temp_merged.txt";
+				TokenStateMachine saved;
+				uint mode = saved.addMode();
+				saved.addRule("[a-z]+", 1);
+				saved.addRule("[0-9]+", 2, mode);
+				expect(saved.saveToFile(filename), true);
+
+				TokenStateMachine loaded;
+				expect(loaded.loadFromFile(filename), true);
+				TokenStateMachine punctuation;
+				punctuation.addRule(",", 3);
+				loaded.merge(punctuation);
+				expect(loaded.modes(), 2);
+				expect(matchType(loaded, "abc"), 1);
+				expect(matchType(loaded, ","), 3);
+				expect(matchType(loaded, "12"), -1);
+
+				TokenStateMachine::Iterator iterator = loaded.begin(mode);
+				iterator.nextState('1');
+				iterator.nextState(',');
+				expect(iterator.getType(), 2);
+				expect(iterator.atEnd(), true);
+
+				// rules can still be added after merging
+				loaded.addRule(";", 4);
+				expect(matchType(loaded, ";"), 4);
+				std::remove(filename.c_str());
+			});
+		});
+
 		it("should be able to save and load", {
-			std::string filename = "temp.txt";
+			std::string filename = "temp_machine.txt";
 
 			TokenStateMachine sm;
 			for(uint i = 0; i < num_keywords; i++) {
@@ -502,6 +925,36 @@ int main() {
 					}
 				}
 			}
+			std::remove(filename.c_str());
+		});
+
+		it("should save and load whitespace transitions and modes", {
+			std::string filename = "temp_modes.txt";
+
+			TokenStateMachine sm;
+			uint mode = sm.addMode();
+			sm.addRule("[ \t\n]+", 1);
+			sm.addRule("a b", 2, mode);
+			expect(sm.saveToFile(filename), true);
+
+			TokenStateMachine sm2;
+			expect(sm2.loadFromFile(filename), true);
+			expect(sm2.modes(), 2);
+
+			std::string str = " \t\n";
+			TokenStateMachine::Iterator iterator = sm2.begin();
+			for(unsigned int i = 0; i < str.size(); i++) {
+				iterator.nextState(str[i]);
+			}
+			expect(iterator.getType(), 1);
+
+			str = "a b";
+			TokenStateMachine::Iterator mode_iterator = sm2.begin(mode);
+			for(unsigned int i = 0; i < str.size(); i++) {
+				mode_iterator.nextState(str[i]);
+			}
+			expect(mode_iterator.getType(), 2);
+			std::remove(filename.c_str());
 		});
 	});
 
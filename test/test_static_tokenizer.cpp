@@ -0,0 +1,146 @@
+#include "static_tokenizer.hpp"
+#include "tokenizer.hpp"
+#include "token_types.hpp"
+#include "token.hpp"
+#include "testing.hpp"
+#include <string>
+#include <vector>
+
+static constexpr StaticRule RULES[] = {
+	{ Tokenizer::WHITESPACE, TokenType::WHITESPACE, true },
+	{ ";[^\n]*\n?", TokenType::COMMENT, true },
+	{ Tokenizer::WORD_RULE, TokenType::WORD },
+	{ "\\.[\\w]+", TokenType::DIRECTIVE },
+	{ Tokenizer::HEX_RULE, TokenType::HEX },
+	{ Tokenizer::DECIMAL_RULE, TokenType::DECIMAL },
+	{ Tokenizer::OCTAL_RULE, TokenType::OCTAL },
+	{ Tokenizer::BINARY_RULE, TokenType::BINARY },
+	{ Tokenizer::DQ_STRING_RULE, TokenType::STRING },
+	{ "\\(", TokenType::OPEN_PAREN },
+	{ ")", TokenType::CLOSE_PAREN },
+	{ ",", TokenType::COMMA },
+	{ ":", TokenType::COLON },
+	{ "#", TokenType::HASH },
+	{ "=", TokenType::EQUALS }
+};
+
+static constexpr StaticRule UNICODE_RULES[] = {
+	{ "\\s+", TokenType::WHITESPACE, true },
+	{ "\\p{L}+", TokenType::WORD },
+	{ "\\x{2192}", TokenType::EQUALS }
+};
+
+static constexpr StaticRule FORMAT_RULES[] = {
+	{ "\\s+", TokenType::WHITESPACE, true },
+	{ "[\\w&&[^\\d_]]+", TokenType::WORD },
+	{ "#[\\h]{4}(-[\\h]{4}){1,2}", TokenType::HEX },
+	{ "[0-9]{1,3}", TokenType::DECIMAL }
+};
+
+static constexpr StaticRule CASELESS_RULES[] = {
+	{ "\\s+", TokenType::WHITESPACE, true },
+	{ "(?i)\\.[a-z]+", TokenType::DIRECTIVE },
+	{ "(?i)0x[\\h]+", TokenType::HEX },
+	{ "(?i)r[0-9]", TokenType::REGISTER },
+	{ "(?i)'[^q]'", TokenType::CHARACTER }
+};
+
+int main() {
+	const std::string text = "abc123_ .data 0x1234567890abcdef ; comment\n\
+		$1234567890abcdef -1234567890 0b10 \"Hi\n, \\tmy \xC3\xA9 string\" ()#,:= ;goodbye";
+
+	describe("static tokenizer", {
+		it("should build the table at compile time", {
+			static_assert(StaticTokenizer<RULES>::NUM_STATES > 2, "no states");
+			static_assert(StaticTokenizer<RULES>::table.types[0] == -1, "end state has a type");
+			expect(sizeof(StaticTokenizer<RULES>::State), 1);
+		});
+
+		it("should give the same tokens as a tokenizer with the same rules", {
+			Tokenizer tokenizer;
+			for(const StaticRule& rule : RULES) {
+				tokenizer.addRule(rule.rule, rule.type, rule.ignore);
+			}
+			std::vector<Token> expected_list;
+			tokenizer.tokenize(text, &expected_list);
+
+			StaticTokenizer<RULES> static_tokenizer;
+			std::vector<Token> token_list;
+			static_tokenizer.tokenize(text, &token_list);
+
+			expect(token_list.size(), expected_list.size());
+			for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+				expect(token_list[i].type, expected_list[i].type);
+				expect(token_list[i].str, expected_list[i].str);
+				expect(token_list[i].row, expected_list[i].row);
+				expect(token_list[i].column, expected_list[i].column);
+			}
+			expect(static_tokenizer.errors(), tokenizer.errors());
+		});
+
+		it("should compile repetition and intersection like a tokenizer", {
+			Tokenizer tokenizer;
+			for(const StaticRule& rule : FORMAT_RULES) {
+				tokenizer.addRule(rule.rule, rule.type, rule.ignore);
+			}
+			std::string format_text = "abc 12 #beef-0000 #cafe-f00d-1234 1234 x_";
+			std::vector<Token> expected_list;
+			tokenizer.tokenize(format_text, &expected_list);
+			expect(expected_list.size(), 8);
+
+			StaticTokenizer<FORMAT_RULES> static_tokenizer;
+			std::vector<Token> token_list;
+			static_tokenizer.tokenize(format_text, &token_list);
+			expect(token_list.size(), expected_list.size());
+			for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+				expect(token_list[i].type, expected_list[i].type);
+				expect(token_list[i].str, expected_list[i].str);
+			}
+		});
+
+		it("should ignore case like a tokenizer", {
+			Tokenizer tokenizer;
+			for(const StaticRule& rule : CASELESS_RULES) {
+				tokenizer.addRule(rule.rule, rule.type, rule.ignore);
+			}
+			std::string caseless_text = ".DATA .text 0XfF r1 R2 'a' 'Q'";
+			std::vector<Token> expected_list;
+			tokenizer.tokenize(caseless_text, &expected_list);
+			expect(expected_list.size(), 9);
+
+			StaticTokenizer<CASELESS_RULES> static_tokenizer;
+			std::vector<Token> token_list;
+			static_tokenizer.tokenize(caseless_text, &token_list);
+			expect(token_list.size(), expected_list.size());
+			for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+				expect(token_list[i].type, expected_list[i].type);
+				expect(token_list[i].str, expected_list[i].str);
+			}
+		});
+
+		it("should match unicode rules", {
+			StaticTokenizer<UNICODE_RULES> static_tokenizer;
+			std::vector<Token> token_list;
+			expect(static_tokenizer.tokenize("na\xC3\xAFve \xE2\x86\x92 \xCE\xB1\xCE\xB2 ?", &token_list), true);
+			expect(token_list.size(), 4);
+			expect(token_list[0].str, "na\xC3\xAFve");
+			expect(token_list[1].type, TokenType::EQUALS);
+			expect(token_list[2].str, "\xCE\xB1\xCE\xB2");
+			expect(token_list[2].column, 9);
+			expect(token_list[3].type, -1);
+			expect(static_tokenizer.errors(), 1);
+		});
+
+		it("should reject the UTF-8 a tokenizer rejects", {
+			StaticStateMachineBuilder<8> builder;
+			expectNoException(builder.addRule("\xC3\xA9", TokenType::WORD));
+			expectException(builder.addRule("\xE0\x80\x80", TokenType::WORD), std::logic_error);
+			expectException(builder.addRule("\xED\xA0\x80", TokenType::WORD), std::logic_error);
+			expectException(builder.addRule("\xF4\x90\x80\x80", TokenType::WORD), std::logic_error);
+		});
+	});
+
+	displayTestResults();
+
+	return failed();
+}
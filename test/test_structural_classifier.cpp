@@ -0,0 +1,115 @@
+#include <string>
+#include "structural_classifier.hpp"
+#include "token_state_machine.hpp"
+#include "testing.hpp"
+
+typedef unsigned int uint;
+
+enum Type {
+	WORD,
+	COMMA,
+	OPEN_PAREN,
+	ARROW,
+	SPACE,
+	STRING
+};
+
+void setup(TokenStateMachine& machine, uint mode = 0) {
+	machine.addRule("[a-z]+", WORD, mode);
+	machine.addRule(",", COMMA, mode);
+	machine.addRule("\\(", OPEN_PAREN, mode);
+	machine.addRule("->", ARROW, mode);
+	machine.addRule("[ \t\n]+", SPACE, mode);
+	machine.addRule("\"[^\"]*\"", STRING, mode);
+}
+
+// bit i of the mask is set for every i where str has a byte in bytes
+uint64_t expectedMask(const std::string& str, const std::string& bytes) {
+	uint64_t mask = 0;
+	for(uint i = 0; i < str.size(); i++) {
+		if (bytes.find(str[i]) != std::string::npos) mask |= (uint64_t)1 << i;
+	}
+	return mask;
+}
+
+int main() {
+	// exactly one block, a shorter one and one past the ranges SSE2 compares
+	std::string block = "abc, (def)\t\"x, y\"->\n  ghi,jkl (mno\t\t\tpqr, stu) vwx,,((\"\" ,";
+	block.resize(StructuralClassifier::BLOCK_SIZE, ' ');
+
+	describe("structural classifier", {
+		TokenStateMachine machine;
+		setup(machine);
+
+		it("should find single bytes and runs from the table", {
+			StructuralClassifier classifier(machine, 0);
+			expect(classifier.empty(), false);
+			expect(classifier.type(','), COMMA);
+			expect(classifier.type('('), OPEN_PAREN);
+			expect(classifier.type(' '), SPACE);
+
+			StructuralClassifier::Masks masks = classifier.classify(block.data(), block.size());
+			expect(masks.single, expectedMask(block, ",("));
+			expect(masks.runs[0], expectedMask(block, "abcdefghijklmnopqrstuvwxyz"));
+			expect(masks.runs[1], expectedMask(block, " \t\n"));
+			uint64_t both_runs = masks.runs[0] | masks.runs[1];
+			expect(masks.any_run, both_runs);
+		});
+
+		it("should leave bytes that start longer tokens to the state machine", {
+			StructuralClassifier classifier(machine, 0);
+			StructuralClassifier::Masks masks = classifier.classify("-\"1)", 4);
+			expect(masks.single, 0);
+			expect(masks.any_run, 0);
+		});
+
+		it("should classify a short block a byte at a time", {
+			StructuralClassifier classifier(machine, 0);
+			StructuralClassifier::Masks masks = classifier.classify(block.data(), 20);
+			expect(masks.single, expectedMask(block.substr(0, 20), ",("));
+			expect(masks.runs[1], expectedMask(block.substr(0, 20), " \t\n"));
+		});
+
+		it("should only use the rules of the mode", {
+			TokenStateMachine moded;
+			uint mode = moded.addMode();
+			setup(moded, mode);
+			moded.addRule(",,", COMMA);
+			StructuralClassifier first(moded, 0);
+			StructuralClassifier second(moded, mode);
+			expect(first.classify(",", 1).single, 0);
+			expect(second.classify(",", 1).single, 1);
+		});
+
+		it("should not make a run of bytes that lead elsewhere", {
+			TokenStateMachine mixed;
+			mixed.addRule(" +", SPACE);
+			mixed.addRule(" *\t", WORD);
+			StructuralClassifier classifier(mixed, 0);
+			expect(classifier.classify(" \t", 2).any_run, 0);
+			expect(classifier.classify(" \t", 2).single, 2);
+		});
+
+		it("should find where a token ends across blocks", {
+			StructuralClassifier classifier(machine, 0);
+			std::string text = "\"" + std::string(100, ' ') + "b,";
+			StructuralScanner scanner(text.data(), text.size());
+			int type = -1;
+			expect(scanner.token(classifier, 0, type), 0);
+			expect(scanner.token(classifier, 1, type), 100);
+			expect(type, SPACE);
+			expect(scanner.token(classifier, 101, type), 1);
+			expect(type, WORD);
+			expect(scanner.token(classifier, 102, type), 1);
+			expect(type, COMMA);
+
+			// the run may go on in the next chunk
+			StructuralScanner cut(text.data(), 50);
+			expect(cut.token(classifier, 1, type), 0);
+		});
+	});
+
+	displayTestResults();
+
+	return failed();
+}
@@ -0,0 +1,193 @@
+#include "token_file.hpp"
+#include "tokenizer.hpp"
+#include "token_types.hpp"
+#include "token.hpp"
+#include "testing.hpp"
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+void setup(Tokenizer& tokenizer);
+std::string makeFile(uint64_t count, const std::string& types, const std::string& lines,
+	const std::string& offsets, const std::string& lengths, const std::string& text);
+
+int main() {
+	std::string text = "abc123_ .data 0x1234567890abcdef ; comment\n\
+		$1234567890abcdef -1234567890 0b10 \"Hi\n, \\tmy \xC3\xA9 string\" \xC3\xA9 ()#,:= ;goodbye";
+	const std::string filename = "temp_tokens.tok";
+
+	Tokenizer tokenizer;
+	setup(tokenizer);
+	std::vector<Token> token_list;
+	tokenizer.tokenize(text, &token_list);
+
+	describe("token file", {
+		it("should save and load token text", {
+			expect(TokenFile::save(filename, token_list), true);
+			TokenFile file;
+			expect(file.open(filename), true);
+			expect(file.size(), token_list.size());
+			expect(file.textKind(), TokenFile::TOKEN_TEXT);
+
+			uint i = 0;
+			for(TokenFile::Iterator it = file.begin(); it != file.end(); ++it) {
+				if (i < token_list.size()) {
+					expect(it->type, token_list[i].type);
+					expect(std::string(it->str, it->length), token_list[i].str);
+					expect(it->row, token_list[i].row);
+					expect(it->column, token_list[i].column);
+				}
+				i++;
+			}
+			expect(i, token_list.size());
+		});
+
+		it("should store offsets into the source", {
+			expect(TokenFile::save(filename, token_list, text.data(), text.size(), TokenFile::SOURCE_TEXT), true);
+			TokenFile file;
+			expect(file.open(filename), true);
+			uint i = 0;
+			for(TokenFile::Iterator it = file.begin(); it != file.end(); ++it) {
+				if (i < token_list.size()) {
+					expect(text.compare(it->offset, it->length, token_list[i].str), 0);
+					expect(std::string(it->str, it->length), token_list[i].str);
+				}
+				i++;
+			}
+			expect(i, token_list.size());
+		});
+
+		it("should resolve a source reference", {
+			expect(TokenFile::save(filename, token_list, text.data(), text.size(),
+				TokenFile::SOURCE_REFERENCE, "input.asm"), true);
+			TokenFile file;
+			expect(file.open(filename), true);
+			expect(file.reference(), "input.asm");
+			expect(file.begin()->str == NULL, true);
+			file.setSource(text.data(), text.size());
+			expect(std::string(file.begin()->str, file.begin()->length), "abc123_");
+		});
+
+		it("should be smaller than a text dump of the tokens", {
+			std::string long_text;
+			for(uint i = 0; i < 1000; i++) {
+				long_text += "word" + std::to_string(i) + " = 0x" + std::to_string(i) + "\n";
+			}
+			std::vector<Token> long_list;
+			tokenizer.tokenize(long_text, &long_list);
+			expect(TokenFile::save(filename, long_list, long_text.data(), long_text.size(),
+				TokenFile::SOURCE_REFERENCE, "long.asm"), true);
+			std::string dump;
+			for(uint i = 0; i < long_list.size(); i++) {
+				dump += std::to_string(long_list[i].type) + ' ' + std::to_string(long_list[i].row) + ' '
+					+ std::to_string(long_list[i].column) + ' ' + long_list[i].str + '\n';
+			}
+			std::ifstream fin(filename.c_str(), std::ios::binary | std::ios::ate);
+			expectLesserThan((size_t)fin.tellg(), dump.size() / 2);
+		});
+
+		it("should not open damaged files", {
+			std::ofstream fout(filename.c_str(), std::ios::binary);
+			fout << "TOKF garbage";
+			fout.close();
+			TokenFile file;
+			expect(file.open(filename), false);
+
+			std::string data;
+			expect(TokenFile::save(filename, token_list), true);
+			std::ifstream fin(filename.c_str(), std::ios::binary);
+			data.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+			expect(file.open(data.data(), data.size()), true);
+			expect(file.open(data.data(), data.size() - 1), false);
+		});
+
+		it("should not open files with bad varints or counts", {
+			TokenFile file;
+			std::string zero(1, '\x00');
+			std::string zeros(2, '\x00');
+			std::string longest = makeFile(1, std::string(9, '\x80') + '\x01', zeros, zero, zero, "");
+			expect(file.open(longest.data(), longest.size()), true);
+			std::string too_long = makeFile(1, std::string(10, '\x80') + '\x01', zeros, zero, zero, "");
+			expect(file.open(too_long.data(), too_long.size()), false);
+			std::string too_large = makeFile(1, std::string(9, '\x80') + '\x02', zeros, zero, zero, "");
+			expect(file.open(too_large.data(), too_large.size()), false);
+
+			std::string huge_count = makeFile(1ull << 63, "", "", "", "", "");
+			expect(file.open(huge_count.data(), huge_count.size()), false);
+
+			// the second offset is the largest signed delta
+			std::string far_offset = makeFile(2, zeros, std::string(4, '\x00'),
+				std::string("\x00\xFE", 2) + std::string(8, '\xFF') + '\x01', std::string("\x03\x00", 2), "abc");
+			expect(file.open(far_offset.data(), far_offset.size()), false);
+		});
+
+		it("should find offsets after a lone continuation byte", {
+			Tokenizer letters;
+			letters.addRule("a", TokenType::WORD);
+			std::string source = "\x80" "a";
+			std::vector<Token> tokens;
+			letters.tokenize(source, &tokens);
+			expect(tokens.size(), 2);
+			expect(TokenFile::save(filename, tokens, source.data(), source.size(), TokenFile::SOURCE_TEXT), true);
+			TokenFile file;
+			expect(file.open(filename), true);
+			TokenFile::Iterator it = file.begin();
+			expect(it->offset, 0);
+			++it;
+			expect(it->offset, 1);
+			expect(std::string(it->str, it->length), "a");
+		});
+	});
+
+	std::remove(filename.c_str());
+
+	displayTestResults();
+
+	return failed();
+}
+
+void setup(Tokenizer& tokenizer) {
+	tokenizer.addRule(Tokenizer::WHITESPACE, TokenType::WHITESPACE, true);
+	tokenizer.addRule(";[^\n]*\n?", TokenType::COMMENT, true);
+	tokenizer.addRule(Tokenizer::WORD_RULE, TokenType::WORD);
+	tokenizer.addRule("\\.[\\w]+", TokenType::DIRECTIVE);
+	tokenizer.addRule(Tokenizer::HEX_RULE, TokenType::HEX);
+	tokenizer.addRule(Tokenizer::DECIMAL_RULE, TokenType::DECIMAL);
+	tokenizer.addRule(Tokenizer::OCTAL_RULE, TokenType::OCTAL);
+	tokenizer.addRule(Tokenizer::BINARY_RULE, TokenType::BINARY);
+	tokenizer.addRule(Tokenizer::DQ_STRING_RULE, TokenType::STRING);
+	tokenizer.addRule("\\(", TokenType::OPEN_PAREN);
+	tokenizer.addRule(")", TokenType::CLOSE_PAREN);
+	tokenizer.addRule(",", TokenType::COMMA);
+	tokenizer.addRule(":", TokenType::COLON);
+	tokenizer.addRule("#", TokenType::HASH);
+	tokenizer.addRule("=", TokenType::EQUALS);
+}
+
+static void putU32(std::string& out, uint32_t value) {
+	for(uint i = 0; i < 4; i++) out += (char)(value >> (8 * i));
+}
+
+static void putU64(std::string& out, uint64_t value) {
+	for(uint i = 0; i < 8; i++) out += (char)(value >> (8 * i));
+}
+
+// builds a token text file from raw sections
+std::string makeFile(uint64_t count, const std::string& types, const std::string& lines,
+		const std::string& offsets, const std::string& lengths, const std::string& text) {
+	const std::string* sections[] = { &types, &lines, &offsets, &lengths, &text };
+	std::string data = "TOKF";
+	putU32(data, TokenFile::VERSION);
+	putU32(data, TokenFile::TOKEN_TEXT);
+	putU32(data, 0);
+	putU64(data, count);
+	uint64_t offset = 24 + 5 * 16;
+	for(uint i = 0; i < 5; i++) {
+		putU64(data, offset);
+		putU64(data, sections[i]->size());
+		offset += sections[i]->size();
+	}
+	for(uint i = 0; i < 5; i++) data += *sections[i];
+	return data;
+}
@@ -0,0 +1,214 @@
+#include "token_generator.hpp"
+#include "tokenizer.hpp"
+#include "token_types.hpp"
+#include "token.hpp"
+#include "testing.hpp"
+#include <coroutine>
+#include <deque>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// source that suspends on every read until the event loop resumes it
+class ChunkedSource {
+public:
+	ChunkedSource(const std::string& text, size_t chunk_size, std::deque<std::coroutine_handle<>>* pending)
+		: text(text), chunk_size(chunk_size), offset(0), pending(pending) {}
+
+	class ReadAwaiter {
+	public:
+		ReadAwaiter(ChunkedSource* source, char* buffer, size_t size)
+			: source(source), buffer(buffer), size(size) {}
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle) { source->pending->push_back(handle); }
+		size_t await_resume() {
+			size_t count = source->text.size() - source->offset;
+			if (count > source->chunk_size) count = source->chunk_size;
+			if (count > size) count = size;
+			source->text.copy(buffer, count, source->offset);
+			source->offset += count;
+			return count;
+		}
+
+	private:
+		ChunkedSource* source;
+		char* buffer;
+		size_t size;
+	};
+
+	ReadAwaiter read(char* buffer, size_t size) { return ReadAwaiter(this, buffer, size); }
+
+private:
+	std::string text;
+	size_t chunk_size;
+	size_t offset;
+	std::deque<std::coroutine_handle<>>* pending;
+};
+
+struct Task {
+	struct promise_type {
+		Task get_return_object() { return Task(); }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+Task collect(Tokenizer& tokenizer, ChunkedSource& source, std::vector<Token>* token_list, bool* done) {
+	AsyncGenerator<Token> tokens = tokenizeAsync(tokenizer, source, 16);
+	while(const Token* token = co_await tokens.next()) {
+		token_list->push_back(*token);
+	}
+	*done = true;
+}
+
+void setup(Tokenizer& tokenizer);
+
+int main() {
+	const std::string text = "abc123_ .data 0x1234567890abcdef ; comment\n\
+		$1234567890abcdef -1234567890 0b10 \"Hi\n, \\tmy \xC3\xA9 string\" ()#,:= ;goodbye";
+
+	describe("token generator", {
+		it("should yield the same tokens as tokenize()", {
+			Tokenizer tokenizer;
+			setup(tokenizer);
+			std::vector<Token> expected_list;
+			tokenizer.tokenize(text, &expected_list);
+
+			std::vector<Token> token_list;
+			for(const Token& token : tokens(tokenizer, text.data(), text.size())) {
+				token_list.push_back(token);
+			}
+			expect(token_list.size(), expected_list.size());
+			for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+				expect(token_list[i].str, expected_list[i].str);
+			}
+		});
+
+		it("should yield tokens from a stream", {
+			Tokenizer tokenizer;
+			setup(tokenizer);
+			std::stringstream ss(text);
+			uint count = 0;
+			for(const Token& token : tokens(tokenizer, ss)) {
+				if (count == 0) expect(token.str, "abc123_");
+				count++;
+			}
+			expect(count, 13);
+			expect(tokenizer.errors(), 0);
+		});
+
+		it("should start over after a generator is dropped", {
+			Tokenizer tokenizer;
+			setup(tokenizer);
+			std::vector<Token> expected_list;
+			tokenizer.tokenize(text, &expected_list);
+
+			std::stringstream ss(text);
+			for(const Token& token : tokens(tokenizer, ss)) {
+				expect(token.str, "abc123_");
+				break;
+			}
+
+			std::vector<Token> token_list;
+			for(const Token& token : tokens(tokenizer, text.data(), text.size())) {
+				token_list.push_back(token);
+			}
+			expect(tokenizer.errors(), 0);
+			expect(token_list.size(), expected_list.size());
+			for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+				expect(token_list[i].str, expected_list[i].str);
+				expect(token_list[i].row, expected_list[i].row);
+				expect(token_list[i].column, expected_list[i].column);
+			}
+		});
+
+		it("should resume chunks stopped by a limit", {
+			Tokenizer tokenizer;
+			setup(tokenizer);
+			std::vector<Token> expected_list;
+			tokenizer.tokenize(text, &expected_list);
+			tokenizer.setMaxTokens(2);
+
+			uint count = 0;
+			for(const Token& token : tokens(tokenizer, text.data(), text.size())) {
+				if (count < expected_list.size()) expect(token.str, expected_list[count].str);
+				count++;
+			}
+			expect(count, expected_list.size());
+
+			std::stringstream ss(text);
+			count = 0;
+			for(const Token& token : tokens(tokenizer, ss)) {
+				if (count < expected_list.size()) expect(token.str, expected_list[count].str);
+				count++;
+			}
+			expect(count, expected_list.size());
+
+			std::deque<std::coroutine_handle<>> pending;
+			ChunkedSource source(text, 40, &pending);
+			std::vector<Token> token_list;
+			bool done = false;
+			collect(tokenizer, source, &token_list, &done);
+			while(!pending.empty()) {
+				std::coroutine_handle<> handle = pending.front();
+				pending.pop_front();
+				handle.resume();
+			}
+			expect(done, true);
+			expect(token_list.size(), expected_list.size());
+		});
+
+		it("should suspend while the source has no data", {
+			Tokenizer tokenizer;
+			setup(tokenizer);
+			std::vector<Token> expected_list;
+			tokenizer.tokenize(text, &expected_list);
+
+			std::deque<std::coroutine_handle<>> pending;
+			ChunkedSource source(text, 5, &pending);
+			std::vector<Token> token_list;
+			bool done = false;
+			collect(tokenizer, source, &token_list, &done);
+
+			uint suspensions = 0;
+			while(!pending.empty()) {
+				std::coroutine_handle<> handle = pending.front();
+				pending.pop_front();
+				suspensions++;
+				handle.resume();
+			}
+
+			expect(done, true);
+			expectGreaterThan(suspensions, text.size() / 5);
+			expect(token_list.size(), expected_list.size());
+			for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+				expect(token_list[i].str, expected_list[i].str);
+				expect(token_list[i].column, expected_list[i].column);
+			}
+		});
+	});
+
+	displayTestResults();
+
+	return failed();
+}
+
+void setup(Tokenizer& tokenizer) {
+	tokenizer.addRule(Tokenizer::WHITESPACE, TokenType::WHITESPACE, true);
+	tokenizer.addRule(";[^\n]*\n?", TokenType::COMMENT, true);
+	tokenizer.addRule(Tokenizer::WORD_RULE, TokenType::WORD);
+	tokenizer.addRule("\\.[\\w]+", TokenType::DIRECTIVE);
+	tokenizer.addRule(Tokenizer::HEX_RULE, TokenType::HEX);
+	tokenizer.addRule(Tokenizer::DECIMAL_RULE, TokenType::DECIMAL);
+	tokenizer.addRule(Tokenizer::OCTAL_RULE, TokenType::OCTAL);
+	tokenizer.addRule(Tokenizer::BINARY_RULE, TokenType::BINARY);
+	tokenizer.addRule(Tokenizer::DQ_STRING_RULE, TokenType::STRING);
+	tokenizer.addRule("\\(", TokenType::OPEN_PAREN);
+	tokenizer.addRule(")", TokenType::CLOSE_PAREN);
+	tokenizer.addRule(",", TokenType::COMMA);
+	tokenizer.addRule(":", TokenType::COLON);
+	tokenizer.addRule("#", TokenType::HASH);
+	tokenizer.addRule("=", TokenType::EQUALS);
+}
@@ -0,0 +1,127 @@
+#include "token_lookahead.hpp"
+#include "tokenizer.hpp"
+#include "token_types.hpp"
+#include "token.hpp"
+#include "testing.hpp"
+#include <sstream>
+#include <string>
+#include <vector>
+
+void setup(Tokenizer& tokenizer);
+
+int main() {
+	std::string text = "abc123_ .data 0x1234567890abcdef ; comment\n\
+		$1234567890abcdef -1234567890 0b10 \"Hi\n, \\tmy \xC3\xA9 string\" ()#,:= ;goodbye";
+
+	// long enough to need several chunks
+	std::string long_text;
+	for(uint i = 0; i < 1000; i++) {
+		long_text += "word" + std::to_string(i) + " = 0x" + std::to_string(i) + ",\n";
+	}
+
+	describe("token lookahead", {
+		Tokenizer tokenizer;
+		setup(tokenizer);
+
+		it("should consume the same tokens as tokenize()", {
+			std::vector<Token> expected_list;
+			tokenizer.tokenize(long_text, &expected_list);
+
+			TokenLookahead lookahead(tokenizer, long_text.data(), long_text.size(), 4);
+			uint i = 0;
+			while(const Token* token = lookahead.peek()) {
+				if (i < expected_list.size()) {
+					expect(token->str, expected_list[i].str);
+					expect(token->row, expected_list[i].row);
+				}
+				expect(lookahead.consume(), true);
+				i++;
+			}
+			expect(i, expected_list.size());
+			expect(lookahead.consume(), false);
+			expect(lookahead.atEnd(), true);
+		});
+
+		it("should resume chunks stopped by a limit", {
+			std::vector<Token> expected_list;
+			tokenizer.tokenize(long_text, &expected_list);
+
+			Tokenizer limited;
+			setup(limited);
+			limited.setMaxTokens(3);
+			std::stringstream ss(long_text);
+			TokenLookahead lookahead(limited, &ss, 4);
+			uint i = 0;
+			while(const Token* token = lookahead.peek()) {
+				if (i < expected_list.size()) expect(token->str, expected_list[i].str);
+				lookahead.consume();
+				i++;
+			}
+			expect(i, expected_list.size());
+
+			limited.setMaxTokens(0);
+			limited.setMemoryBudget(200);
+			TokenLookahead from_memory(limited, long_text.data(), long_text.size(), 4);
+			i = 0;
+			while(from_memory.consume()) i++;
+			expect(i, expected_list.size());
+		});
+
+		it("should peek ahead without consuming", {
+			std::stringstream ss(text);
+			TokenLookahead lookahead(tokenizer, &ss, 3);
+			expect(lookahead.peek(2)->str, "0x1234567890abcdef");
+			expect(lookahead.peek(0)->str, "abc123_");
+			expect(lookahead.peek(1)->type, TokenType::DIRECTIVE);
+			lookahead.consume();
+			expect(lookahead.peek()->str, ".data");
+			expect(lookahead.position(), 1);
+			expectException(lookahead.peek(3), std::runtime_error);
+		});
+
+		it("should return NULL past the end", {
+			TokenLookahead lookahead(tokenizer, "a b", 3, 4);
+			expect(lookahead.peek(1)->str, "b");
+			expect(lookahead.peek(2) == NULL, true);
+			TokenLookahead empty(tokenizer, "", 0);
+			expect(empty.atEnd(), true);
+		});
+
+		it("should rewind to a mark in the window", {
+			TokenLookahead lookahead(tokenizer, long_text.data(), long_text.size(), 4);
+			lookahead.consume();
+			size_t mark = lookahead.mark();
+			lookahead.consume();
+			lookahead.consume();
+			expect(lookahead.peek()->str, ",");
+			lookahead.rewind(mark);
+			expect(lookahead.peek()->str, "=");
+
+			for(uint i = 0; i < 5; i++) lookahead.consume();
+			lookahead.peek(3);
+			expectException(lookahead.rewind(mark), std::runtime_error);
+		});
+	});
+
+	displayTestResults();
+
+	return failed();
+}
+
+void setup(Tokenizer& tokenizer) {
+	tokenizer.addRule(Tokenizer::WHITESPACE, TokenType::WHITESPACE, true);
+	tokenizer.addRule(";[^\n]*\n?", TokenType::COMMENT, true);
+	tokenizer.addRule(Tokenizer::WORD_RULE, TokenType::WORD);
+	tokenizer.addRule("\\.[\\w]+", TokenType::DIRECTIVE);
+	tokenizer.addRule(Tokenizer::HEX_RULE, TokenType::HEX);
+	tokenizer.addRule(Tokenizer::DECIMAL_RULE, TokenType::DECIMAL);
+	tokenizer.addRule(Tokenizer::OCTAL_RULE, TokenType::OCTAL);
+	tokenizer.addRule(Tokenizer::BINARY_RULE, TokenType::BINARY);
+	tokenizer.addRule(Tokenizer::DQ_STRING_RULE, TokenType::STRING);
+	tokenizer.addRule("\\(", TokenType::OPEN_PAREN);
+	tokenizer.addRule(")", TokenType::CLOSE_PAREN);
+	tokenizer.addRule(",", TokenType::COMMA);
+	tokenizer.addRule(":", TokenType::COLON);
+	tokenizer.addRule("#", TokenType::HASH);
+	tokenizer.addRule("=", TokenType::EQUALS);
+}
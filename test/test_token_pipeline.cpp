@@ -0,0 +1,173 @@
+#include "token_pipeline.hpp"
+#include "tokenizer.hpp"
+#include "token_types.hpp"
+#include "token.hpp"
+#include "testing.hpp"
+#include <chrono>
+#include <ctime>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+void setup(Tokenizer& tokenizer);
+
+// gives some text and then fails, like a broken connection
+class FailingBuffer : public std::streambuf {
+public:
+	explicit FailingBuffer(const std::string& text) : text(text), served(false) {}
+
+protected:
+	int_type underflow() {
+		if (served) throw std::runtime_error("connection lost");
+		served = true;
+		setg(&text[0], &text[0], &text[0] + text.size());
+		return traits_type::to_int_type(text[0]);
+	}
+
+private:
+	std::string text;
+	bool served;
+};
+
+// gives its text after a delay, like a slow connection
+class SlowBuffer : public std::streambuf {
+public:
+	explicit SlowBuffer(const std::string& text) : text(text), served(false) {}
+
+protected:
+	int_type underflow() {
+		if (served) return traits_type::eof();
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		served = true;
+		setg(&text[0], &text[0], &text[0] + text.size());
+		return traits_type::to_int_type(text[0]);
+	}
+
+private:
+	std::string text;
+	bool served;
+};
+
+int main() {
+	std::string text;
+	for(uint i = 0; i < 5000; i++) {
+		text += "word" + std::to_string(i) + " = 0x" + std::to_string(i) + " \"a string\" \xC3\xA9,\n";
+	}
+
+	describe("token pipeline", {
+		Tokenizer tokenizer;
+		setup(tokenizer);
+		std::vector<Token> expected_list;
+		tokenizer.tokenize(text, &expected_list);
+		uint expected_errors = tokenizer.errors();
+
+		it("should hand over the tokens of tokenize() in full batches", {
+			std::stringstream ss(text);
+			TokenPipeline pipeline(tokenizer, &ss, 128, 4);
+			std::vector<Token> token_list;
+			uint short_batches = 0;
+			while(const TokenBuffer* batch = pipeline.next()) {
+				if (batch->size() != 128) short_batches++;
+				for(const Token& token : *batch) {
+					token_list.push_back(token);
+				}
+			}
+			expect(short_batches, 1);
+			expect(pipeline.errors(), expected_errors);
+			expect(token_list.size(), expected_list.size());
+			for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+				expect(token_list[i].str, expected_list[i].str);
+				expect(token_list[i].type, expected_list[i].type);
+				expect(token_list[i].row, expected_list[i].row);
+				expect(token_list[i].column, expected_list[i].column);
+			}
+			expect(pipeline.next() == NULL, true);
+		});
+
+		it("should wait for the caller when the ring is full", {
+			TokenPipeline pipeline(tokenizer, text.data(), text.size(), 10, 3);
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			expect(pipeline.queued(), 3);
+			size_t tokens = 0;
+			while(const TokenBuffer* batch = pipeline.next()) {
+				expectLesserThan(pipeline.queued(), 4);
+				tokens += batch->size();
+			}
+			expect(tokens, expected_list.size());
+		});
+
+		it("should sleep instead of spinning while it waits", {
+			SlowBuffer buffer(text);
+			std::istream stream(&buffer);
+			std::clock_t start = std::clock();
+			TokenPipeline pipeline(tokenizer, &stream, 10, 3);
+			expect(pipeline.next()->size(), 10);
+			expectLesserThan(std::clock() - start, CLOCKS_PER_SEC / 10);
+
+			// the lexing thread waits on a full ring
+			start = std::clock();
+			std::this_thread::sleep_for(std::chrono::milliseconds(200));
+			expect(pipeline.queued(), 3);
+			expectLesserThan(std::clock() - start, CLOCKS_PER_SEC / 10);
+
+			size_t tokens = 10;
+			while(const TokenBuffer* batch = pipeline.next()) {
+				tokens += batch->size();
+			}
+			expect(tokens, expected_list.size());
+		});
+
+		it("should rethrow an error from the lexing thread", {
+			FailingBuffer buffer(text.substr(0, 10000));
+			std::istream stream(&buffer);
+			stream.exceptions(std::ios::badbit);
+			TokenPipeline pipeline(tokenizer, &stream, 10, 2);
+			size_t tokens = 0;
+			try {
+				while(const TokenBuffer* batch = pipeline.next()) {
+					tokens += batch->size();
+				}
+				expect(true, false);
+			} catch (std::runtime_error& e) {
+				expect(std::string(e.what()), "connection lost");
+			}
+			expectGreaterThan(tokens, 0);
+		});
+
+		it("should refuse a tokenizer with limits", {
+			Tokenizer limited;
+			setup(limited);
+			limited.setMaxTokens(5);
+			expectException(TokenPipeline(limited, text.data(), text.size()), std::runtime_error);
+			limited.setMaxTokens(0);
+			limited.setMemoryBudget(1000);
+			std::stringstream ss(text);
+			expectException(TokenPipeline(limited, &ss), std::runtime_error);
+			limited.setMemoryBudget(0);
+			TokenPipeline pipeline(limited, text.data(), text.size(), 10, 2);
+			expect(pipeline.next()->size(), 10);
+		});
+
+		it("should stop the lexing thread when destroyed early", {
+			TokenPipeline pipeline(tokenizer, text.data(), text.size(), 10, 2);
+			expect(pipeline.next()->size(), 10);
+		});
+	});
+
+	displayTestResults();
+
+	return failed();
+}
+
+void setup(Tokenizer& tokenizer) {
+	tokenizer.addRule(Tokenizer::WHITESPACE, TokenType::WHITESPACE, true);
+	tokenizer.addRule(Tokenizer::WORD_RULE, TokenType::WORD);
+	tokenizer.addRule(Tokenizer::HEX_RULE, TokenType::HEX);
+	tokenizer.addRule(Tokenizer::DECIMAL_RULE, TokenType::DECIMAL);
+	tokenizer.addRule(Tokenizer::DQ_STRING_RULE, TokenType::STRING);
+	tokenizer.addRule(",", TokenType::COMMA);
+	tokenizer.addRule("=", TokenType::EQUALS);
+}
@@ -3,9 +3,17 @@
 #include "token.hpp"
 #include "testing.hpp"
 #include <fstream>
+#include <sstream>
 #include <iostream>
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <new>
+#include <cstdlib>
+#include <type_traits>
+#include <cstdio>
 
 #define testSingleToken(message, token_str, token_type, num_errors)\
 {\
@@ -20,7 +28,40 @@
 	});\
 }
 
+// counts allocations so tests can check that a call makes none
+size_t num_allocations = 0;
+
+void* operator new(size_t size) {
+	num_allocations++;
+	void* memory = std::malloc(size > 0 ? size : 1);
+	if (memory == NULL) throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void* memory) noexcept {
+	std::free(memory);
+}
+
+// keeps everything a tokenizer gives its segment sink
+struct SegmentRecorder {
+	std::vector<Tokenizer::SegmentPart> parts;
+	std::vector<int> types;
+	std::vector<const char*> begins;
+	std::string text;
+	size_t longest = 0;
+
+	void operator()(Tokenizer::SegmentPart part, int type, const char* begin, const char* end, uint, uint) {
+		parts.push_back(part);
+		types.push_back(type);
+		begins.push_back(begin);
+		text.append(begin, end);
+		longest = std::max<size_t>(longest, end - begin);
+	}
+};
+
 void setup(Tokenizer& tokenizer);
+uint setupQuoted(Tokenizer& tokenizer);
+void tokenizeRepeatedly(TokenizerMetrics* metrics, const std::string* str, uint times);
 
 int main() {
 	Tokenizer tokenizer;
@@ -148,6 +189,827 @@ int main() {
 			expect(token_list.size(), 0);
 		});
 
+		it("should parse empty string", {
+			std::vector<Token> token_list;
+			tokenizer.tokenize("", &token_list);
+			expect(tokenizer.errors(), 0);
+			expect(token_list.size(), 0);
+		});
+
+		describe("utf-8", {
+			testSingleToken("should parse string with multi-byte characters",
+				"\"gr\xC3\xBC\xC3\x9F \xE4\xB8\x96\xE7\x95\x8C \xF0\x9F\x98\x80\"", TokenType::STRING, 0);
+
+			it("should ignore comment with multi-byte characters", {
+				std::vector<Token> token_list;
+				std::string str = "; \xD0\xBF\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82\nfoo";
+				tokenizer.tokenize(str, &token_list);
+				expect(tokenizer.errors(), 0);
+				expect(token_list.size(), 1);
+				expect(token_list[0].row, 2);
+			});
+
+			it("should parse unmatched character as one invalid token", {
+				std::vector<Token> token_list;
+				std::string str = "\xE2\x82\xAC foo";
+				tokenizer.tokenize(str, &token_list);
+				expect(tokenizer.errors(), 1);
+				expect(token_list.size(), 2);
+				expect(token_list[0].str, "\xE2\x82\xAC");
+				expect(token_list[1].column, 3);
+			});
+
+			it("should count columns in characters", {
+				Tokenizer unicode_tokenizer;
+				unicode_tokenizer.addRule("[\\p{L}_][\\p{L}\\d_]*", TokenType::WORD);
+				unicode_tokenizer.addRule(Tokenizer::WHITESPACE, TokenType::WHITESPACE, true);
+				std::vector<Token> token_list;
+				std::string str = "\xCE\xB1\xCE\xB2\xCE\xB3 stra\xC3\x9F" "e \xE6\x97\xA5\xE6\x9C\xAC";
+				unicode_tokenizer.tokenize(str, &token_list);
+				expect(unicode_tokenizer.errors(), 0);
+				expect(token_list.size(), 3);
+				expect(token_list[1].str, "stra\xC3\x9F" "e");
+				expect(token_list[1].column, 5);
+				expect(token_list[2].column, 12);
+			});
+
+			it("should count new lines inside long ASCII runs", {
+				Tokenizer unicode_tokenizer;
+				unicode_tokenizer.addRule("[\\p{L}_][\\p{L}\\d_]*", TokenType::WORD);
+				unicode_tokenizer.addRule(Tokenizer::WHITESPACE, TokenType::WHITESPACE, true);
+				std::vector<Token> token_list;
+				std::string str = "\xCE\xB1                    \n   \n                     foo \xCE\xB2\n bar";
+				unicode_tokenizer.tokenize(str, &token_list);
+				expect(unicode_tokenizer.errors(), 0);
+				expect(token_list.size(), 4);
+				expect(token_list[1].row, 3);
+				expect(token_list[1].column, 22);
+				expect(token_list[2].column, 26);
+				expect(token_list[3].row, 4);
+				expect(token_list[3].column, 2);
+			});
+
+			it("should parse multi-byte characters from a stream", {
+				std::vector<Token> token_list;
+				std::stringstream ss("\xE2\x82\xAC \"\xC3\xA9\" foo");
+				tokenizer.tokenize(&ss, &token_list);
+				expect(tokenizer.errors(), 1);
+				expect(token_list.size(), 3);
+				expect(token_list[1].type, TokenType::STRING);
+				expect(token_list[2].column, 7);
+			});
+		});
+
+		describe("modes", {
+			const int QUOTE = 100;
+			const int TEXT = 101;
+			const int OPEN_EMBED = 102;
+			const int CLOSE_EMBED = 103;
+
+			Tokenizer mode_tokenizer;
+			uint string_mode = mode_tokenizer.addMode("string");
+			uint embed_mode = mode_tokenizer.addMode("embed");
+			mode_tokenizer.addRule(Tokenizer::WORD_RULE, TokenType::WORD);
+			mode_tokenizer.addRule(Tokenizer::WHITESPACE, TokenType::WHITESPACE, true);
+			mode_tokenizer.addRule("\"", QUOTE);
+			mode_tokenizer.addRule(string_mode, "[^\"$]+", TEXT);
+			mode_tokenizer.addRule(string_mode, "\"", QUOTE);
+			mode_tokenizer.addRule(string_mode, "${", OPEN_EMBED);
+			mode_tokenizer.addRule(embed_mode, Tokenizer::WORD_RULE, TokenType::WORD);
+			mode_tokenizer.addRule(embed_mode, "}", CLOSE_EMBED);
+			mode_tokenizer.addModeChange(Tokenizer::DEFAULT_MODE, QUOTE, Tokenizer::PUSH_MODE, string_mode);
+			mode_tokenizer.addModeChange(string_mode, QUOTE, Tokenizer::POP_MODE);
+			mode_tokenizer.addModeChange(string_mode, OPEN_EMBED, Tokenizer::PUSH_MODE, embed_mode);
+			mode_tokenizer.addModeChange(embed_mode, CLOSE_EMBED, Tokenizer::POP_MODE);
+
+			it("should find modes by name", {
+				expect(mode_tokenizer.getMode("string"), string_mode);
+				expect(mode_tokenizer.getMode("default"), Tokenizer::DEFAULT_MODE);
+				expectException(mode_tokenizer.getMode("nope"), std::runtime_error);
+			});
+
+			it("should tokenize text in each mode", {
+				std::vector<Token> token_list;
+				std::string str = "say \"hi ${name}!\" done";
+				mode_tokenizer.tokenize(str, &token_list);
+				expect(mode_tokenizer.errors(), 0);
+				expect(token_list.size(), 9);
+				expect(token_list[2].type, TEXT);
+				expect(token_list[2].str, "hi ");
+				expect(token_list[4].type, TokenType::WORD);
+				expect(token_list[6].str, "!");
+				expect(token_list[8].str, "done");
+				expect(mode_tokenizer.mode(), Tokenizer::DEFAULT_MODE);
+			});
+
+			it("should stay in mode at end of text", {
+				std::vector<Token> token_list;
+				mode_tokenizer.tokenize("\"open", &token_list);
+				expect(mode_tokenizer.mode(), string_mode);
+			});
+		});
+
+		it("should add literals", {
+			Tokenizer literal_tokenizer;
+			literal_tokenizer.addRule(Tokenizer::WHITESPACE, TokenType::WHITESPACE, true);
+			literal_tokenizer.addLiteral("(*", TokenType::OPEN_PAREN);
+			literal_tokenizer.addLiteral("*)", TokenType::CLOSE_PAREN);
+			literal_tokenizer.addLiteral("a.b", TokenType::WORD);
+			std::vector<Token> token_list;
+			literal_tokenizer.tokenize("(* a.b *) axb", &token_list);
+			expect(token_list.size(), 6);
+			expect(token_list[0].type, TokenType::OPEN_PAREN);
+			expect(token_list[1].str, "a.b");
+			expect(token_list[2].type, TokenType::CLOSE_PAREN);
+			expect(literal_tokenizer.errors(), 3);
+		});
+
+		describe("feed()", {
+			std::string str = " \t\vabc123_ .data 0x1234567890abcdef \
+				; hello this is a comment\n\
+				$1234567890abcdef -1234567890 0b10 \"Hi\n\
+				, \\tmy \\\\fellow \xC3\xA9\" \xE2\x82\xAC ()#,:= ;goodbye";
+
+			it("should parse the same tokens in any chunk size", {
+				std::vector<Token> expected_list;
+				tokenizer.tokenize(str, &expected_list);
+				uint expected_errors = tokenizer.errors();
+
+				for(uint chunk_size = 1; chunk_size < 8; chunk_size++) {
+					std::vector<Token> token_list;
+					for(uint i = 0; i < str.size(); i += chunk_size) {
+						uint size = std::min<uint>(chunk_size, str.size() - i);
+						tokenizer.feed(str.data() + i, size, &token_list);
+					}
+					tokenizer.finish(&token_list);
+					expect(tokenizer.errors(), expected_errors);
+					expect(token_list.size(), expected_list.size());
+					for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+						expect(token_list[i].str, expected_list[i].str);
+						expect(token_list[i].type, expected_list[i].type);
+						expect(token_list[i].row, expected_list[i].row);
+						expect(token_list[i].column, expected_list[i].column);
+					}
+				}
+			});
+
+			it("should only add complete tokens", {
+				std::vector<Token> token_list;
+				tokenizer.feed("foo ba", 6, &token_list);
+				expect(token_list.size(), 1);
+				tokenizer.feed("r", 1, &token_list);
+				expect(token_list.size(), 1);
+				tokenizer.finish(&token_list);
+				expect(token_list.size(), 2);
+				expect(token_list[1].str, "bar");
+			});
+
+			it("should continue a token in a copy of the tokenizer", {
+				std::vector<Token> expected_list;
+				tokenizer.tokenize(str, &expected_list);
+
+				for(uint lazy = 0; lazy < 2; lazy++) {
+					Tokenizer* first = new Tokenizer();
+					if (lazy) first->useLazyMachine();
+					setup(*first);
+					std::vector<Token> token_list;
+					first->feed(str.data(), 6, &token_list);
+					Tokenizer copied(*first);
+					Tokenizer second;
+					second = *first;
+					delete first;
+
+					std::vector<Token> copied_list = token_list;
+					copied.feed(str.data() + 6, str.size() - 6, &copied_list);
+					copied.finish(&copied_list);
+					second.feed(str.data() + 6, str.size() - 6, &token_list);
+					second.finish(&token_list);
+					expect(token_list.size(), expected_list.size());
+					expect(copied_list.size(), expected_list.size());
+					for(uint i = 0; i < token_list.size() && i < expected_list.size() && i < copied_list.size(); i++) {
+						expect(token_list[i].str, expected_list[i].str);
+						expect(copied_list[i].str, expected_list[i].str);
+						expect(copied_list[i].type, expected_list[i].type);
+					}
+				}
+			});
+		});
+
+		describe("rule cache", {
+			it("should store compiled rules and load them again", {
+				Tokenizer first;
+				first.setCacheDirectory(".");
+				setup(first);
+				std::string filename = "./" + first.cacheKey() + ".tsm";
+				std::remove(filename.c_str());
+
+				std::vector<Token> expected_list;
+				first.tokenize("foo 0x12 \"bar\" ; comment\n(#)", &expected_list);
+				std::ifstream fin(filename.c_str());
+				expect(fin.is_open(), true);
+				fin.close();
+
+				Tokenizer second;
+				second.setCacheDirectory(".");
+				setup(second);
+				expect(second.cacheKey(), first.cacheKey());
+				std::vector<Token> token_list;
+				second.tokenize("foo 0x12 \"bar\" ; comment\n(#)", &token_list);
+				expect(second.errors(), 0);
+				expect(token_list.size(), expected_list.size());
+				for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+					expect(token_list[i].type, expected_list[i].type);
+				}
+				std::remove(filename.c_str());
+			});
+
+			it("should use a different key for different rules", {
+				Tokenizer first;
+				first.setCacheDirectory(".");
+				first.addRule("[a-z]+", 1);
+				Tokenizer second;
+				second.setCacheDirectory(".");
+				second.addRule("[a-z]+", 1, true);
+				expectNotEqual(first.cacheKey(), second.cacheKey());
+			});
+
+			it("should recompile a damaged cache file", {
+				Tokenizer first;
+				first.setCacheDirectory(".");
+				first.addRule("[a-z]+", 1);
+				std::string filename = "./" + first.cacheKey() + ".tsm";
+				std::ofstream fout(filename.c_str());
+				fout << "TSM 1 7 garbage";
+				fout.close();
+
+				std::vector<Token> token_list;
+				first.tokenize("abc", &token_list);
+				expect(token_list.size(), 1);
+				expect(token_list[0].type, 1);
+				std::remove(filename.c_str());
+			});
+
+			it("should throw if rules were added before the cache directory", {
+				Tokenizer first;
+				first.addRule("[a-z]+", 1);
+				expectException(first.setCacheDirectory("."), std::runtime_error);
+			});
+		});
+
+		describe("count()", {
+			std::string str = "abc123_ .data 0x1234567890abcdef ; comment\n\
+				$1234567890abcdef 0b10 \"Hi\" ()#,:= abc";
+
+			it("should count the tokens of each type", {
+				std::vector<Token> token_list;
+				tokenizer.tokenize(str, &token_list);
+				std::vector<uint> expected_counts;
+				for(uint i = 0; i < token_list.size(); i++) {
+					if ((uint)token_list[i].type >= expected_counts.size()) {
+						expected_counts.resize(token_list[i].type + 1, 0);
+					}
+					expected_counts[token_list[i].type]++;
+				}
+
+				std::vector<uint> type_counts;
+				expect(tokenizer.count(str, &type_counts), 0);
+				expect(type_counts.size(), expected_counts.size());
+				for(uint i = 0; i < type_counts.size() && i < expected_counts.size(); i++) {
+					expect(type_counts[i], expected_counts[i]);
+				}
+				expect(type_counts[TokenType::WORD], 2);
+			});
+
+			it("should count invalid tokens", {
+				std::vector<uint> type_counts;
+				expect(tokenizer.count("abc ~ 0x ~", &type_counts), 3);
+				expect(tokenizer.errors(), 3);
+				expect(type_counts[TokenType::WORD], 1);
+			});
+
+			it("should stop at the first invalid token", {
+				std::vector<uint> type_counts;
+				expect(tokenizer.count("abc ~ def ~", &type_counts, true), 1);
+				expect(type_counts[TokenType::WORD], 1);
+				expect(tokenizer.validate(str), true);
+				expect(tokenizer.validate("abc ~"), false);
+			});
+		});
+
+		describe("limits", {
+			std::string str = "abc \"a very long string\" 0x12345678 def";
+
+			it("should truncate long tokens", {
+				Tokenizer limited;
+				setup(limited);
+				limited.setMaxTokenLength(5);
+				std::vector<Token> token_list;
+				limited.tokenize(str, &token_list);
+				expect(token_list.size(), 4);
+				expect(token_list[1].str, "\"a ve");
+				expect(token_list[1].type, TokenType::STRING);
+				expect(token_list[2].str, "0x123");
+				expect(token_list[3].str, "def");
+				expect(token_list[3].column, 37);
+				expect(limited.errors(), 0);
+			});
+
+			it("should reject long tokens", {
+				Tokenizer limited;
+				setup(limited);
+				limited.setMaxTokenLength(8, Tokenizer::REJECT_TOKEN);
+				std::vector<Token> token_list;
+				for(uint i = 0; i < str.size(); i += 3) {
+					limited.feed(str.data() + i, std::min<size_t>(3, str.size() - i), &token_list);
+				}
+				limited.finish(&token_list);
+				expect(token_list.size(), 4);
+				expect(token_list[1].str, "\"a very ");
+				expect(token_list[1].type, -1);
+				expect(token_list[2].type, -1);
+				expect(token_list[3].str, "def");
+				expect(limited.errors(), 2);
+			});
+
+			it("should stop at the token limit and resume", {
+				Tokenizer limited;
+				setup(limited);
+				limited.setMaxTokens(3);
+				std::vector<Token> token_list;
+				limited.tokenize(str, &token_list);
+				expect(token_list.size(), 3);
+				expect(limited.status(), Tokenizer::TOKEN_LIMIT_REACHED);
+				limited.resume(&token_list);
+				expect(token_list.size(), 4);
+				expect(limited.status(), Tokenizer::COMPLETE);
+				expect(token_list[3].str, "def");
+				expect(token_list[3].column, 37);
+			});
+
+			it("should stop at the memory budget and resume a stream", {
+				std::string long_str;
+				for(uint i = 0; i < 2000; i++) {
+					long_str += "word" + std::to_string(i) + " = " + std::to_string(i + 1) + "\n";
+				}
+				std::vector<Token> expected_list;
+				tokenizer.tokenize(long_str, &expected_list);
+
+				Tokenizer limited;
+				setup(limited);
+				limited.setMemoryBudget(1000);
+				std::stringstream ss(long_str);
+				std::vector<Token> token_list;
+				limited.tokenize(&ss, &token_list);
+				uint calls = 1;
+				while(limited.status() != Tokenizer::COMPLETE) {
+					expect(limited.status(), Tokenizer::MEMORY_LIMIT_REACHED);
+					limited.resume(&token_list);
+					calls++;
+				}
+				expectGreaterThan(calls, 100);
+				expect(token_list.size(), expected_list.size());
+				for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+					expect(token_list[i].str, expected_list[i].str);
+					expect(token_list[i].row, expected_list[i].row);
+				}
+			});
+		});
+
+		it("should make the same tokens without a pair table", {
+			std::string str = "abc123_ .data 0x1234567890abcdef ; comment\n\"Hi\n, \\tmy \xC3\xA9 string\" 0b10 ()#,:= @";
+			std::vector<Token> expected_list;
+			tokenizer.tokenize(str, &expected_list);
+
+			Tokenizer single;
+			setup(single);
+			single.setPairTableSize(0);
+			std::vector<Token> token_list;
+			single.tokenize(str, &token_list);
+			expect(token_list.size(), expected_list.size());
+			for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+				expect(token_list[i].str, expected_list[i].str);
+				expect(token_list[i].type, expected_list[i].type);
+				expect(token_list[i].column, expected_list[i].column);
+			}
+		});
+
+		describe("structural pre-pass", {
+			std::string str;
+			for(uint i = 0; i < 200; i++) {
+				str += "label" + std::to_string(i) + ": mov (r1), 0x" + std::to_string(i) + " ; note,\n\t\t#" + std::to_string(i) + " = \"a, (b)\"  ";
+			}
+			std::vector<Token> expected_list;
+			tokenizer.tokenize(str, &expected_list);
+
+			it("should make the same tokens in one call or fed in pieces", {
+				Tokenizer structural;
+				setup(structural);
+				structural.setStructuralPrepass(true);
+				std::vector<Token> token_list;
+				structural.tokenize(str, &token_list);
+				expect(structural.errors(), tokenizer.errors());
+				expect(token_list.size(), expected_list.size());
+				for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+					expect(token_list[i].str, expected_list[i].str);
+					expect(token_list[i].type, expected_list[i].type);
+					expect(token_list[i].row, expected_list[i].row);
+					expect(token_list[i].column, expected_list[i].column);
+				}
+
+				token_list.clear();
+				for(uint i = 0; i < str.size(); i += 37) {
+					structural.feed(str.data() + i, std::min<size_t>(37, str.size() - i), &token_list);
+				}
+				structural.finish(&token_list);
+				expect(token_list.size(), expected_list.size());
+				for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+					expect(token_list[i].str, expected_list[i].str);
+					expect(token_list[i].column, expected_list[i].column);
+				}
+			});
+
+			it("should follow mode changes", {
+				Tokenizer structural;
+				structural.setStructuralPrepass(true);
+				uint quoted = structural.addMode("quoted");
+				structural.addRule(",", TokenType::COMMA);
+				structural.addRule(" +", TokenType::WHITESPACE);
+				structural.addRule("'", TokenType::CHARACTER);
+				structural.addRule(quoted, "[^']+", TokenType::STRING);
+				structural.addRule(quoted, "'", TokenType::CHARACTER);
+				structural.addModeChange(Tokenizer::DEFAULT_MODE, TokenType::CHARACTER, Tokenizer::PUSH_MODE, quoted);
+				structural.addModeChange(quoted, TokenType::CHARACTER, Tokenizer::POP_MODE);
+				std::vector<Token> token_list;
+				structural.tokenize(", ' a, b ',", &token_list);
+				expect(token_list.size(), 6);
+				expect(token_list[3].str, " a, b ");
+				expect(token_list[3].type, TokenType::STRING);
+				expect(token_list[5].type, TokenType::COMMA);
+			});
+		});
+
+		describe("lazy machine", {
+			std::string str = "abc123_ .data 0x1234567890abcdef ; comment\n\"Hi\n, \\tmy \xC3\xA9 string\" 0b10 ()#,:= @";
+			std::vector<Token> expected_list;
+			tokenizer.tokenize(str, &expected_list);
+
+			it("should make the same tokens as a compiled table", {
+				Tokenizer lazy;
+				lazy.useLazyMachine();
+				setup(lazy);
+				std::vector<Token> token_list;
+				lazy.tokenize(str, &token_list);
+				expect(lazy.errors(), tokenizer.errors());
+				expect(token_list.size(), expected_list.size());
+				for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+					expect(token_list[i].str, expected_list[i].str);
+					expect(token_list[i].type, expected_list[i].type);
+					expect(token_list[i].column, expected_list[i].column);
+				}
+			});
+
+			it("should make the same tokens with a tiny cache, fed a byte at a time", {
+				Tokenizer lazy;
+				lazy.useLazyMachine(4096);
+				setup(lazy);
+				std::vector<Token> token_list;
+				for(uint i = 0; i < str.size(); i++) {
+					lazy.feed(str.data() + i, 1, &token_list);
+				}
+				lazy.finish(&token_list);
+				expectGreaterThan(lazy.lazyMachine()->cacheResets(), 0);
+				expect(token_list.size(), expected_list.size());
+				for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+					expect(token_list[i].str, expected_list[i].str);
+					expect(token_list[i].type, expected_list[i].type);
+				}
+			});
+
+			it("should let keywords overlap other rules", {
+				Tokenizer lazy;
+				lazy.useLazyMachine();
+				lazy.addRule(Tokenizer::WHITESPACE, TokenType::WHITESPACE, true);
+				lazy.addLiteral("mov", TokenType::INSTRUCTION);
+				lazy.addLiteral("eax", TokenType::REGISTER);
+				lazy.addRule(Tokenizer::WORD_RULE, TokenType::WORD);
+				std::vector<Token> token_list;
+				lazy.tokenize("mov eax movq", &token_list);
+				expect(token_list.size(), 3);
+				expect(token_list[0].type, TokenType::INSTRUCTION);
+				expect(token_list[1].type, TokenType::REGISTER);
+				expect(token_list[2].type, TokenType::WORD);
+
+				std::vector<uint> type_counts;
+				expect(lazy.count("mov eax movq eax", &type_counts), 0);
+				expect(type_counts[TokenType::REGISTER], 2);
+			});
+
+			it("should be chosen before any rules", {
+				Tokenizer lazy;
+				lazy.addRule(Tokenizer::WORD_RULE, TokenType::WORD);
+				expectException(lazy.useLazyMachine(), std::runtime_error);
+				expect(lazy.lazyMachine() == NULL, true);
+			});
+		});
+
+		describe("checkpoint", {
+			std::string str = "abc123_ .data 0x1234567890abcdef ; comment\n\"Hi\n, \\tmy \xC3\xA9 string\" 0b10 ()#,:= @ \xC3\xA9";
+			std::vector<Token> expected_list;
+			tokenizer.tokenize(str, &expected_list);
+
+			it("should resume in another tokenizer from every offset", {
+				for(uint split = 0; split <= str.size(); split++) {
+					Tokenizer first;
+					setup(first);
+					std::vector<Token> token_list;
+					first.feed(str.data(), split, &token_list);
+					std::string checkpoint = first.checkpoint();
+
+					Tokenizer second;
+					setup(second);
+					expect(second.restore(checkpoint), true);
+					expect(second.offset(), split);
+					second.feed(str.data() + second.offset(), str.size() - split, &token_list);
+					second.finish(&token_list);
+					expect(second.errors(), tokenizer.errors());
+					expect(token_list.size(), expected_list.size());
+					for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+						expect(token_list[i].str, expected_list[i].str);
+						expect(token_list[i].type, expected_list[i].type);
+						expect(token_list[i].row, expected_list[i].row);
+						expect(token_list[i].column, expected_list[i].column);
+					}
+				}
+			});
+
+			it("should keep the modes and a token cut short", {
+				Tokenizer first;
+				uint quoted = setupQuoted(first);
+				std::vector<Token> token_list;
+				first.feed("'abcdef", 7, &token_list);
+
+				Tokenizer second;
+				setupQuoted(second);
+				expect(second.restore(first.checkpoint()), true);
+				expect(second.mode(), quoted);
+				second.feed("gh'", 3, &token_list);
+				second.finish(&token_list);
+				expect(token_list.size(), 3);
+				expect(token_list[1].str, "abcd");
+				expect(token_list[1].type, -1);
+				expect(token_list[2].column, 10);
+				expect(second.mode(), Tokenizer::DEFAULT_MODE);
+			});
+
+			it("should resume a lazy machine", {
+				Tokenizer first;
+				first.useLazyMachine();
+				setup(first);
+				std::vector<Token> token_list;
+				first.feed(str.data(), 20, &token_list);
+
+				Tokenizer second;
+				second.useLazyMachine();
+				setup(second);
+				expect(second.restore(first.checkpoint()), true);
+				second.feed(str.data() + 20, str.size() - 20, &token_list);
+				second.finish(&token_list);
+				expect(token_list.size(), expected_list.size());
+				for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+					expect(token_list[i].str, expected_list[i].str);
+					expect(token_list[i].type, expected_list[i].type);
+				}
+			});
+
+			it("should not restore a checkpoint of other rules", {
+				Tokenizer first;
+				setup(first);
+				std::vector<Token> token_list;
+				first.feed(str.data(), 10, &token_list);
+				Tokenizer other;
+				other.addRule(Tokenizer::WORD_RULE, TokenType::WORD);
+				expect(other.restore(first.checkpoint()), false);
+				expect(other.restore("TCP 1"), false);
+				expect(other.offset(), 0);
+			});
+		});
+
+		describe("segments", {
+			std::string blob(100, 'x');
+			std::string str = "abc \"" + blob + "\" def \"short\"";
+
+			it("should give a long token to the sink in pieces while feeding", {
+				Tokenizer segmenting;
+				setup(segmenting);
+				SegmentRecorder recorder;
+				segmenting.setSegmentSink(16, std::ref(recorder));
+				std::vector<Token> token_list;
+				for(uint i = 0; i < str.size(); i += 7) {
+					segmenting.feed(str.data() + i, std::min<size_t>(7, str.size() - i), &token_list);
+				}
+				segmenting.finish(&token_list);
+
+				expect(recorder.text, "\"" + blob + "\"");
+				expect(recorder.longest, 16);
+				expect(recorder.parts.size(), 7);
+				expect(recorder.parts[0], Tokenizer::BEGIN_SEGMENT);
+				expect(recorder.parts[1], Tokenizer::CONTINUE_SEGMENT);
+				expect(recorder.parts[6], Tokenizer::END_SEGMENT);
+				expect(recorder.types[0], -1);
+				expect(recorder.types[6], TokenType::STRING);
+
+				expect(token_list.size(), 4);
+				expect(token_list[1].type, TokenType::STRING);
+				expect(token_list[1].str, "");
+				expect(token_list[1].column, 5);
+				expect(token_list[2].str, "def");
+				expect(token_list[2].column, 108);
+				expect(token_list[3].str, "\"short\"");
+			});
+
+			it("should not copy segments of text given whole", {
+				Tokenizer segmenting;
+				setup(segmenting);
+				SegmentRecorder recorder;
+				segmenting.setSegmentSink(16, std::ref(recorder));
+				std::vector<Token> token_list;
+				segmenting.tokenize(str, &token_list);
+				expect(recorder.text, "\"" + blob + "\"");
+				expect(recorder.begins[0] == str.data() + 4, true);
+				expect(recorder.begins[1] == str.data() + 20, true);
+				expect(token_list.size(), 4);
+			});
+
+			it("should reject a segmented token that is too long", {
+				Tokenizer segmenting;
+				setup(segmenting);
+				SegmentRecorder recorder;
+				segmenting.setSegmentSink(16, std::ref(recorder));
+				segmenting.setMaxTokenLength(50, Tokenizer::REJECT_TOKEN);
+				std::vector<Token> token_list;
+				segmenting.tokenize(str, &token_list);
+				expect(recorder.text.size(), 102);
+				expect(recorder.types.back(), -1);
+				expect(token_list[1].type, -1);
+				expect(segmenting.errors(), 1);
+			});
+
+			it("should resume a segmented token from a checkpoint", {
+				Tokenizer first;
+				setup(first);
+				SegmentRecorder recorder;
+				first.setSegmentSink(16, std::ref(recorder));
+				std::vector<Token> token_list;
+				first.feed(str.data(), 50, &token_list);
+
+				Tokenizer second;
+				setup(second);
+				second.setSegmentSink(16, std::ref(recorder));
+				expect(second.restore(first.checkpoint()), true);
+				second.feed(str.data() + 50, str.size() - 50, &token_list);
+				second.finish(&token_list);
+				expect(recorder.text, "\"" + blob + "\"");
+				expect(recorder.parts.size(), 7);
+				expect(recorder.parts[3], Tokenizer::CONTINUE_SEGMENT);
+				expect(token_list.size(), 4);
+			});
+
+			it("should throw without a sink", {
+				Tokenizer segmenting;
+				expectException(segmenting.setSegmentSink(16, Tokenizer::SegmentSink()), std::runtime_error);
+			});
+		});
+
+		describe("token buffer", {
+			std::string str = "abc123_ .data \"a string too long to fit in a short string\" ; comment\n0x1234567890abcdef";
+
+			it("should move tokens", {
+				expect(std::is_nothrow_move_assignable<Token>::value, true);
+				expect(std::is_nothrow_move_constructible<Token>::value, true);
+			});
+
+			it("should reuse a cleared buffer without allocating", {
+				TokenBuffer buffer;
+				tokenizer.tokenize(str, &buffer);
+				expect(buffer.size(), 4);
+				buffer.clear();
+				expect(buffer.empty(), true);
+
+				size_t allocations = num_allocations;
+				tokenizer.tokenize(str, &buffer);
+				allocations = num_allocations - allocations;
+				expect(allocations, 0);
+				expect(buffer.size(), 4);
+				expect(buffer[2].str, "\"a string too long to fit in a short string\"");
+				expect(buffer[2].type, TokenType::STRING);
+				expect(buffer[3].row, 2);
+			});
+
+			it("should add to a buffer like a vector", {
+				std::vector<Token> token_list;
+				tokenizer.tokenize(str + " def", &token_list);
+				TokenBuffer buffer;
+				buffer.reserve(8, 64);
+				tokenizer.tokenize(str, &buffer);
+				tokenizer.tokenize(" def", &buffer);
+				expect(buffer.size(), token_list.size());
+				uint i = 0;
+				for(const Token& token : buffer) {
+					if (i < token_list.size()) expect(token.str, token_list[i].str);
+					i++;
+				}
+			});
+		});
+
+		describe("metrics", {
+			std::string str = "abc 12 @ def\n";
+
+			it("should count bytes, tokens and errors", {
+				TokenizerMetrics metrics;
+				Tokenizer measured;
+				measured.setMetrics(&metrics);
+				setup(measured);
+				std::vector<Token> token_list;
+				measured.tokenize(str, &token_list);
+				measured.count(str, NULL);
+
+				TokenizerMetrics::Totals totals = metrics.totals();
+				expect(totals.bytes, str.size() * 2);
+				expect(metrics.tokens(TokenType::WORD), 4);
+				expect(metrics.tokens(TokenType::DECIMAL), 2);
+				expect(metrics.tokens(-1), 2);
+				expect(metrics.tokens(TokenType::WHITESPACE), 0);
+				expectGreaterThan(totals.compiles, 0);
+				expectGreaterThan(totals.memory_bytes, 0);
+			});
+
+			it("should add up the counts of several threads", {
+				TokenizerMetrics metrics;
+				std::thread first(tokenizeRepeatedly, &metrics, &str, 200);
+				std::thread second(tokenizeRepeatedly, &metrics, &str, 300);
+				first.join();
+				second.join();
+				expect(metrics.totals().bytes, str.size() * 500);
+				expect(metrics.tokens(TokenType::WORD), 1000);
+				expect(metrics.tokens(-1), 500);
+			});
+
+			it("should export prometheus text and json", {
+				TokenizerMetrics metrics;
+				tokenizeRepeatedly(&metrics, &str, 1);
+				std::string text = metrics.toPrometheus("lexer");
+				std::string word = std::to_string(TokenType::WORD);
+				expectNotEqual(text.find("# TYPE lexer_bytes_total counter\nlexer_bytes_total 13\n"), std::string::npos);
+				expectNotEqual(text.find("lexer_tokens_total{type=\"" + word + "\"} 2\n"), std::string::npos);
+				expectNotEqual(text.find("lexer_errors_total{type=\"-1\"} 1\n"), std::string::npos);
+				expectNotEqual(text.find("# TYPE lexer_machine_memory_bytes gauge\n"), std::string::npos);
+
+				std::string json = metrics.toJson();
+				expect(json.substr(0, 12), "{\"bytes\":13,");
+				expectNotEqual(json.find("\"errors\":{\"-1\":1}"), std::string::npos);
+
+				metrics.reset();
+				expect(metrics.totals().bytes, 0);
+				expect(metrics.tokens(TokenType::WORD), 0);
+			});
+
+			it("should count large types", {
+				const int LARGE = 1 << 28;
+				TokenizerMetrics metrics;
+				Tokenizer measured;
+				measured.setMetrics(&metrics);
+				measured.addRule("a", LARGE);
+				measured.addRule("b", -LARGE);
+				std::vector<Token> token_list;
+				measured.tokenize("aab", &token_list);
+				expect(metrics.tokens(LARGE), 2);
+				expect(metrics.tokens(-LARGE), 1);
+				expect(metrics.totals().type_counts.size(), 2);
+				expectNotEqual(metrics.toJson().find("\"tokens\":{\"268435456\":2}"), std::string::npos);
+			});
+
+			it("should sum the memory of every tokenizer", {
+				TokenizerMetrics metrics;
+				Tokenizer first;
+				first.setMetrics(&metrics);
+				setup(first);
+				std::vector<Token> token_list;
+				first.tokenize(str, &token_list);
+				uint64_t one = metrics.totals().memory_bytes;
+				expectGreaterThan(one, 0);
+				{
+					Tokenizer second;
+					second.setMetrics(&metrics);
+					setup(second);
+					second.tokenize(str, &token_list);
+					expect(metrics.totals().memory_bytes, one * 2);
+				}
+				expect(metrics.totals().memory_bytes, one);
+				first.setMetrics(NULL);
+				expect(metrics.totals().memory_bytes, 0);
+			});
+		});
+
 		it("should parse multi token string", {
 			std::vector<Token> token_list;
 			std::string str = " \t\vabc123_ .data 0x1234567890abcdef \
@@ -194,4 +1056,27 @@ void setup(Tokenizer& tokenizer) {
 	tokenizer.addRule(":", TokenType::COLON);
 	tokenizer.addRule("#", TokenType::HASH);
 	tokenizer.addRule("=", TokenType::EQUALS);
+}
+
+void tokenizeRepeatedly(TokenizerMetrics* metrics, const std::string* str, uint times) {
+	Tokenizer tokenizer;
+	tokenizer.setMetrics(metrics);
+	setup(tokenizer);
+	std::vector<Token> token_list;
+	for(uint i = 0; i < times; i++) {
+		token_list.clear();
+		tokenizer.tokenize(*str, &token_list);
+	}
+}
+
+// strings in single quotes lexed in their own mode, with tokens of at most 4 bytes
+uint setupQuoted(Tokenizer& tokenizer) {
+	uint quoted = tokenizer.addMode("quoted");
+	tokenizer.addRule("'", TokenType::CHARACTER);
+	tokenizer.addRule(quoted, "[^']+", TokenType::STRING);
+	tokenizer.addRule(quoted, "'", TokenType::CHARACTER);
+	tokenizer.addModeChange(Tokenizer::DEFAULT_MODE, TokenType::CHARACTER, Tokenizer::PUSH_MODE, quoted);
+	tokenizer.addModeChange(quoted, TokenType::CHARACTER, Tokenizer::POP_MODE);
+	tokenizer.setMaxTokenLength(4, Tokenizer::REJECT_TOKEN);
+	return quoted;
 }
\ No newline at end of file
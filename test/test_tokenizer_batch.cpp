@@ -0,0 +1,101 @@
+#include "tokenizer_batch.hpp"
+#include "tokenizer.hpp"
+#include "token_types.hpp"
+#include "token.hpp"
+#include "testing.hpp"
+#include <string>
+#include <vector>
+
+void setup(Tokenizer& tokenizer);
+
+// texts of different lengths so lanes finish at different times
+std::vector<std::string> makeTexts() {
+	std::vector<std::string> texts;
+	texts.push_back("abc123_ .data 0x1234567890abcdef ; comment\n$1234567890abcdef -1234567890 0b10");
+	texts.push_back("");
+	texts.push_back("\"Hi\n, \\tmy \xC3\xA9 string\" ()#,:= @ ;goodbye");
+	texts.push_back("x");
+	texts.push_back("\"unterminated");
+	for(uint i = 0; i < 40; i++) {
+		std::string text;
+		for(uint j = 0; j < i * 7; j++) {
+			text += "word" + std::to_string(j) + " = 0x" + std::to_string(i) + ",\n";
+		}
+		texts.push_back(text + "\xC3\xA9");
+	}
+	return texts;
+}
+
+const uint lane_counts[] = { 1, 4, 8, 16 };
+const std::string valid_texts[] = { "a b c", "", "0x10 = 16" };
+
+int main() {
+	std::vector<std::string> texts = makeTexts();
+
+	describe("tokenizer batch", {
+		Tokenizer tokenizer;
+		setup(tokenizer);
+
+		std::vector<std::vector<Token>> expected_lists(texts.size());
+		std::vector<uint> expected_errors(texts.size());
+		for(uint i = 0; i < texts.size(); i++) {
+			tokenizer.tokenize(texts[i], &expected_lists[i]);
+			expected_errors[i] = tokenizer.errors();
+		}
+
+		it("should make the same tokens as tokenize() with any number of lanes", {
+			for(uint lanes : lane_counts) {
+				TokenizerBatch batch(tokenizer, lanes);
+				std::vector<std::vector<Token>> token_lists;
+				expect(batch.tokenize(texts, &token_lists), true);
+				expect(token_lists.size(), texts.size());
+				for(uint i = 0; i < texts.size() && i < token_lists.size(); i++) {
+					expect(batch.errors(i), expected_errors[i]);
+					expect(token_lists[i].size(), expected_lists[i].size());
+					for(uint t = 0; t < token_lists[i].size() && t < expected_lists[i].size(); t++) {
+						expect(token_lists[i][t].str, expected_lists[i][t].str);
+						expect(token_lists[i][t].type, expected_lists[i][t].type);
+						expect(token_lists[i][t].row, expected_lists[i][t].row);
+						expect(token_lists[i][t].column, expected_lists[i][t].column);
+					}
+				}
+			}
+		});
+
+		it("should return false when no text has invalid tokens", {
+			TokenizerBatch batch(tokenizer, 4);
+			std::vector<Token> token_lists[3];
+			expect(batch.tokenize(valid_texts, 3, token_lists), false);
+			expect(token_lists[0].size(), 3);
+			expect(token_lists[1].size(), 0);
+			expect(token_lists[2][2].type, TokenType::DECIMAL);
+		});
+
+		it("should throw on a bad number of lanes", {
+			expectException(TokenizerBatch(tokenizer, 0), std::runtime_error);
+			expectException(TokenizerBatch(tokenizer, TokenizerBatch::MAX_LANES + 1), std::runtime_error);
+		});
+	});
+
+	displayTestResults();
+
+	return failed();
+}
+
+void setup(Tokenizer& tokenizer) {
+	tokenizer.addRule(Tokenizer::WHITESPACE, TokenType::WHITESPACE, true);
+	tokenizer.addRule(";[^\n]*\n?", TokenType::COMMENT, true);
+	tokenizer.addRule(Tokenizer::WORD_RULE, TokenType::WORD);
+	tokenizer.addRule("\\.[\\w]+", TokenType::DIRECTIVE);
+	tokenizer.addRule(Tokenizer::HEX_RULE, TokenType::HEX);
+	tokenizer.addRule(Tokenizer::DECIMAL_RULE, TokenType::DECIMAL);
+	tokenizer.addRule(Tokenizer::OCTAL_RULE, TokenType::OCTAL);
+	tokenizer.addRule(Tokenizer::BINARY_RULE, TokenType::BINARY);
+	tokenizer.addRule(Tokenizer::DQ_STRING_RULE, TokenType::STRING);
+	tokenizer.addRule("\\(", TokenType::OPEN_PAREN);
+	tokenizer.addRule(")", TokenType::CLOSE_PAREN);
+	tokenizer.addRule(",", TokenType::COMMA);
+	tokenizer.addRule(":", TokenType::COLON);
+	tokenizer.addRule("#", TokenType::HASH);
+	tokenizer.addRule("=", TokenType::EQUALS);
+}
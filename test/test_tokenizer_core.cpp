@@ -0,0 +1,182 @@
+#include "tokenizer_core.hpp"
+#include "tokenizer.hpp"
+#include "token_types.hpp"
+#include "token.hpp"
+#include "testing.hpp"
+#include <sstream>
+#include <string>
+#include <vector>
+
+void setup(Tokenizer& tokenizer);
+
+// collects the text of each token, checking positions are not tracked
+struct Collect {
+	std::vector<std::string>* strings;
+	void operator()(int, const char* begin, const char* end, const NoPosition& position) {
+		strings->push_back(std::string(begin, end) + std::to_string(position.row()));
+	}
+};
+
+typedef TokenizerCore<> DefaultCore;
+typedef TokenizerCore<RowColumnPosition, VectorSink, KeepErrors, MemorySource, IgnoreTypes, UseModes> FullCore;
+typedef TokenizerCore<RowColumnPosition, VectorSink, KeepErrors, StreamSource, IgnoreTypes> StreamCore;
+typedef TokenizerCore<OffsetPosition, ColumnSink, SkipErrors, MemorySource, IgnoreTypes> ColumnCore;
+typedef TokenizerCore<NoPosition, CallbackSink<Collect>, StopAtError, MemorySource, IgnoreTypes> CallbackCore;
+typedef TokenizerCore<OffsetPosition, ColumnSink, ThrowOnError, MemorySource, IgnoreTypes> ThrowingCore;
+typedef TokenizerCore<RowColumnPosition, BufferSink, KeepErrors, MemorySource, IgnoreTypes> BufferCore;
+
+int main() {
+	std::string text = "abc123_ .data 0x1234567890abcdef ; comment\n\
+		$1234567890abcdef -1234567890 0b10 \"Hi\n, \\tmy \xC3\xA9 string\" ()#,:= @ ;goodbye";
+
+	// long enough to need several chunks, with a string longer than a chunk
+	std::string long_text = "\"" + std::string(10000, 'x') + "\"\n";
+	for(uint i = 0; i < 1000; i++) {
+		long_text += "word" + std::to_string(i) + " = 0x" + std::to_string(i) + " \xC3\xA9,\n";
+	}
+
+	describe("tokenizer core", {
+		Tokenizer tokenizer;
+		setup(tokenizer);
+
+		it("should make the same tokens as tokenize()", {
+			std::vector<Token> expected_list;
+			tokenizer.tokenize(text, &expected_list);
+
+			std::vector<Token> token_list;
+			FullCore core(tokenizer, VectorSink(&token_list));
+			expect(core.tokenize(MemorySource(text)), true);
+			expect(core.errors(), tokenizer.errors());
+			expect(token_list.size(), expected_list.size());
+			for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+				expect(token_list[i].str, expected_list[i].str);
+				expect(token_list[i].type, expected_list[i].type);
+				expect(token_list[i].row, expected_list[i].row);
+				expect(token_list[i].column, expected_list[i].column);
+			}
+		});
+
+		it("should give ignored types to the sink by default", {
+			std::vector<Token> token_list;
+			DefaultCore core(tokenizer, VectorSink(&token_list));
+			expect(core.tokenize(MemorySource("abc ;x\n1")), false);
+			expect(token_list.size(), 4);
+			expect(token_list[1].type, TokenType::WHITESPACE);
+			expect(token_list[2].type, TokenType::COMMENT);
+			expect(token_list[3].row, 2);
+		});
+
+		it("should apply mode changes only with UseModes", {
+			const int QUOTE = 100;
+			const int TEXT = 101;
+			Tokenizer mode_tokenizer;
+			uint string_mode = mode_tokenizer.addMode("string");
+			mode_tokenizer.addRule(Tokenizer::WORD_RULE, TokenType::WORD);
+			mode_tokenizer.addRule(Tokenizer::WHITESPACE, TokenType::WHITESPACE, true);
+			mode_tokenizer.addRule("\"", QUOTE);
+			mode_tokenizer.addRule(string_mode, "[^\"]+", TEXT);
+			mode_tokenizer.addRule(string_mode, "\"", QUOTE);
+			mode_tokenizer.addModeChange(Tokenizer::DEFAULT_MODE, QUOTE, Tokenizer::PUSH_MODE, string_mode);
+			mode_tokenizer.addModeChange(string_mode, QUOTE, Tokenizer::POP_MODE);
+
+			std::string quoted = "say \"hi there\" now";
+			std::vector<Token> expected_list;
+			mode_tokenizer.tokenize(quoted, &expected_list);
+
+			std::vector<Token> token_list;
+			DefaultCore core(mode_tokenizer, VectorSink(&token_list));
+			expectException(core.tokenize(MemorySource(quoted)), std::runtime_error);
+
+			FullCore full(mode_tokenizer, VectorSink(&token_list));
+			expect(full.tokenize(MemorySource(quoted)), false);
+			expect(token_list.size(), expected_list.size());
+			for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+				expect(token_list[i].type, expected_list[i].type);
+			}
+			expect(token_list[2].str, "hi there");
+			expect(full.mode(), Tokenizer::DEFAULT_MODE);
+		});
+
+		it("should reuse the tokens of a buffer", {
+			std::vector<Token> expected_list;
+			tokenizer.tokenize(text, &expected_list);
+
+			TokenBuffer buffer;
+			BufferCore core(tokenizer, BufferSink(&buffer));
+			core.tokenize(MemorySource(text));
+			buffer.clear();
+			core.tokenize(MemorySource(text));
+			expect(buffer.size(), expected_list.size());
+			for(uint i = 0; i < buffer.size() && i < expected_list.size(); i++) {
+				expect(buffer[i].str, expected_list[i].str);
+				expect(buffer[i].column, expected_list[i].column);
+			}
+		});
+
+		it("should read a stream in chunks", {
+			std::vector<Token> expected_list;
+			tokenizer.tokenize(long_text, &expected_list);
+
+			std::vector<Token> token_list;
+			std::stringstream ss(long_text);
+			StreamCore core(tokenizer, VectorSink(&token_list));
+			core.tokenize(StreamSource(&ss));
+			expect(token_list.size(), expected_list.size());
+			for(uint i = 0; i < token_list.size() && i < expected_list.size(); i++) {
+				expect(token_list[i].str, expected_list[i].str);
+				expect(token_list[i].column, expected_list[i].column);
+			}
+			expect(core.position().offset(), long_text.size());
+		});
+
+		it("should record offsets and skip invalid tokens", {
+			ColumnCore core(tokenizer);
+			expect(core.tokenize(MemorySource(text)), true);
+			expect(core.errors(), 1);
+			ColumnSink& columns = core.sink();
+			expect(columns.size(), 13);
+			for(uint i = 0; i < columns.size(); i++) {
+				expectNotEqual(columns.types[i], TokenType::INVALID);
+			}
+			expect(text.substr(columns.offsets[2], columns.lengths[2]), "0x1234567890abcdef");
+			expect(columns.types[2], TokenType::HEX);
+		});
+
+		it("should stop or throw at the first invalid token", {
+			std::vector<std::string> strings;
+			Collect collect = { &strings };
+			CallbackCore core(tokenizer, callbackSink(collect));
+			std::string invalid = "abc @ def";
+			expect(core.tokenize(MemorySource(invalid)), true);
+			expect(strings.size(), 1);
+			expect(strings[0], "abc0");
+
+			ThrowingCore throwing(tokenizer);
+			expectException(throwing.tokenize(MemorySource(invalid)), std::runtime_error);
+			expect(throwing.sink().size(), 1);
+			expect(throwing.position().offset(), 4);
+		});
+	});
+
+	displayTestResults();
+
+	return failed();
+}
+
+void setup(Tokenizer& tokenizer) {
+	tokenizer.addRule(Tokenizer::WHITESPACE, TokenType::WHITESPACE, true);
+	tokenizer.addRule(";[^\n]*\n?", TokenType::COMMENT, true);
+	tokenizer.addRule(Tokenizer::WORD_RULE, TokenType::WORD);
+	tokenizer.addRule("\\.[\\w]+", TokenType::DIRECTIVE);
+	tokenizer.addRule(Tokenizer::HEX_RULE, TokenType::HEX);
+	tokenizer.addRule(Tokenizer::DECIMAL_RULE, TokenType::DECIMAL);
+	tokenizer.addRule(Tokenizer::OCTAL_RULE, TokenType::OCTAL);
+	tokenizer.addRule(Tokenizer::BINARY_RULE, TokenType::BINARY);
+	tokenizer.addRule(Tokenizer::DQ_STRING_RULE, TokenType::STRING);
+	tokenizer.addRule("\\(", TokenType::OPEN_PAREN);
+	tokenizer.addRule(")", TokenType::CLOSE_PAREN);
+	tokenizer.addRule(",", TokenType::COMMA);
+	tokenizer.addRule(":", TokenType::COLON);
+	tokenizer.addRule("#", TokenType::HASH);
+	tokenizer.addRule("=", TokenType::EQUALS);
+}